@@ -13,6 +13,7 @@ You need to run \'batchInstrument\' first, then run %(prog)s under the same dire
 import sys, os, shutil
 import yaml
 import subprocess
+import hashlib
 
 prog = os.path.basename(sys.argv[0])
 script_path = os.path.realpath(os.path.dirname(__file__))
@@ -63,10 +64,44 @@ def phraseMasterYaml():
 		sys.exit(-1)
 	return master_yaml_dict, model_list
 
+def modelDigest(workdir):
+	# a model is done as long as its input.yaml does not change
+	try:
+		with open(os.path.join(workdir, 'input.yaml'), 'rb') as model_yaml_file:
+			return hashlib.sha1(model_yaml_file.read()).hexdigest()[0:16]
+	except IOError:
+		return "-"
+
+def readBatchJournal():
+	# models completed by previous runs, from the lines "done <model> <digest>"
+	# of batch_journal.txt. The campaign of an interrupted model is resumed by
+	# injectfault itself
+	completed = {}
+	try:
+		with open(os.path.join(basedir, 'batch_journal.txt'), 'r') as journal:
+			for line in journal:
+				flds = line.split()
+				if len(flds) == 3 and flds[0] == "done":
+					completed[flds[1]] = flds[2]
+	except IOError:
+		pass
+	return completed
+
+def recordModel(model, digest):
+	with open(os.path.join(basedir, 'batch_journal.txt'), 'a') as journal:
+		journal.write("done " + model + " " + digest + "\n")
+		journal.flush()
+		os.fsync(journal.fileno())
+
 def callInjectfault(model_list, *argv):
 	num_failed = 0
+	completed = readBatchJournal()
 	for model in model_list:
 		workdir = os.path.join(basedir, "llfi-"+model)
+		digest = modelDigest(workdir)
+		if completed.get(model) == digest:
+			print ("\ninjectfault:", model, " completed before, skipped")
+			continue
 		try:
 			os.chdir(workdir)
 		except:
@@ -90,6 +125,7 @@ def callInjectfault(model_list, *argv):
 		else:
 			print (o.decode())
 			print ("injectfault:", model, " succeed!")
+			recordModel(model, digest)
 		os.chdir(basedir)
 	return num_failed
 
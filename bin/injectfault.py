@@ -24,11 +24,60 @@ import yaml
 import time
 import random
 import shutil
+import threading
+import tempfile
+import mmap
+import struct
+import urllib.parse
+import signal
+import queue
+import math
+import errno
+import statistics
+import hashlib
+import fcntl
+import socket
 
 runOverride = False
 optionlist = []
 defaultTimeout = 500
 
+#hang detection, see checkHang()
+HANG_CHECK_INTERVAL = 0.25
+HEARTBEAT_MAGIC = b"LLFIHBT\0"
+HEARTBEAT_FORMAT = "<8siiQiiQqq"
+HEARTBEAT_HANG_INJECTED = 3
+HEARTBEAT_CRASHED = 4
+hangStall = 0
+hangFactor = 0
+
+#streaming output comparison, see OutputWatch
+sdcStop = False
+sdcFiles = []
+goldencycles = 0
+goldentime = 0
+
+#worker pool, see campaignOption in input_masterlist.yaml. Without workers the
+#experiments run one after another in the base directory
+workers = 0
+sandboxInput = "copy"
+snapshotState = {}
+snapshotLock = threading.Lock()
+replayGolden = False
+resultLock = threading.Lock()
+
+#adaptive stopping, see targetPrecision in input_masterlist.yaml
+OUTCOMES = ["SDC", "crash", "hang"]
+sites = {}
+
+#campaign journal, see Journal. Completed experiments are fsync'ed to disk
+#every JOURNAL_SYNC_RECORDS records or JOURNAL_SYNC_INTERVAL seconds
+JOURNAL_SYNC_RECORDS = 32
+JOURNAL_SYNC_INTERVAL = 5.0
+#claims of other hosts, whose processes cannot be looked up, lapse
+#JOURNAL_CLAIM_GRACE seconds after the timeout of their experiment
+JOURNAL_CLAIM_GRACE = 300
+
 # basedir is assigned in parseArgs(args)
 basedir = ""
 prog = os.path.basename(sys.argv[0])
@@ -96,6 +145,8 @@ def checkInputYaml():
       if opt=="forceRun":
         runOverride = True
         print("Kernel: Forcing run")
+  if "campaignOption" in doc:
+    parseCampaignOption(doc["campaignOption"])
   if "defaultTimeout" in doc:
     defaultTimeout = int(doc["defaultTimeout"])
     assert defaultTimeout > 0, "The timeOut option must be greater than 0"
@@ -103,6 +154,30 @@ def checkInputYaml():
     print("Default timeout is set to " + str(defaultTimeout) + " by default.")
 
 
+def parseCampaignOption(campaignOption):
+  global workers, sandboxInput, replayGolden
+  for key in campaignOption:
+    val = campaignOption[key]
+    if key == "workers":
+      if not isinstance(val, int) or val < 0:
+        print("ERROR: workers must be a non-negative integer in input.yaml.")
+        exit(1)
+      workers = val if val > 0 else os.cpu_count()
+    elif key == "sandboxInput":
+      if val not in ["link", "copy"]:
+        print("ERROR: sandboxInput must be link or copy in input.yaml.")
+        exit(1)
+      sandboxInput = val
+    elif key == "replayGolden":
+      if not isinstance(val, bool):
+        print("ERROR: replayGolden must be True or False in input.yaml.")
+        exit(1)
+      replayGolden = val
+    else:
+      print("ERROR: Unknown campaignOption " + key + " in input.yaml.")
+      exit(1)
+
+
 def print_progressbar(idx, nruns):
   pct = (float(idx) / float(nruns))
   WIDTH = 50
@@ -115,14 +190,20 @@ def print_progressbar(idx, nruns):
 
 ################################################################################
 def config():
-  global inputdir, outputdir, errordir, stddir, llfi_stat_dir
+  global inputdir, outputdir, errordir, stddir, llfi_stat_dir, baselinedir, planfile, journalfile
+  global storedir, golden, replaydir
   # config
   llfi_dir = os.path.dirname(fi_exe)
+  baselinedir = os.path.join(llfi_dir, "baseline")
   inputdir = os.path.join(llfi_dir, "prog_input")
   outputdir = os.path.join(llfi_dir, "prog_output")
   errordir = os.path.join(llfi_dir, "error_output")
   stddir = os.path.join(llfi_dir, "std_output")
   llfi_stat_dir = os.path.join(llfi_dir, "llfi_stat_output")
+  planfile = os.path.join(llfi_dir, "fi_plan.txt")
+  journalfile = os.path.join(llfi_dir, "fi_journal.txt")
+  storedir = os.path.join(llfi_dir, "store")
+  replaydir = os.path.join(llfi_dir, "goldtrace_cache")
 
   if not os.path.isdir(outputdir):
     os.mkdir(outputdir)
@@ -134,48 +215,331 @@ def config():
     os.mkdir(stddir)
   if not os.path.isdir(llfi_stat_dir):
     os.mkdir(llfi_stat_dir)
+  if not os.path.isdir(storedir):
+    os.mkdir(storedir)
+  golden = goldenDigests()
 
 
 ################################################################################
-def execute( execlist, timeout):
-  global outputfile
-  global return_codes
+def execute(execlist, timeout, worker, run_id, outputfile):
   print(' '.join(execlist))
   #get state of directory
-  dirSnapshot()
-  p = subprocess.Popen(execlist, stdout = subprocess.PIPE)
-  elapsetime = 0
-  while (elapsetime < timeout):
-    elapsetime += 1
-    time.sleep(1)
-    if p.poll() is not None:
-      moveOutput()
-      print("\t program finish", p.returncode)
-      print("\t time taken", elapsetime,"\n")
-      outputFile = open(outputfile, "wb")
-      outputFile.write(p.communicate()[0])
-      outputFile.close()
-      replenishInput() #for cases where program deletes input or alters them each run
-      # Keep a dict of all return codes received.
-      if p.returncode in return_codes:
-        return_codes[p.returncode] += 1
+  dirBefore = dirSnapshot(worker.workdir)
+  resetHeartbeat(worker)
+  starttime = time.time()
+  p = subprocess.Popen(execlist, stdout = subprocess.PIPE, cwd = worker.workdir)
+
+  #stdout is drained by a reader thread, which also counts the output bytes as
+  #progress and hashes them for the store, and a waiter thread signals the
+  #exit, so normal runs return as soon as they finish instead of at the next
+  #poll
+  output = []
+  digest = hashlib.sha256()
+  watch = OutputWatch(worker.workdir)
+  def readOutput():
+    while True:
+      chunk = os.read(p.stdout.fileno(), 65536)
+      if not chunk:
+        break
+      output.append(chunk)
+      digest.update(chunk)
+      watch.feedStdout(chunk)
+  def waitChild():
+    p.wait()
+    finished.set()
+  finished = threading.Event()
+  reader = threading.Thread(target = readOutput)
+  reader.daemon = True
+  reader.start()
+  waiter = threading.Thread(target = waitChild)
+  waiter.daemon = True
+  waiter.start()
+
+  hang = checkHang(finished, starttime, timeout, output, worker, watch)
+  if hang is None:
+    reader.join()
+    elapsetime = time.time() - starttime
+    artifacts = moveOutput(dirBefore, run_id, worker.workdir)
+    returncode = p.returncode
+    crash = readCrashRecord(worker)
+    if crash is not None:
+      #the runtime caught the signal and exited with 128 + signal, report the
+      #run as killed by it
+      returncode = -crash[0]
+      print("\t program crashed,", describeCrash(crash))
+    print("\t program finish", returncode)
+    print("\t time taken", "%.2f" % elapsetime,"\n")
+    artifacts[outputfile] = storeOutput(outputfile, output, digest.hexdigest())
+    replenishInput(worker.workdir) #for cases where program deletes input or alters them each run
+    # Keep a dict of all return codes received.
+    with resultLock:
+      if returncode in return_codes:
+        return_codes[returncode] += 1
       else:
-        return_codes[p.returncode] = 1
-      return str(p.returncode)
+        return_codes[returncode] = 1
+    return str(returncode), artifacts
 
-  # child timed out!
-  if "TO" in return_codes:
-    return_codes["TO"] += 1
-  else:
-    return_codes["TO"] = 1
+  # child timed out, or its output diverged!
+  code = "SDC" if watch.diverged else "TO"
+  with resultLock:
+    if code in return_codes:
+      return_codes[code] += 1
+    else:
+      return_codes[code] = 1
   #inputFile.close()
-  print("\tParent : Child timed out. Cleaning up ... ")
+  print("\tParent : Child " + hang + ". Cleaning up ... ")
   p.kill()
+  waiter.join()
+  #a grandchild may still hold stdout open, do not wait for it
+  reader.join(1)
+
+  artifacts = moveOutput(dirBefore, run_id, worker.workdir)
+  replenishInput(worker.workdir)
 
-  moveOutput()
-  replenishInput()
+  if watch.diverged:
+    #the output up to the divergence is kept
+    artifacts[outputfile] = storeOutput(outputfile, output, digest.hexdigest())
+    return "sdc-terminated", artifacts
+  return "timed-out", artifacts
 
-  return "timed-out"
+################################################################################
+def checkHang(finished, starttime, timeout, output, worker, watch):
+  #wait for the child, return None when it exits or the reason it is
+  #considered hung: the timeout, no progress (cycles or output bytes) for
+  #hangStall seconds, or more than hangFactor times the golden cycles or time.
+  #With sdcStop a run whose output diverged from the golden run is stopped too
+  lastProgress = None
+  lastChange = starttime
+  while not finished.wait(HANG_CHECK_INTERVAL):
+    now = time.time()
+    if sdcStop and watch.poll():
+      return "diverged from the golden output"
+    if readHeartbeatState(worker) == HEARTBEAT_HANG_INJECTED:
+      return "hangs by an injected hang"
+    if now - starttime >= timeout:
+      return "timed out"
+    cycles = readHeartbeatCycles(worker)
+    progress = (cycles, sum(len(chunk) for chunk in output))
+    if progress != lastProgress:
+      lastProgress = progress
+      lastChange = now
+    elif hangStall > 0 and now - lastChange >= hangStall:
+      return "made no progress for " + str(hangStall) + " seconds"
+    if hangFactor > 0:
+      if goldencycles > 0 and cycles > hangFactor * goldencycles:
+        return "exceeded " + str(hangFactor) + " times the golden cycles"
+      if goldentime > 0 and now - starttime > hangFactor * max(goldentime, 1.0):
+        return "exceeded " + str(hangFactor) + " times the golden run time"
+  return None
+
+################################################################################
+class OutputWatch:
+  #compares the stdout and the sdcFiles of a running experiment with the
+  #golden run as they are written. diverged is set at the first byte that
+  #differs or goes past the end of the golden output; an output that is only
+  #shorter is left to the comparison of the finished run
+  def __init__(self, workdir):
+    self.workdir = workdir
+    self.diverged = False
+    self.stdoutPos = 0
+    self.filePos = {}
+
+  def compare(self, golden, pos, data):
+    if golden is None:
+      return
+    if golden[pos:pos+len(data)] != data:
+      self.diverged = True
+
+  def feedStdout(self, chunk):
+    if sdcStop and not self.diverged:
+      self.compare(goldenStdout, self.stdoutPos, chunk)
+    self.stdoutPos += len(chunk)
+
+  def poll(self):
+    #read what the sdcFiles grew by since the last poll
+    for name in sdcFiles:
+      if self.diverged:
+        break
+      path = os.path.join(self.workdir, name)
+      if not os.path.isfile(path):
+        continue
+      pos = self.filePos.get(name, 0)
+      if os.path.getsize(path) < pos:
+        #rewritten from the start
+        pos = 0
+      watched = open(path, 'rb')
+      watched.seek(pos)
+      data = watched.read()
+      watched.close()
+      self.compare(goldenFiles.get(name), pos, data)
+      self.filePos[name] = pos + len(data)
+    return self.diverged
+
+def loadGoldenOutputs():
+  #golden stdout and sdcFiles, the golden copy of a file <name>.<ext> is
+  #baseline/<name>.prof.<ext>
+  global goldenStdout, goldenFiles
+  goldenStdout = None
+  goldenFiles = {}
+  if not sdcStop:
+    return
+  if os.path.isfile(os.path.join(baselinedir, "golden_std_output")):
+    goldenFile = open(os.path.join(baselinedir, "golden_std_output"), 'rb')
+    goldenStdout = goldenFile.read()
+    goldenFile.close()
+  for name in sdcFiles:
+    flds = name.split(".")
+    goldenName = '.'.join(flds[0:-1] + ["prof"] + flds[-1:]) if len(flds) > 1 else name + ".prof"
+    if not os.path.isfile(os.path.join(baselinedir, goldenName)):
+      print("WARNING: " + goldenName + " is not in " + baselinedir + ", " + name + " is not compared while written")
+      continue
+    goldenFile = open(os.path.join(baselinedir, goldenName), 'rb')
+    goldenFiles[name] = goldenFile.read()
+    goldenFile.close()
+
+################################################################################
+def openHeartbeat(worker):
+  #shared progress page, updated by the runtime (see LLFIHeartbeat in Utils.h)
+  shmdir = "/dev/shm" if os.path.isdir("/dev/shm") else tempfile.gettempdir()
+  fd, worker.heartbeatfile = tempfile.mkstemp(prefix = "llfi.heartbeat.", dir = shmdir)
+  os.write(fd, b'\0' * mmap.PAGESIZE)
+  worker.heartbeat = mmap.mmap(fd, mmap.PAGESIZE)
+  os.close(fd)
+
+def closeHeartbeat(worker):
+  worker.heartbeat.close()
+  os.remove(worker.heartbeatfile)
+
+def resetHeartbeat(worker):
+  worker.heartbeat[0:struct.calcsize(HEARTBEAT_FORMAT)] = b'\0' * struct.calcsize(HEARTBEAT_FORMAT)
+
+def readHeartbeatState(worker):
+  fields = struct.unpack_from(HEARTBEAT_FORMAT, worker.heartbeat, 0)
+  if fields[0] != HEARTBEAT_MAGIC:
+    return 0
+  return fields[1]
+
+def readHeartbeatCycles(worker):
+  fields = struct.unpack_from(HEARTBEAT_FORMAT, worker.heartbeat, 0)
+  if fields[0] != HEARTBEAT_MAGIC:
+    return 0
+  return fields[3]
+
+def readCrashRecord(worker):
+  #(signal, faulting address, llfi_index of the last target executed, cycles
+  #since the injection) written by the runtime when the run crashed, else None
+  fields = struct.unpack_from(HEARTBEAT_FORMAT, worker.heartbeat, 0)
+  if fields[0] != HEARTBEAT_MAGIC or fields[1] != HEARTBEAT_CRASHED:
+    return None
+  return fields[4], fields[6], fields[7], fields[8]
+
+def describeCrash(crash):
+  sig, address, index, latency = crash
+  try:
+    name = signal.Signals(sig).name
+  except ValueError:
+    name = "signal " + str(sig)
+  return (name + " at address " + hex(address) + ", last llfi_index " + str(index) +
+          ", " + (str(latency) + " cycles after the injection" if latency >= 0 else "no fault injected"))
+
+################################################################################
+def replayGoldenWindows(timeout, worker, run_id):
+  #With rolling hash tracing the golden run only keeps one hash per window.
+  #Rerun the profiling executable to dump the golden records of every window
+  #at which this run's traces diverged, as llfi.stat.goldtrace[.t<k>].<run_id>.txt.
+  #Each replay is kept in replaydir under its windows, runs diverging at the
+  #same windows reuse it
+  windows = []
+  for each in os.listdir(llfi_stat_dir):
+    flds = each.split(".")
+    if not each.startswith("llfi.stat.trace.") or flds[-2] != run_id:
+      continue
+    ordinal = 0
+    if len(flds) == 6 and flds[3].startswith("t") and flds[3][1:].isdigit():
+      ordinal = int(flds[3][1:])
+    traceFile = open(os.path.join(llfi_stat_dir, each), 'r')
+    lines = traceFile.readlines()
+    traceFile.close()
+    if len(lines) == 0 or not lines[0].startswith("#TraceStartInstNumber:"):
+      continue
+    count = len([line for line in lines if not line.startswith("#")])
+    windows.append("%d:%s:%d" % (ordinal, lines[0].split()[1], count))
+
+  prof_exe = fi_exe.replace("-faultinjection.exe", "-profiling.exe")
+  if len(windows) == 0 or not os.path.isfile(prof_exe):
+    return
+
+  cached = os.path.join(replaydir, hashlib.sha1(','.join(sorted(windows)).encode()).hexdigest())
+  if not os.path.isdir(cached):
+    replayWindows(prof_exe, windows, timeout, worker, cached)
+  if not os.path.isdir(cached):
+    return
+  for each in os.listdir(cached):
+    flds = each.split(".")
+    newName = '.'.join(flds[0:-1])+'.'+run_id+'.'+flds[-1]
+    shutil.copyfile(os.path.join(cached, each), os.path.join(llfi_stat_dir, newName))
+
+def replayWindows(prof_exe, windows, timeout, worker, cached):
+  dirBefore = dirSnapshot(worker.workdir)
+  env = dict(os.environ)
+  env["LLFI_TRACE_WINDOW"] = ','.join(windows)
+  p = subprocess.Popen([prof_exe] + optionlist, stdout = subprocess.DEVNULL, env = env, cwd = worker.workdir)
+  try:
+    p.wait(timeout)
+  except subprocess.TimeoutExpired:
+    p.kill()
+    p.wait()
+  #filled under a private name, so other workers only see complete replays
+  os.makedirs(replaydir, exist_ok = True)
+  filling = tempfile.mkdtemp(dir = replaydir)
+  for each in os.listdir(worker.workdir):
+    if each in dirBefore:
+      continue
+    path = os.path.join(worker.workdir, each)
+    if each.startswith("llfi.stat.goldtrace"):
+      os.rename(path, os.path.join(filling, each))
+    elif os.path.isfile(path):
+      #outputs of the replay are not part of the experiment
+      os.remove(path)
+  replenishInput(worker.workdir)
+  try:
+    os.rename(filling, cached)
+  except OSError:
+    #replayed by another worker meanwhile
+    shutil.rmtree(filling)
+
+################################################################################
+def writeDaikonConfig():
+  #runtime options of DaikonTraceLib, see daikonOption in input_masterlist.yaml
+  daikonOptions = {"arrayPolicy": "array_policy", "arrayMax": "array_max", "arrayUnknown": "array_unknown",
+                   "dtraceFormat": "dtrace_format", "samplePolicy": "sample_policy", "sampleLimit": "sample_limit"}
+  if "daikonOption" not in doc:
+    if os.path.isfile("llfi.config.daikon.txt"):
+      os.remove("llfi.config.daikon.txt")
+    return
+  daikonconfig_File = open("llfi.config.daikon.txt", 'w')
+  for key in doc["daikonOption"]:
+    val = doc["daikonOption"][key]
+    if key not in daikonOptions:
+      print("ERROR: Unknown daikonOption " + key + " in input.yaml.")
+      exit(1)
+    if key == "arrayPolicy" and val not in ["first", "stride", "full"]:
+      print("ERROR: arrayPolicy must be first, stride or full in input.yaml.")
+      exit(1)
+    if key == "dtraceFormat" and val not in ["text", "binary"]:
+      print("ERROR: dtraceFormat must be text or binary in input.yaml.")
+      exit(1)
+    if key.startswith("array") and key != "arrayPolicy" and (not isinstance(val, int) or val < 0):
+      print("ERROR: " + key + " must be a non-negative integer in input.yaml.")
+      exit(1)
+    if key == "samplePolicy" and val not in ["none", "first", "reservoir", "backoff"]:
+      print("ERROR: samplePolicy must be none, first, reservoir or backoff in input.yaml.")
+      exit(1)
+    if key == "sampleLimit" and (not isinstance(val, int) or val < 1):
+      print("ERROR: sampleLimit must be a positive integer in input.yaml.")
+      exit(1)
+    daikonconfig_File.write(daikonOptions[key] + "=" + str(val) + '\n')
+  daikonconfig_File.close()
 
 ################################################################################
 def storeInputFiles():
@@ -195,54 +559,462 @@ def storeInputFiles():
       inputList.append(opt)
 
 ################################################################################
-def replenishInput():#TODO make condition to skip this if input is present
+def replenishInput(workdir):#TODO make condition to skip this if input is present
+  if workdir != ".":
+    #sandboxes are staged again for every experiment
+    return
   for each in inputList:
     if not os.path.isfile(each):#copy deleted inputfiles back to basedir
       shutil.copy2(os.path.join(inputdir, each), each)
 
 ################################################################################
-def moveOutput():
-  #move all newly created files
-  newfiles = [_file for _file in os.listdir(".")]
+def moveOutput(dirBefore, run_id, workdir):
+  #move all newly created files, returns where they were moved to with the
+  #content hash of the program outputs, which are kept in the store
+  moved = {}
+  newfiles = [_file for _file in os.listdir(workdir)]
   for each in newfiles:
     if each not in dirBefore:
-      fileSize = os.stat(each).st_size
+      path = os.path.join(workdir, each)
+      fileSize = os.stat(path).st_size
       if fileSize == 0 and each.startswith("llfi"):
         #empty library output, can delete
         print(each+ " is going to be deleted for having size of " + str(fileSize))
-        os.remove(each)
+        os.remove(path)
       else:
         flds = each.split(".")
         newName = '.'.join(flds[0:-1])
         newName+='.'+run_id+'.'+flds[-1]
         if newName.startswith("llfi"):
-          os.rename(each, os.path.join(llfi_stat_dir, newName))
+          os.rename(path, os.path.join(llfi_stat_dir, newName))
+          moved[os.path.join(llfi_stat_dir, newName)] = None
         else:
-          os.rename(each, os.path.join(outputdir, newName))
+          os.rename(path, os.path.join(outputdir, newName))
+          moved[os.path.join(outputdir, newName)] = storeFile(os.path.join(outputdir, newName))
+  return moved
 
 ################################################################################
-def dirSnapshot():
+#Content-addressed store of the program outputs, llfi/store/<xx>/<sha256>.
+#The outputs of a run stay at their usual paths, as read-only hard links of
+#the one copy of each distinct content, so benign runs cost no disk space.
+#An object that reached the hard link limit of the file system is continued
+#by <sha256>.1, <sha256>.2, ...
+def hashFile(path):
+  digest = hashlib.sha256()
+  hashed = open(path, 'rb')
+  while True:
+    chunk = hashed.read(1 << 20)
+    if not chunk:
+      break
+    digest.update(chunk)
+  hashed.close()
+  return digest.hexdigest()
+
+def storeObjects(digest):
+  objdir = os.path.join(storedir, digest[0:2])
+  if not os.path.isdir(objdir):
+    os.makedirs(objdir, exist_ok = True)
+  gen = 0
+  while True:
+    yield os.path.join(objdir, digest + ("." + str(gen) if gen > 0 else ""))
+    gen += 1
+
+def storeFile(path, digest = None):
+  #replace path by a link to the stored copy of its content, or make it the
+  #stored copy. Returns the content hash
+  if digest is None:
+    digest = hashFile(path)
+  for obj in storeObjects(digest):
+    try:
+      os.link(path, obj)
+      os.chmod(obj, 0o444)
+      return digest
+    except FileExistsError:
+      pass
+    except OSError:
+      #no hard links here, keep the private copy
+      return digest
+    try:
+      os.link(obj, path + ".store")
+    except OSError as e:
+      if e.errno == errno.EMLINK:
+        continue
+      return digest
+    os.replace(path + ".store", path)
+    return digest
+
+def storeOutput(path, chunks, digest):
+  #the captured stdout of a run, only written when its content is new
+  if os.path.lexists(path):
+    os.remove(path)
+  for obj in storeObjects(digest):
+    if not os.path.isfile(obj):
+      break
+    try:
+      os.link(obj, path)
+      return digest
+    except OSError as e:
+      if e.errno != errno.EMLINK:
+        break
+  outputFile = open(path, "wb")
+  outputFile.write(b''.join(chunks))
+  outputFile.close()
+  return storeFile(path, digest)
+
+def goldenDigests():
+  #content hashes of the golden standard output ("std") and output files,
+  #by the name the output files of the faulty runs have without their run_id
+  digests = {}
+  if not os.path.isdir(baselinedir):
+    return digests
+  if os.path.isfile(os.path.join(baselinedir, "golden_std_output")):
+    digests["std"] = hashFile(os.path.join(baselinedir, "golden_std_output"))
+  for each in os.listdir(baselinedir):
+    flds = each.split(".")
+    if each.startswith("llfi") or len(flds) < 3 or flds[-2] != "prof":
+      continue
+    digests['.'.join(flds[0:-2] + flds[-1:])] = hashFile(os.path.join(baselinedir, each))
+  return digests
+
+################################################################################
+def dirSnapshot(workdir):
   #snapshot of directory before each execute() is performed
-  global dirBefore
-  dirBefore = [_file for _file in os.listdir(".")]
+  return [_file for _file in os.listdir(workdir)]
+
+################################################################################
+class Worker:
+  #runs one experiment at a time in workdir, the base directory or its own
+  #sandbox, with its own heartbeat page
+  def __init__(self, workdir):
+    self.workdir = workdir
+    openHeartbeat(self)
+
+def stageInputs():
+  #read-only snapshot of the files and directories of the base directory, but
+  #llfi/, which the sandboxes are staged from. Copies are reflinked where the
+  #file system can
+  global sandboxdir, snapshotdir
+  #one sandbox per injectfault process, several can share a campaign
+  sandboxdir = os.path.join(os.path.dirname(fi_exe), "sandbox", str(os.getpid()))
+  snapshotdir = os.path.join(sandboxdir, "inputs")
+  if os.path.isdir(sandboxdir):
+    shutil.rmtree(sandboxdir)
+  #sandboxes left behind by processes that were killed
+  if os.path.isdir(os.path.dirname(sandboxdir)):
+    for each in os.listdir(os.path.dirname(sandboxdir)):
+      try:
+        os.kill(int(each), 0)
+      except (ValueError, PermissionError):
+        continue
+      except ProcessLookupError:
+        shutil.rmtree(os.path.join(os.path.dirname(sandboxdir), each))
+  os.makedirs(snapshotdir)
+  stageTree(".", snapshotdir, False, sandboxInput == "link",
+            ("llfi", "llfi.config.runtime.txt"))
+  snapshotState.update(treeState(snapshotdir))
+
+def treeState(srcdir):
+  #modification time and size of the files under srcdir, by relative path
+  state = {}
+  for dirpath, dirnames, filenames in os.walk(srcdir):
+    for each in filenames:
+      st = os.stat(os.path.join(dirpath, each))
+      state[os.path.relpath(os.path.join(dirpath, each), srcdir)] = (st.st_mtime_ns, st.st_size)
+  return state
+
+def restageInputs():
+  #the read-only permission of the snapshot does not hold for root, inputs the
+  #program rewrote through a hard link are copied again from the base directory
+  snapshotLock.acquire()
+  try:
+    for path, state in treeState(snapshotdir).items():
+      if snapshotState.get(path) == state:
+        continue
+      print("WARNING: " + path + " was modified through its link in a sandbox, set sandboxInput to copy for programs that write their inputs")
+      dst = os.path.join(snapshotdir, path)
+      os.remove(dst)
+      copyFile(path, dst)
+      os.chmod(dst, 0o444)
+      st = os.stat(dst)
+      snapshotState[path] = (st.st_mtime_ns, st.st_size)
+  finally:
+    snapshotLock.release()
+
+def stageTree(srcdir, dstdir, link, readonly, skipped = ()):
+  #directories are recreated, files hard-linked or copied. Symbolic links are
+  #followed, the sandboxes are deeper than the base directory
+  for each in os.listdir(srcdir):
+    if each in skipped:
+      continue
+    src = os.path.join(srcdir, each)
+    dst = os.path.join(dstdir, each)
+    if os.path.isdir(src):
+      os.mkdir(dst)
+      stageTree(src, dst, link, readonly)
+      continue
+    if not os.path.isfile(src):
+      continue
+    if link:
+      try:
+        os.link(src, dst)
+        continue
+      except OSError:
+        pass
+    copyFile(src, dst)
+    if readonly:
+      os.chmod(dst, 0o444)
+
+def copyFile(src, dst):
+  if subprocess.call(["cp", "--reflink=auto", "-p", src, dst], stderr = subprocess.DEVNULL) != 0:
+    shutil.copy2(src, dst)
+
+def prepareSandbox(worker):
+  #a fresh directory with the inputs, private copies of the snapshot or hard
+  #links of it, which only hold for programs that do not write their inputs
+  if os.path.isdir(worker.workdir):
+    shutil.rmtree(worker.workdir)
+  os.mkdir(worker.workdir)
+  stageTree(snapshotdir, worker.workdir, sandboxInput == "link", False)
+
+################################################################################
+def runExperiment(worker, run_id, ficonfig, timeout):
+  outputfile = stddir + "/std_outputfile-" + "run-"+run_id
+  errorfile = errordir + "/errorfile-" + "run-"+run_id
+  if worker.workdir != ".":
+    prepareSandbox(worker)
+
+  ficonfig_File = open(os.path.join(worker.workdir, "llfi.config.runtime.txt"), 'w')
+  ficonfig_File.write(ficonfig)
+  ficonfig_File.write("heartbeat_file="+worker.heartbeatfile+'\n')
+  ficonfig_File.close()
+
+  execlist = [fi_exe]
+  execlist.extend(optionlist)
+  ret, artifacts = execute(execlist, timeout, worker, run_id, outputfile)
+  if worker.workdir != "." and sandboxInput == "link":
+    restageInputs()
+  if replayGolden and os.path.isfile(os.path.join(baselinedir, "llfi.stat.tracehash.prof.txt")):
+    replayGoldenWindows(timeout, worker, run_id)
+  if ret == "sdc-terminated":
+    pass
+  elif ret == "timed-out":
+    error_File = open(errorfile, 'w')
+    error_File.write("Program hang\n")
+    error_File.close()
+  elif int(ret) < 0:
+    error_File = open(errorfile, 'w')
+    error_File.write("Program crashed, terminated by the system, return code " + ret + '\n')
+    crash = readCrashRecord(worker)
+    if crash is not None:
+      error_File.write("Crash record: " + describeCrash(crash) + '\n')
+    error_File.close()
+  elif int(ret) > 0:
+    error_File = open(errorfile, 'w')
+    error_File.write("Program crashed, terminated by itself, return code " + ret + '\n')
+    error_File.close()
+  if ret == "timed-out" or (ret != "sdc-terminated" and int(ret) != 0):
+    artifacts[errorfile] = None
+  if worker.workdir != ".":
+    shutil.rmtree(worker.workdir)
+  return ret, artifacts
+
+def runExperiments(pool, experiments, timeout, journal, estimator = None):
+  #experiments are (plan id, run_id, contents of llfi.config.runtime.txt) of
+  #one run option. They are claimed from the journal, which skips the ones
+  #completed before or claimed by another injectfault process. With an
+  #estimator no new experiment is started once it reached its precision, the
+  #ones in flight still finish and are counted
+  runIds = dict([(plan_id, run_id) for plan_id, run_id, ficonfig in experiments])
+  cursor = [0]
+  done = [0]
+  def recordCompleted():
+    #count the experiments of this run option completed by any process, and
+    #feed their outcomes to the estimator
+    for plan_id, outcome in journal.takeCompleted():
+      if plan_id not in runIds:
+        continue
+      done[0] += 1
+      if estimator:
+        estimator.record(outcome, injectedStratum(runIds[plan_id], estimator.stratifyBy))
+  recordCompleted()
+  if done[0] > 0:
+    print("Resuming: " + str(done[0]) + " of " + str(len(experiments)) + " experiments completed before")
+  errors = []
+  def work(worker):
+    while not errors:
+      with resultLock:
+        if estimator and estimator.reached():
+          return
+        experiment = journal.claim(experiments, cursor, timeout)
+        recordCompleted()
+      if experiment is None:
+        return
+      plan_id, run_id, ficonfig = experiment
+      try:
+        ret, artifacts = runExperiment(worker, run_id, ficonfig, timeout)
+        outcome = classifyRun(run_id, ret, artifacts)
+      except Exception as e:
+        errors.append(e)
+        return
+      # Print updates, print the number of injections finished
+      with resultLock:
+        journal.complete(plan_id, run_id, outcome, artifacts)
+        recordCompleted()
+        print_progressbar(done[0], len(experiments))
+        if estimator:
+          estimator.report()
+
+  if len(pool) == 1:
+    work(pool[0])
+  else:
+    threads = [threading.Thread(target = work, args = (worker,)) for worker in pool]
+    for thread in threads:
+      thread.start()
+    for thread in threads:
+      thread.join()
+  if errors:
+    raise errors[0]
+  journal.sync()
+  return done[0]
+
+################################################################################
+def classifyRun(run_id, ret, artifacts):
+  #outcome of a finished experiment: hang, crash, SDC when the standard output
+  #or an output file differs from the golden run or a golden output is
+  #missing, benign otherwise. Outputs are compared by their content hash
+  if ret == "sdc-terminated":
+    return "SDC"
+  if ret == "timed-out":
+    return "hang"
+  if int(ret) != 0:
+    return "crash"
+  outputs = {}
+  for path in artifacts:
+    if artifacts[path] is None:
+      continue
+    if os.path.dirname(path) == stddir:
+      outputs["std"] = artifacts[path]
+      continue
+    flds = os.path.basename(path).split(".")
+    name = '.'.join(flds[0:-2] + flds[-1:])
+    if name not in golden:
+      return "SDC"
+    outputs[name] = artifacts[path]
+  for name in golden:
+    if outputs.get(name) != golden[name]:
+      return "SDC"
+  return "benign"
+
+def injectedStratum(run_id, stratifyBy):
+  #function or opcode of the instruction the fault was injected into, from the
+  #first line of llfi.stat.fi.injectedfaults.<run_id>.txt and the site table
+  if stratifyBy is None:
+    return None
+  statfile = os.path.join(llfi_stat_dir, "llfi.stat.fi.injectedfaults."+run_id+".txt")
+  if not os.path.isfile(statfile):
+    return "(not injected)"
+  statFile = open(statfile, 'r')
+  line = statFile.readline()
+  statFile.close()
+  fields = {}
+  for field in line[line.find(":")+1:].split(","):
+    if "=" in field:
+      key, val = field.strip().split("=", 1)
+      fields[key] = val
+  if stratifyBy == "opcode":
+    return fields.get("opcode", "(unknown)")
+  return sites.get(fields.get("fi_index"), "(unknown)")
+
+def loadSites():
+  #llfi.stat.sites.txt is written by instrument, lines "<llfi index> <function> <opcode>"
+  global sites
+  if not os.path.isfile("llfi.stat.sites.txt"):
+    print("ERROR: stratifyBy: function needs llfi.stat.sites.txt, please run instrument again.")
+    exit(1)
+  sites = {}
+  siteFile = open("llfi.stat.sites.txt", 'r')
+  for line in siteFile:
+    flds = line.split()
+    if len(flds) == 3:
+      sites[flds[0]] = flds[1]
+  siteFile.close()
+
+class Estimator:
+  #SDC, crash and hang rates of a run option with the half-widths of their
+  #confidence intervals. Pooled rates use the Wilson score interval. Stratified
+  #rates are post-stratified: the strata are weighted by their share of the
+  #runs and each contributes the variance of its Wilson-adjusted rate
+  def __init__(self, precision, confidence, stratifyBy):
+    self.precision = precision
+    self.stratifyBy = stratifyBy
+    self.z = statistics.NormalDist().inv_cdf((1 + confidence) / 2.0)
+    self.runs = 0
+    self.strata = {}
+
+  def record(self, outcome, stratum):
+    self.runs += 1
+    counts = self.strata.setdefault(stratum, {"runs": 0})
+    counts["runs"] += 1
+    counts[outcome] = counts.get(outcome, 0) + 1
+
+  def wilson(self, hits, runs):
+    #(center, half-width) of the Wilson score interval
+    z2 = self.z * self.z
+    rate = float(hits) / runs
+    center = (rate + z2 / (2 * runs)) / (1 + z2 / runs)
+    halfwidth = self.z / (1 + z2 / runs) * math.sqrt(rate * (1 - rate) / runs + z2 / (4 * runs * runs))
+    return center, halfwidth
+
+  def estimate(self, outcome):
+    if self.runs == 0:
+      return 0.0, 1.0
+    if self.stratifyBy is None:
+      return self.wilson(self.strata[None].get(outcome, 0), self.runs)
+    z2 = self.z * self.z
+    rate = 0.0
+    variance = 0.0
+    for counts in list(self.strata.values()):
+      weight = float(counts["runs"]) / self.runs
+      adjusted = (counts.get(outcome, 0) + z2 / 2) / (counts["runs"] + z2)
+      rate += weight * counts.get(outcome, 0) / counts["runs"]
+      variance += weight * weight * adjusted * (1 - adjusted) / (counts["runs"] + z2)
+    return rate, self.z * math.sqrt(variance)
+
+  def reached(self):
+    for outcome in OUTCOMES:
+      if self.estimate(outcome)[1] > self.precision:
+        return False
+    return True
+
+  def report(self, final = False):
+    line = "\t" + ", ".join(["%s %.1f%% +/- %.1f%%" % ((outcome,) + tuple(100 * x for x in self.estimate(outcome))) for outcome in OUTCOMES])
+    print(line + " after " + str(self.runs) + " runs")
+    if final and self.stratifyBy is not None:
+      for stratum in sorted(self.strata):
+        counts = self.strata[stratum]
+        print(("  %-24s %5d runs, " % (stratum, counts["runs"])) +
+              ", ".join(["%s %.1f%%" % (outcome, 100.0 * counts.get(outcome, 0) / counts["runs"]) for outcome in OUTCOMES]))
 
 ################################################################################
 def readCycles():
-  global totalcycles
+  global totalcycles, goldencycles, goldentime
   profinput= open("llfi.stat.prof.txt","r")
-  while 1:
-    line = profinput.readline()
-    if line.strip():
-      if line[0] == 't':
-        label, totalcycles = line.split("=")
-        break
+  for line in profinput:
+    if line.startswith("total_cycle="):
+      label, totalcycles = line.split("=")
+      goldencycles = int(totalcycles)
   profinput.close()
+  timeFileName = os.path.join(baselinedir, "llfi.stat.time.prof.txt")
+  if os.path.isfile(timeFileName):
+    timeFile = open(timeFileName, "r")
+    for line in timeFile:
+      if line.startswith("total_time="):
+        goldentime = float(line.split("=")[1])
+    timeFile.close()
 
 ################################################################################
-def checkValues(key, val, var1 = None,var2 = None,var3 = None,var4 = None):
+def checkValues(key, val):
   #preliminary input checking for fi options
-  #also checks for fi_bit usage by non-kernel users
-  #optional var# are used for fi_bit's case only
   if key =='run_number':
     assert isinstance(val, int)==True, key+" must be an integer in input.yaml"
     assert int(val)>0, key+" must be greater than 0 in input.yaml"
@@ -271,6 +1043,13 @@ def checkValues(key, val, var1 = None,var2 = None,var3 = None,var4 = None):
     assert isinstance(val, int)==True, key+" must be an integer in input.yaml"
     assert int(val) >= 0, key+" must be greater than or equal to 0 in input.yaml"
 
+  elif key == 'fi_instance':
+    assert isinstance(val, int)==True, key+" must be an integer in input.yaml"
+    assert int(val) >= 0, key+" must be greater than or equal to 0 in input.yaml"
+
+  elif key == 'fi_plan':
+    assert val in ["random", "stratified", "exhaustive"], key+" must be random, stratified or exhaustive in input.yaml"
+
   elif key == 'fi_reg_index':
     assert isinstance(val, int)==True, key+" must be an integer in input.yaml"
     assert int(val) >= 0, key+" must be greater than or equal to 0 in input.yaml"
@@ -278,26 +1057,478 @@ def checkValues(key, val, var1 = None,var2 = None,var3 = None,var4 = None):
   elif key == 'fi_bit':
     assert isinstance(val, int)==True, key+" must be an integer in input.yaml"
     assert int(val) >= 0, key+" must be greater than or equal to 0 in input.yaml"
-    if runOverride:
-      pass
-    elif var1 != None and var1 > 1 and (var2 or var3) and var4:
-      user_input = input("\nWARNING: Injecting into the same cycle(index), bit multiple times "+
-                  "is redundant as it would yield the same result."+
-                  "\nTo turn off this warning, please see Readme "+
-                  "for kernel mode.\nDo you wish to continue anyway? (Y/N)\n ")
-      if user_input.upper() =="Y":
-        pass
-      else:
-        exit(1)
+
+  elif key == 'hangStall' or key == 'hangFactor':
+    assert isinstance(val, (int, float))==True, key+" must be a number in input.yaml"
+    assert val >= 0, key+" must be greater than or equal to 0 in input.yaml"
+
+  elif key == 'virtual_time':
+    assert isinstance(val, bool)==True, key+" must be True or False in input.yaml"
+
+  elif key == 'memory_budget':
+    assert isinstance(val, int)==True, key+" must be an integer in input.yaml"
+    assert int(val) >= 0, key+" must be greater than or equal to 0 in input.yaml"
+
+  elif key == 'hang_mode':
+    assert val in ["park", "spin"], key+" must be park or spin in input.yaml"
+
+  elif key == 'sdcStop':
+    assert isinstance(val, bool)==True, key+" must be True or False in input.yaml"
+
+  elif key == 'sdcFiles':
+    assert isinstance(val, list)==True, key+" must be a list of file names in input.yaml"
+
+  elif key == 'targetPrecision':
+    assert isinstance(val, float)==True, key+" must be a number in input.yaml"
+    assert val > 0 and val < 0.5, key+" must be between 0 and 0.5 in input.yaml"
+
+  elif key == 'confidence':
+    assert isinstance(val, float)==True, key+" must be a number in input.yaml"
+    assert val > 0 and val < 1, key+" must be between 0 and 1 in input.yaml"
+
+  elif key == 'stratifyBy':
+    assert val in ["function", "opcode"], key+" must be function or opcode in input.yaml"
 
   elif key == 'fi_random_seed':
     assert isinstance(val, int)==True, key+" must be an integer in input.yaml"
     assert int(val) >= 0, key+" must be greater than or equal to 0 in input.yaml"
 
+################################################################################
+def loadSiteProfile():
+  #dynamic instances per injection target from the golden run
+  #(baseline/llfi.stat.sitecount.prof.txt, lines "<llfi index> <instances>") and
+  #the bit widths of its registers (llfi.stat.fi.targets.txt written by
+  #instrument, lines "<llfi index> <opcode> <width>...")
+  countfile = os.path.join(baselinedir, "llfi.stat.sitecount.prof.txt")
+  if not os.path.isfile(countfile) or not os.path.isfile("llfi.stat.fi.targets.txt"):
+    print("ERROR: stratified and exhaustive fi_plan need " + countfile +
+          " and llfi.stat.fi.targets.txt, please run instrument and profile again.")
+    exit(1)
+  widths = {}
+  targetFile = open("llfi.stat.fi.targets.txt", 'r')
+  for line in targetFile:
+    flds = line.split()
+    widths[int(flds[0])] = [int(w) for w in flds[2:]]
+  targetFile.close()
+  siteList = []
+  countFile = open(countfile, 'r')
+  for line in countFile:
+    flds = line.split()
+    if len(flds) == 2 and int(flds[0]) in widths:
+      siteList.append((int(flds[0]), int(flds[1]), widths[int(flds[0])]))
+  countFile.close()
+  return sorted(siteList)
+
+def allocateRuns(siteList, runs):
+  #runs per site proportional to its dynamic instances, largest remainder
+  #first, at most one run per instance
+  total = sum([count for index, count, widths in siteList])
+  if runs >= total:
+    return [count for index, count, widths in siteList]
+  shares = [float(runs) * count / total for index, count, widths in siteList]
+  alloc = [int(share) for share in shares]
+  order = sorted(range(len(shares)), key = lambda k: alloc[k] - shares[k])
+  for k in order[0:runs - sum(alloc)]:
+    alloc[k] += 1
+  return alloc
+
+def planRunOption(ii, run):
+  #experiments of one run option as lists of (key, value) lines of
+  #llfi.config.runtime.txt, in the order the runtime expects them
+  opt = run["run"]
+  for key in ["fi_plan", "fi_cycle", "fi_index", "fi_instance", "fi_reg_index",
+              "fi_bit", "fi_num_bits", "window_len", "fi_random_seed", "hang_mode",
+              "virtual_time", "memory_budget"]:
+    if key in opt:
+      checkValues(key, opt[key])
+  mode = opt.get("fi_plan", "random")
+  if mode != "exhaustive":
+    if "numOfRuns" not in opt:
+      print("ERROR: Must include a run number per fi config in input.yaml.")
+      exit(1)
+    checkValues("run_number", opt["numOfRuns"])
+  if mode != "random" and ("fi_cycle" in opt or "fi_index" in opt or "window_len" in opt):
+    print("ERROR: fi_cycle, fi_index and window_len can only be used with the random fi_plan.")
+    exit(1)
+
+  fi_type = None
+  if "fi_type" in opt:
+    fi_type = opt["fi_type"]
+    if fi_type == "SoftwareFault" or fi_type == "AutoInjection" or fi_type == "Automated":
+      try:
+        cOpt = doc["compileOption"]
+        injectorname = cOpt["instSelMethod"][0]["customInstselector"]["include"][0]
+      except:
+        print("\n\nERROR: Cannot extract fi_type from instSelMethod. Please check the customInstselector field in input.yaml\n")
+      else:
+        fi_type = injectorname
+    checkValues("fi_type", fi_type)
+
+  #one generator per run option, so a seeded plan is reproducible
+  rng = random.Random(opt.get("fi_random_seed"))
+
+  def experiment(target, reg, bit):
+    lines = list(target)
+    if fi_type is not None:
+      lines.append(("fi_type", fi_type))
+    if reg is not None:
+      lines.append(("fi_reg_index", reg))
+    if bit is not None:
+      lines.append(("fi_bit", bit))
+    if "fi_num_bits" in opt:
+      lines.append(("fi_num_bits", opt["fi_num_bits"]))
+    if "hang_mode" in opt:
+      lines.append(("hang_mode", opt["hang_mode"]))
+    if opt.get("virtual_time"):
+      lines.append(("virtual_time", 1))
+    if "memory_budget" in opt:
+      lines.append(("memory_budget", opt["memory_budget"]))
+    if "window_len" in opt and target[0][0] == "fi_cycle":
+      fi_second_cycle = min(target[0][1] + rng.randint(1, int(opt["window_len"])), int(totalcycles) - 1)
+      lines.append(("fi_second_cycle", fi_second_cycle))
+    return lines
+
+  plan = []
+  if mode == "random":
+    if "fi_cycle" in opt:
+      targets = [[("fi_cycle", opt["fi_cycle"])]] * opt["numOfRuns"]
+    elif "fi_index" in opt:
+      print(("\nINFO: You choose to inject faults based on LLFI index, "
+             "this will inject into every runtime instruction whose LLFI "
+             "index is %d\n" % opt["fi_index"]))
+      target = [("fi_index", opt["fi_index"])]
+      if "fi_instance" in opt:
+        target.append(("fi_instance", opt["fi_instance"]))
+      targets = [target] * opt["numOfRuns"]
+    else:
+      #cycles are drawn without replacement
+      cycles = rng.sample(range(0, int(totalcycles)), min(opt["numOfRuns"], int(totalcycles)))
+      targets = [[("fi_cycle", cycle)] for cycle in cycles]
+    for target in targets:
+      plan.append(experiment(target, opt.get("fi_reg_index"), opt.get("fi_bit")))
+    return plan
+
+  #stratified and exhaustive plans name every dynamic instruction by its llfi
+  #index and instance, and fix the register and bit, so each experiment is
+  #deterministic
+  siteList = loadSiteProfile()
+  if mode == "stratified":
+    alloc = allocateRuns(siteList, opt["numOfRuns"])
+  for k, (index, count, widths) in enumerate(siteList):
+    if mode == "stratified":
+      instances = sorted(rng.sample(range(0, count), alloc[k]))
+    else:
+      instances = range(0, count)
+    for instance in instances:
+      target = [("fi_index", index), ("fi_instance", instance)]
+      if mode == "stratified":
+        reg = opt.get("fi_reg_index", rng.randrange(len(widths)))
+        if reg >= len(widths):
+          continue
+        bit = opt.get("fi_bit", rng.randrange(widths[reg]))
+        if bit < widths[reg]:
+          plan.append(experiment(target, reg, bit))
+        continue
+      regs = [opt["fi_reg_index"]] if "fi_reg_index" in opt else range(0, len(widths))
+      for reg in regs:
+        if reg >= len(widths):
+          continue
+        bits = [opt["fi_bit"]] if "fi_bit" in opt else range(0, widths[reg])
+        for bit in bits:
+          if bit < widths[reg]:
+            plan.append(experiment(target, reg, bit))
+  #sites come in llfi index order, a campaign that targetPrecision stops
+  #early must still have run a random sample of the plan
+  rng.shuffle(plan)
+  return plan
+
+def campaignDigest():
+  #a plan is reused as long as input.yaml and the golden profile it was
+  #planned from do not change
+  digest = hashlib.sha1()
+  for each in ["input.yaml", "llfi.stat.prof.txt",
+               os.path.join(baselinedir, "llfi.stat.sitecount.prof.txt")]:
+    if os.path.isfile(each):
+      digestFile = open(each, 'rb')
+      digest.update(digestFile.read())
+      digestFile.close()
+  return digest.hexdigest()[0:16]
+
+def planDigest():
+  if not os.path.isfile(planfile):
+    return None
+  planFile = open(planfile, 'r')
+  line = planFile.readline()
+  planFile.close()
+  if not line.startswith("# plan "):
+    return None
+  return line.split()[2]
+
+def planCampaign(rOpt):
+  #plan every run option before anything executes, written to llfi/fi_plan.txt
+  #as lines "<plan id> <run_id> key=value ...". The plan id hashes the
+  #experiment, so repeating a deterministic experiment (the dynamic
+  #instruction, register and bit are all fixed) is detected and dropped, also
+  #across run options. Experiments that leave some of them to the runtime are
+  #independent draws and get a draw number in their id instead.
+  #A new plan starts a new journal, the experiments completed for the plan it
+  #replaces are run again even if their plan ids did not change
+  plan = []
+  planned = set()
+  draws = {}
+  for ii, run in enumerate(rOpt):
+    duplicates = 0
+    index = 0
+    for lines in planRunOption(ii, run):
+      keys = [key for key, val in lines]
+      ficonfig = ' '.join([key+"="+str(val) for key, val in lines])
+      deterministic = ("fi_cycle" in keys or "fi_instance" in keys) and "fi_reg_index" in keys and "fi_bit" in keys
+      if not deterministic:
+        draws[ficonfig] = draws.get(ficonfig, 0) + 1
+        ficonfig_id = ficonfig + " draw=" + str(draws[ficonfig])
+      else:
+        ficonfig_id = ficonfig
+      plan_id = hashlib.sha1(ficonfig_id.encode()).hexdigest()[0:16]
+      if plan_id in planned:
+        duplicates += 1
+        continue
+      planned.add(plan_id)
+      plan.append((plan_id, str(ii)+"-"+str(index), ficonfig))
+      index += 1
+    if duplicates > 0:
+      print("INFO: FI Config #" + str(ii) + ": " + str(duplicates) + " duplicate experiments are not planned")
+    print("FI Config #" + str(ii) + ": " + str(index) + " experiments planned")
+
+  planFile = open(planfile, 'w')
+  planFile.write("# plan " + campaignDigest() + "\n")
+  planFile.write("# plan id, run id, runtime config of the experiment\n")
+  for plan_id, run_id, ficonfig in plan:
+    planFile.write(plan_id + " " + run_id + " " + ficonfig + "\n")
+  planFile.close()
+
+def readPlan():
+  #the experiments of the plan file by run option, as (plan id, run id,
+  #contents of llfi.config.runtime.txt)
+  experiments = {}
+  planFile = open(planfile, 'r')
+  for line in planFile:
+    if line.startswith("#"):
+      continue
+    flds = line.split()
+    run_id = flds[1]
+    ficonfig = ''.join([fld + '\n' for fld in flds[2:]])
+    experiments.setdefault(int(run_id.split("-")[0]), []).append((flds[0], run_id, ficonfig))
+  planFile.close()
+  return experiments
+
+def processIncarnation(pid):
+  #the boot and the start time of process pid, which tell it from the earlier
+  #processes that had its pid. "-" where /proc does not have them
+  try:
+    bootFile = open("/proc/sys/kernel/random/boot_id", 'r')
+    boot = bootFile.read().strip().replace("-", "")[0:12]
+    bootFile.close()
+    statFile = open("/proc/" + str(pid) + "/stat", 'r')
+    stat = statFile.read()
+    statFile.close()
+  except (IOError, OSError):
+    return "-"
+  #the fields after the command name, which may contain spaces
+  starttime = stat[stat.rfind(")") + 2:].split()[19]
+  return boot + "-" + starttime
+
+class Journal:
+  #append-only record of the campaign in llfi/fi_journal.txt, next to the plan
+  #it belongs to. Lines are
+  #  "# plan <digest>"                      first line
+  #  "open <owner> <time> <workdir>"        a process joined the campaign, and
+  #                                         runs experiments in the base
+  #                                         directory or in sandboxes
+  #  "claim <plan id> <owner> <lease>"      an experiment was started
+  #  "done <plan id> <run_id> <outcome> <artifact>[=<sha256>],..."
+  #                                         artifact paths percent-encoded
+  #Every injectfault process working on the plan appends to it under an
+  #exclusive flock and reads what the others appended since, so the processes
+  #share the experiments. Claims of processes that are gone are void, which
+  #restarts their experiments in the next process. Processes of other hosts
+  #are taken to be gone once the lease, the time by which the experiment has
+  #timed out, passed by JOURNAL_CLAIM_GRACE. Owners are
+  #<host>:<pid>:<incarnation>, see processIncarnation, as pids are reused
+  #after a reboot or a container restart
+  def __init__(self):
+    self.host = socket.gethostname()
+    self.owner = self.host + ":" + str(os.getpid()) + ":" + processIncarnation(os.getpid())
+    self.joined = False
+    self.file = open(journalfile, 'ab+')
+    self.offset = 0
+    self.opens = {}
+    self.claims = {}
+    self.completed = set()
+    self.fresh = []
+    self.unsynced = 0
+    self.lastsync = time.time()
+
+  def lock(self):
+    fcntl.flock(self.file.fileno(), fcntl.LOCK_EX)
+    self.refresh()
+
+  def unlock(self):
+    self.file.flush()
+    fcntl.flock(self.file.fileno(), fcntl.LOCK_UN)
+
+  def refresh(self):
+    #read the records appended since the last refresh
+    self.file.seek(self.offset)
+    data = self.file.read()
+    #a record still being written by another process is read next time
+    end = data.rfind(b"\n") + 1
+    self.offset += end
+    for line in data[0:end].decode().splitlines():
+      flds = line.split(None, 4)
+      if len(flds) == 4 and flds[0] == "open":
+        self.opens[flds[1]] = (float(flds[2]), flds[3])
+        if flds[1] == self.owner:
+          self.joined = True
+      elif len(flds) == 4 and flds[0] == "claim":
+        #claims in this process's name from before it joined are not its own
+        if flds[2] == self.owner and not self.joined:
+          continue
+        self.claims[flds[1]] = (flds[2], float(flds[3]))
+      elif len(flds) == 5 and flds[0] == "done" and flds[3] in OUTCOMES + ["benign"] and flds[1] not in self.completed:
+        self.completed.add(flds[1])
+        self.fresh.append((flds[1], flds[3]))
+
+  def append(self, record):
+    #a record cut short by a crash is left on a line of its own
+    size = self.file.seek(0, os.SEEK_END)
+    if size > 0:
+      self.file.seek(size - 1)
+      if self.file.read(1) != b"\n":
+        record = "\n" + record
+    self.file.write((record + "\n").encode())
+    self.file.flush()
+
+  def takeCompleted(self):
+    #(plan id, outcome) of the experiments completed since the last call
+    fresh = self.fresh
+    self.fresh = []
+    return fresh
+
+  def alive(self, owner, lease):
+    #whether the process owner still runs, or for other hosts whether lease
+    #has not lapsed yet
+    flds = owner.split(":")
+    if len(flds) != 3:
+      return False
+    host, pid, incarnation = flds
+    if host != self.host:
+      return time.time() < lease + JOURNAL_CLAIM_GRACE
+    try:
+      os.kill(int(pid), 0)
+    except ProcessLookupError:
+      return False
+    except PermissionError:
+      pass
+    return processIncarnation(int(pid)) == incarnation
+
+  def claimed(self, plan_id):
+    #whether a running process holds plan_id
+    if plan_id not in self.claims:
+      return False
+    return self.alive(*self.claims[plan_id])
+
+  def baseHolder(self):
+    #another running process that joined the campaign in the base directory,
+    #None if there is none. It is running while it holds an experiment
+    for owner in self.opens:
+      joined, workdir = self.opens[owner]
+      if owner == self.owner or workdir != "base":
+        continue
+      if self.alive(owner, joined) or any(self.claims[plan_id][0] == owner and self.claimed(plan_id) for plan_id in self.claims):
+        return owner
+    return None
+
+  def join(self, workdir):
+    self.append("open " + self.owner + " " + str(int(time.time())) + " " + workdir)
+
+  def claim(self, experiments, cursor, timeout):
+    #the next experiment nobody completed or holds, None when there is none.
+    #cursor[0] is the position in experiments to continue the search from
+    self.lock()
+    try:
+      while cursor[0] < len(experiments):
+        experiment = experiments[cursor[0]]
+        cursor[0] += 1
+        if experiment[0] in self.completed or self.claimed(experiment[0]):
+          continue
+        lease = int(time.time()) + timeout
+        self.append("claim " + experiment[0] + " " + self.owner + " " + str(lease))
+        self.claims[experiment[0]] = (self.owner, lease)
+        return experiment
+      return None
+    finally:
+      self.unlock()
+
+  def complete(self, plan_id, run_id, outcome, artifacts):
+    #the record is on disk after the next sync, a crash before that repeats
+    #the experiment
+    artifacts = [urllib.parse.quote(os.path.relpath(each)) + ("=" + artifacts[each] if artifacts[each] else "") for each in artifacts]
+    self.lock()
+    try:
+      self.append("done " + plan_id + " " + run_id + " " + outcome + " " + (",".join(artifacts) or "-"))
+      self.refresh()
+      self.unsynced += 1
+      if self.unsynced >= JOURNAL_SYNC_RECORDS or time.time() - self.lastsync >= JOURNAL_SYNC_INTERVAL:
+        self.sync()
+    finally:
+      self.unlock()
+
+  def sync(self):
+    self.file.flush()
+    os.fsync(self.file.fileno())
+    self.unsynced = 0
+    self.lastsync = time.time()
+
+  def close(self):
+    self.sync()
+    self.file.close()
+
+def openCampaign(rOpt):
+  #plan the campaign, or resume the one planned from the same input.yaml and
+  #golden profile. Another injectfault process may be planning at the same
+  #time, so this holds the journal lock. A process running experiments in the
+  #base directory leaves its outputs there, which neither a second one nor the
+  #input snapshot of the sandboxes can tell from the inputs, so it cannot be
+  #joined
+  journal = Journal()
+  journal.lock()
+  try:
+    if planDigest() == campaignDigest():
+      print("Resuming the campaign of " + planfile)
+    else:
+      planCampaign(rOpt)
+      journal.file.truncate(0)
+      journal.offset = 0
+      journal.opens = {}
+      journal.claims = {}
+      journal.completed = set()
+      journal.fresh = []
+      journal.append("# plan " + campaignDigest())
+    holder = journal.baseHolder()
+    if holder is not None:
+      print("ERROR: The injectfault process " + holder + " runs the experiments of this campaign in the base directory.")
+      print("Wait for it to finish, or stop it and resume the campaign in processes with workers in campaignOption.")
+      exit(1)
+    journal.join("sandbox" if workers > 0 else "base")
+    journal.sync()
+  finally:
+    journal.unlock()
+  return journal
+
 ################################################################################
 def main(args):
-  global optionlist, outputfile, totalcycles,run_id, return_codes
-  global defaultTimeout
+  global optionlist, totalcycles, return_codes
+  global defaultTimeout, hangStall, hangFactor, sdcStop, sdcFiles
 
   parseArgs(args)
   checkInputYaml()
@@ -306,6 +1537,7 @@ def main(args):
   # get total num of cycles
   readCycles()
   storeInputFiles()
+  writeDaikonConfig()
 
   #Set up each config file and its corresponding run_number
   try:
@@ -319,6 +1551,15 @@ def main(args):
     print("Please build the executables with create-executables.\n")
     exit(1)
   else:
+    print("======Experiment Plan======")
+    journal = openCampaign(rOpt)
+    plan = readPlan()
+
+    if workers > 0:
+      stageInputs()
+      pool = [Worker(os.path.join(sandboxdir, "worker-"+str(k))) for k in range(0, workers)]
+    else:
+      pool = [Worker(".")]
     print("======Fault Injection======")
     for ii, run in enumerate(rOpt):
       # Maintain a dict of all return codes received and print summary at end
@@ -329,157 +1570,79 @@ def main(args):
         print("")
       print("---FI Config #"+str(ii)+"---")
 
-      if "numOfRuns" not in run["run"]:
-        print("ERROR: Must include a run number per fi config in input.yaml.")
-        exit(1)
-
       if "timeOut" in run["run"]:
          timeout = int(run["run"]["timeOut"])
          assert timeout > 0, "The timeOut option must be greater than 0"
       else:
          timeout = defaultTimeout 
          print("Run with default timeout " + str(timeout))
-      
-      run_number=run["run"]["numOfRuns"]
-      checkValues("run_number", run_number)
+
+      hangStall = 0
+      hangFactor = 0
+      if "hangStall" in run["run"]:
+        hangStall = run["run"]["hangStall"]
+        checkValues("hangStall", hangStall)
+      if "hangFactor" in run["run"]:
+        hangFactor = run["run"]["hangFactor"]
+        checkValues("hangFactor", hangFactor)
+      sdcStop = run["run"].get("sdcStop", False)
+      checkValues("sdcStop", sdcStop)
+      sdcFiles = run["run"].get("sdcFiles", [])
+      checkValues("sdcFiles", sdcFiles)
+      loadGoldenOutputs()
+
+      #with a target precision the plan holds the maximum number of runs
+      estimator = None
+      if "targetPrecision" in run["run"]:
+        targetPrecision = run["run"]["targetPrecision"]
+        checkValues("targetPrecision", targetPrecision)
+        confidence = run["run"].get("confidence", 0.95)
+        checkValues("confidence", confidence)
+        stratifyBy = run["run"].get("stratifyBy")
+        if stratifyBy is not None:
+          checkValues("stratifyBy", stratifyBy)
+          if stratifyBy == "function":
+            loadSites()
+        estimator = Estimator(targetPrecision, confidence, stratifyBy)
 
       # check for verbosity option, set at the FI run level
       if "verbose" in run["run"]:
         options["verbose"] = run["run"]["verbose"]
 
-      # reset all configurations
-      if 'fi_type' in locals():
-        del fi_type
-      if 'fi_cycle' in locals():
-        del fi_cycle
-      if 'fi_index' in locals():
-        del fi_index
-      if 'fi_reg_index' in locals():
-        del fi_reg_index
-      if 'fi_bit' in locals():
-        del fi_bit
-      ##======== Add number of corrupted bits QINING @MAR 13th========
-      if 'fi_num_bits' in locals():
-        del fi_num_bits
-      ##==============================================================
-      ##======== Add second corrupted regs QINING @MAR 27th===========
-      if 'window_len' in locals():
-        del window_len
-      ##==============================================================
-      if 'fi_random_seed' in locals():
-        del fi_random_seed
-
-      #write new fi config file according to input.yaml
-      if "fi_type" in run["run"]:
-        fi_type=run["run"]["fi_type"]
-        if fi_type == "SoftwareFault" or fi_type == "AutoInjection" or fi_type == "Automated":
-          try:
-            cOpt = doc["compileOption"]
-            injectorname = cOpt["instSelMethod"][0]["customInstselector"]["include"][0]
-          except:
-            print("\n\nERROR: Cannot extract fi_type from instSelMethod. Please check the customInstselector field in input.yaml\n")
-          else:
-            fi_type = injectorname
-        checkValues("fi_type",fi_type)
-      ##======== Add number of corrupted bits QINING @MAR 13th========
-      if "fi_num_bits" in run["run"]:
-        fi_num_bits=run["run"]["fi_num_bits"]
-        checkValues("fi_num_bits", fi_num_bits)
-      ##==============================================================
-      ##======== Add second corrupted regs QINING @MAR 27th===========
-      if 'window_len' in run["run"]:
-        window_len=run["run"]["window_len"]
-        checkValues("window_len", window_len)
-      ##==============================================================
-      if "fi_cycle" in run["run"]:
-        fi_cycle=run["run"]["fi_cycle"]
-        checkValues("fi_cycle",fi_cycle)
-      if "fi_index" in run["run"]:
-        fi_index=run["run"]["fi_index"]
-        checkValues("fi_index",fi_index)
-      if "fi_reg_index" in run["run"]:
-        fi_reg_index=run["run"]["fi_reg_index"]
-        checkValues("fi_reg_index",fi_reg_index)
-      if "fi_bit" in run["run"]:
-        fi_bit=run["run"]["fi_bit"]
-        checkValues("fi_bit",fi_bit,run_number,fi_cycle,fi_index,fi_reg_index)
-      if "fi_random_seed" in run["run"]:
-        fi_random_seed=run["run"]["fi_random_seed"]
-        checkValues("fi_random_seed",fi_random_seed)
-
-      if ('fi_cycle' not in locals()) and 'fi_index' in locals():
-        print(("\nINFO: You choose to inject faults based on LLFI index, "
-               "this will inject into every runtime instruction whose LLFI "
-               "index is %d\n" % fi_index))
-
-      need_to_calc_fi_cycle = True
-      if ('fi_cycle' in locals()) or 'fi_index' in locals():
-        need_to_calc_fi_cycle = False
-
       # fault injection
-      for index in range(0, run_number):
-        run_id = str(ii)+"-"+str(index)
-        outputfile = stddir + "/std_outputfile-" + "run-"+run_id
-        errorfile = errordir + "/errorfile-" + "run-"+run_id
-        execlist = [fi_exe]
-        
-        if('fi_cycle' not in locals() and 'fi_random_seed' in locals()):
-          random.seed(fi_random_seed)
-
-        if need_to_calc_fi_cycle:
-          fi_cycle = random.randint(0, int(totalcycles) - 1)
-
-        ficonfig_File = open("llfi.config.runtime.txt", 'w')
-        if 'fi_cycle' in locals():
-          ficonfig_File.write("fi_cycle="+str(fi_cycle)+'\n')
-        elif 'fi_index' in locals():
-          ficonfig_File.write("fi_index="+str(fi_index)+'\n')
-
-        if 'fi_type' in locals():
-          ficonfig_File.write("fi_type="+fi_type+'\n')
-        if 'fi_reg_index' in locals():
-          ficonfig_File.write("fi_reg_index="+str(fi_reg_index)+'\n')
-        if 'fi_bit' in locals():
-          ficonfig_File.write("fi_bit="+str(fi_bit)+'\n')
-        ##======== Add number of corrupted bits QINING @MAR 13th========
-        if 'fi_num_bits' in locals():
-          ficonfig_File.write("fi_num_bits="+str(fi_num_bits)+'\n')
-        ##==============================================================
-        ##======== Add second corrupted regs QINING @MAR 27th===========
-        if 'window_len' in locals():
-          fi_second_cycle = min(fi_cycle + random.randint(1, int(window_len)), int(totalcycles) - 1)
-          ficonfig_File.write("fi_second_cycle="+str(fi_second_cycle)+'\n')
-        ##==============================================================
-        ficonfig_File.close()
-
-        # print run index before executing. Comma removes newline for prettier
-        # formatting
-        execlist.extend(optionlist)
-        ret = execute(execlist, timeout)
-        if ret == "timed-out":
-          error_File = open(errorfile, 'w')
-          error_File.write("Program hang\n")
-          error_File.close()
-        elif int(ret) < 0:
-          error_File = open(errorfile, 'w')
-          error_File.write("Program crashed, terminated by the system, return code " + ret + '\n')
-          error_File.close()
-        elif int(ret) > 0:
-          error_File = open(errorfile, 'w')
-          error_File.write("Program crashed, terminated by itself, return code " + ret + '\n')
-          error_File.close()
-
-        # Print updates, print the number of injections finished
-        print_progressbar(index+1, run_number)
+      experiments = []
+      for plan_id, run_id, ficonfig in plan.get(ii, []):
+        if os.path.isfile(os.path.join(baselinedir, "llfi.stat.tracehash.prof.txt")):
+          ficonfig += "trace_hash_golden="+baselinedir+'\n'
+        experiments.append((plan_id, run_id, ficonfig))
+      if not experiments:
+        continue
+
+      finished = runExperiments(pool, experiments, timeout, journal, estimator)
 
       #print_progressbar(run_number, run_number)
       print("") # progress bar needs a newline after 100% reached
+      if estimator:
+        if estimator.reached():
+          print("Target precision reached after " + str(finished) + " of at most " + str(len(experiments)) + " runs:")
+        else:
+          print("WARNING: Target precision not reached within " + str(len(experiments)) + " runs:")
+        estimator.report(True)
       # Print summary
       if options["verbose"]:
         print("========== SUMMARY ==========")
         print("Return codes: (code:\toccurance)")
         for r in list(return_codes.keys()):
           print(("  %3s: %5d" % (str(r), return_codes[r])))
+    journal.close()
+    for worker in pool:
+      closeHeartbeat(worker)
+    if workers > 0:
+      shutil.rmtree(sandboxdir)
+      try:
+        os.rmdir(os.path.dirname(sandboxdir))
+      except OSError:
+        pass
 
 ################################################################################
 
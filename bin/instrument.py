@@ -303,6 +303,22 @@ def readCompileOption():
         assert int(cOpt["tracingPropagationOption"]["maxTrace"])>0, "maxTrace must be greater than 0 in input.yaml"
         compileOptions.append('-maxtrace')
         compileOptions.append(str(cOpt["tracingPropagationOption"]["maxTrace"]))
+      if "hashWindow" in cOpt["tracingPropagationOption"]:
+        assert isinstance(cOpt["tracingPropagationOption"]["hashWindow"], int)==True, "hashWindow must be an integer in input.yaml"
+        assert int(cOpt["tracingPropagationOption"]["hashWindow"])>=0, "hashWindow must be greater than or equal to 0 in input.yaml"
+        compileOptions.append('-tracehashwindow')
+        compileOptions.append(str(cOpt["tracingPropagationOption"]["hashWindow"]))
+      if "functions" in cOpt["tracingPropagationOption"]:
+        for func in cOpt["tracingPropagationOption"]["functions"]:
+          compileOptions.append('-tracefunc=' + func)
+      if "opcodes" in cOpt["tracingPropagationOption"]:
+        for opcode in cOpt["tracingPropagationOption"]["opcodes"]:
+          compileOptions.append('-traceinst=' + opcode)
+      if "sampleRate" in cOpt["tracingPropagationOption"]:
+        assert isinstance(cOpt["tracingPropagationOption"]["sampleRate"], int)==True, "sampleRate must be an integer in input.yaml"
+        assert int(cOpt["tracingPropagationOption"]["sampleRate"])>0, "sampleRate must be greater than 0 in input.yaml"
+        compileOptions.append('-tracesamplerate')
+        compileOptions.append(str(cOpt["tracingPropagationOption"]["sampleRate"]))
 
       ###Dot Graph Generation selection
       if "generateCDFG" in cOpt["tracingPropagationOption"]:
@@ -179,7 +179,9 @@ def execCompilation(execlist):
 
 ################################################################################
 def readCompileOption():
-  global compileOptions
+  global compileOptions, fiCompileOptions
+  #options of the fault injection executable only
+  fiCompileOptions = []
   
   ###Instruction selection method
   if "instSelMethod" not in cOpt:  
@@ -295,6 +297,40 @@ def readCompileOption():
            "please disable the option and re-run %s." %prog))
     compileOptions.append('-daikontracepass')
 
+    ###Program point selection of the Daikon trace
+    if "daikonTraceOption" in cOpt:
+      dOpt = cOpt["daikonTraceOption"]
+      fileOptions = {"pptFile": "-daikonpptfile=", "callProfile": "-daikoncallprofile=",
+                     "invariants": "-daikoninvariants="}
+      numOptions = {"maxCalls": "-daikonmaxcalls=", "maxCallsPerInvariant": "-daikonmaxcallsperinvariant=",
+                    "hotLimit": "-daikonhotlimit="}
+      for key in dOpt:
+        if key in fileOptions:
+          if not os.path.isfile(dOpt[key]):
+            print("\n\nERROR: " + key + " " + str(dOpt[key]) + " in input.yaml does not exist.\n")
+            exit(1)
+          compileOptions.append(fileOptions[key] + os.path.abspath(dOpt[key]))
+        elif key in numOptions:
+          if not isinstance(dOpt[key], (int, float)) or dOpt[key] < 0:
+            print("\n\nERROR: " + key + " must be a non-negative number in input.yaml.\n")
+            exit(1)
+          compileOptions.append(numOptions[key] + str(dOpt[key]))
+        elif key == "invariantCheck":
+          #the fault injection executable checks the invariants instead of writing a dtrace
+          if not os.path.isfile(dOpt[key]):
+            print("\n\nERROR: invariantCheck " + str(dOpt[key]) + " in input.yaml does not exist.\n")
+            exit(1)
+          fiCompileOptions.extend(['-invariantcheckpass', '-invariantfile=' + os.path.abspath(dOpt[key])])
+        elif key == "keepTrace":
+          if not isinstance(dOpt[key], bool):
+            print("\n\nERROR: keepTrace must be True or False in input.yaml.\n")
+            exit(1)
+          if dOpt[key]:
+            fiCompileOptions.append('-invariantkeeptrace')
+        else:
+          print("\n\nERROR: Unknown daikonTraceOption " + key + " in input.yaml.\n")
+          exit(1)
+
 ################################################################################
 def _suffixOfIR():
   if options["readable"]:
@@ -334,6 +370,7 @@ def compileProg():
     execlist = [optbin, '-load', llfilib, "-faultinjectionpass"]
     execlist2 = ['-o', fifile + _suffixOfIR(), llfi_indexed_file + _suffixOfIR()]
     execlist.extend(compileOptions)
+    execlist.extend(fiCompileOptions)
     execlist.extend(execlist2)
     if options["readable"]:
       execlist.append("-S")
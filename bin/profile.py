@@ -108,22 +108,29 @@ def execute(execlist):
   print('\t' + ' '.join(execlist))
   #get state of directory
   dirSnapshot()
+  starttime = time.time()
   p = subprocess.Popen(execlist, stdout=subprocess.PIPE)
-  elapsetime = 0
-  while True:
-    elapsetime += 1
-    time.sleep(1)
-    #print p.poll()
-    if p.poll() is not None:
-      moveOutput()
-      print("\t program finish", p.returncode)
-      print("\t time taken", elapsetime,"\n")
-      outputFile = open(outputfile, "wb")
-      outputFile.write(p.communicate()[0])
-      outputFile.close()
-      replenishInput() #for cases where program deletes input or alters them each run
-      #inputFile.close()
-      return p.returncode
+  output = p.communicate()[0]
+  elapsetime = time.time() - starttime
+  moveOutput()
+  print("\t program finish", p.returncode)
+  print("\t time taken", elapsetime,"\n")
+  outputFile = open(outputfile, "wb")
+  outputFile.write(output)
+  outputFile.close()
+  recordGoldenTime(elapsetime)
+  replenishInput() #for cases where program deletes input or alters them each run
+  #inputFile.close()
+  return p.returncode
+
+################################################################################
+def recordGoldenTime(elapsetime):
+  #injectfault compares the progress of faulty runs against the golden run.
+  #Kept apart from llfi.stat.prof.txt, whose last line the GUI reads as the
+  #cycle count
+  timeFile = open(os.path.join(baselinedir, "llfi.stat.time.prof.txt"), "w")
+  timeFile.write("total_time=%.3f\n" % elapsetime)
+  timeFile.close()
 
 ################################################################################
 def storeInputFiles():
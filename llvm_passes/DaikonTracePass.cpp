@@ -8,6 +8,25 @@ Authors: Arijit Chattopadhyay (https://github.com/arijitvt/RTool), Abraham Chan
   This pass injects a function call at the entry and exit points of 
   every function that prints variable type and value 
   to a file specified during the pass.
+
+  Every program point gets a static descriptor (name, variable names and
+  type codes, see runtime_lib/DaikonTrace.h), the hooks only pass its
+  address and the raw values.
+
+  Program point selection, on top of the built-in skip list:
+    -daikonpptfile=<file>     lines "include <pattern>", "exclude <pattern>" and
+                              "limit <invocations> <pattern>", patterns match the
+                              demangled function name with or without its
+                              parameters, '*' matches anything. With include
+                              lines only matching functions are instrumented,
+                              limit sets the recorded invocations of the function
+    -daikoncallprofile=<file> call profile of a profiling run (call_profile of
+                              DaikonTraceLib), functions called more often than
+                              -daikonmaxcalls times, or more often than
+                              -daikonmaxcallsperinvariant times per invariant found
+                              for them in -daikoninvariants, are hot. Hot functions
+                              are excluded, or limited to -daikonhotlimit recorded
+                              invocations when it is set
 ***************/
 
 #include "DaikonTracePass.h"
@@ -16,22 +35,66 @@ Authors: Arijit Chattopadhyay (https://github.com/arijitvt/RTool), Abraham Chan
 
 namespace llfi {
 
+//Initialize the pass
+char DaikonTrace::ID = 0;
+bool DaikonTrace::isInit = false;
+
+static cl::opt<string> daikonpptfile("daikonpptfile",
+	cl::desc("Program points to include, exclude or rate limit in the Daikon trace"),
+	cl::init(""));
+
+static cl::opt<string> daikoncallprofile("daikoncallprofile",
+	cl::desc("Invocations per program point of a profiling run of the Daikon trace"),
+	cl::init(""));
+
+static cl::opt<string> daikoninvariants("daikoninvariants",
+	cl::desc("Daikon invariants of a previous trace, weigh the call profile by the invariants per function"),
+	cl::init(""));
+
+static cl::opt<unsigned long long> daikonmaxcalls("daikonmaxcalls",
+	cl::desc("Functions with more calls in the call profile are hot (0: no limit)"),
+	cl::init(0));
+
+static cl::opt<double> daikonmaxcallsperinvariant("daikonmaxcallsperinvariant",
+	cl::desc("Functions with more calls per invariant in the call profile are hot (0: no limit)"),
+	cl::init(0));
+
+static cl::opt<int> daikonhotlimit("daikonhotlimit",
+	cl::desc("Recorded invocations of hot functions, they are not instrumented when 0"),
+	cl::init(0));
+
+//"..func(int):::ENTER" -> "func(int)"
+static string getPptFunctionName(string pptName) {
+	if(pptName.compare(0,2,"..") == 0) {
+		pptName = pptName.substr(2);
+	}
+	return pptName.substr(0,pptName.find(":::"));
+}
+
+static string trimString(const string &str) {
+	return StringRef(str).trim().str();
+}
+
 bool DaikonTrace::runOnFunction(Function &F) {
 
 	if (!isInit) {
 		
 		Module *module = F.getParent();	
 		doInit(module);
+		loadArrayAnnotations(module);
+		loadPptSelection(module);
 
 		generateProgramPoints(module);
 		loadProgramPoints(module);
 	}
 
 	//Generate function and variable declaration entries
+	computeComparability(&F);
 	dumpDeclFileAtEntryAndExit(&F,"ENTRY");
 	dumpDeclFileAtEntryAndExit(&F,"EXIT");
 	
 	//Instrument every function at entry and exit points 
+	dataLayout = &getAnalysis<DataLayout>();
 	hookAtFunctionStart(&F);
 	hookAtFunctionEnd(&F);
 
@@ -62,52 +125,40 @@ void DaikonTrace::hookAtFunctionStart(Function *func) {
 		}
 	}
 
-	int totalArgumentSize = Arguments.size();	
-	
-	/**
-	 * So far the format is varcount,function name, function params
-	 * The var count will count function params but not the function name
-	 */
-
-	Function *hookFunctionBegin = cast<Function>(module->getOrInsertFunction("clap_hookFuncBegin",functionType));
-	vector<Value*> argList;
-	Constant *argCount = ConstantInt::get(module->getContext(),APInt(32,totalArgumentSize,true));
-	argList.push_back(argCount);
+	Instruction *target = NULL;
+	for(inst_iterator institr = inst_begin(func); institr!= inst_end(func); ++institr) {
+		Instruction *ii = &*institr;
+		if(!isa<AllocaInst>(ii)) {
+			target = ii;
+			break;
+		}
+	}
 
-	//Send the function name
-	string funcNameStr = func->getName().str();
-	string finalNameToSend=".."+getDemangledFunctionName(funcNameStr.c_str())+":::ENTER";
-	StringRef finalNameToSendRef (finalNameToSend.c_str());
-	Value *funcNameValue = getValueForString(finalNameToSendRef,module);
-	argList.push_back(funcNameValue);
-	
 	/**
-	 * The format is  varname -vartype-varvalue
+	 * The names and types of the variables are in the static program point descriptor,
+	 * the hook only gets the descriptor followed by the raw values
 	 */
-	//Now Send the parameters
+	vector<string> varNames;
+	vector<uint32_t> varTypes;
 	for(vector<Value*>::iterator ArgItr = Arguments.begin(); ArgItr != Arguments.end(); ++ArgItr) {
-		Value *val= *ArgItr;
-		Value *valName = getValueForString(val->getName(),module);
-		string typeStr = getTypeString(val);
-		Value *type=getValueForString(StringRef(typeStr.c_str()).trim(),module);
-		argList.push_back(valName);
-		argList.push_back(type);
-		argList.push_back(val);
+		varNames.push_back((*ArgItr)->getName().trim().str());
+		varTypes.push_back(getTypeCode((*ArgItr)->getType()));
 	}
 
-	Instruction *target = NULL;
-
-	//To disable this instrumentation and follow the old approach then the comment out
-	//the function call to insertDummyStoreIntoFunction
-	Instruction *hookFunctionBeginInstruction = CallInst::Create(hookFunctionBegin,argList);
+	string funcNameStr = func->getName().str();
+	string pptName = ".."+getDemangledFunctionName(funcNameStr.c_str())+":::ENTER";
 
-	for(inst_iterator institr = inst_begin(func); institr!= inst_end(func); ++institr) {
-		Instruction *ii = &*institr;
-		if(!isa<AllocaInst>(ii)) {
-			target = ii;
-			break;
+	Function *hookFunctionBegin = cast<Function>(module->getOrInsertFunction("clap_hookPptBegin",pptHookType));
+	vector<Value*> argList;
+	argList.push_back(getProgramPointDescriptor(pptName,varNames,varTypes,getSampleLimit(func),module));
+	for(vector<Value*>::iterator ArgItr = Arguments.begin(); ArgItr != Arguments.end(); ++ArgItr) {
+		argList.push_back(getRawValue(*ArgItr,target));
+		if(isArrayType(*ArgItr)) {
+			argList.push_back(getArrayExtent(func,*ArgItr,target));
 		}
 	}
+
+	Instruction *hookFunctionBeginInstruction = CallInst::Create(hookFunctionBegin,argList);
 	hookFunctionBeginInstruction->insertBefore(target);
 
 }
@@ -132,14 +183,6 @@ void DaikonTrace::hookAtFunctionEnd(Function *func) {
 		}
 	}
 
-	int totalArgumentSize = Arguments.size();
-	
-
-	/**
-	 * So far the format is varcount,function name, function params
-	 * The var count will count function params but not the function name
-	 */
- 
 	//First Check the return type
 	bool hasReturn = false;
 	StringRef returnTypeRef( getTypeString(func->getReturnType()));
@@ -147,43 +190,7 @@ void DaikonTrace::hookAtFunctionEnd(Function *func) {
 		hasReturn = true;
 	}
 
-	//Now standard process
-	Function *hookFunctionEnd = cast<Function>(module->getOrInsertFunction("clap_hookFuncEnd",functionType));
-	vector<Value*> argList;
-	Constant *argCount ; 
-	if(hasReturn) {
-		//One extra for return type
-		argCount = ConstantInt::get(module->getContext(),APInt(32,totalArgumentSize+1,true));
-	}else {
-		argCount = ConstantInt::get(module->getContext(),APInt(32,totalArgumentSize,true));
-	}
-
-	argList.push_back(argCount);
-
-
-	//Send the function name
-	string funcNameStr = func->getName().str();
-	string finalNameToSend=".."+getDemangledFunctionName(funcNameStr.c_str())+":::EXIT0";
-	StringRef finalNameToSendRef (finalNameToSend.c_str());
-	Value *funcNameValue = getValueForString(finalNameToSendRef,module);
-	argList.push_back(funcNameValue);
-	
-	/**
-	 * The format is  varname -vartype-varvalue
-	 */
-	//Now Send the parameters
-	//for(Function::arg_iterator argItr = func->arg_begin(); argItr != func->arg_end(); ++argItr) {
-	for(vector<Value*>::iterator ArgItr = Arguments.begin(); ArgItr != Arguments.end(); ++ArgItr) {
-		Value *val= *ArgItr;
-		Value *valName = getValueForString(val->getName(),module);
-		string typeStr = getTypeString(val);
-		Value *type=getValueForString(StringRef(typeStr.c_str()).trim(),module);
-		argList.push_back(valName);
-		argList.push_back(type);
-		argList.push_back(val);
-	}
-
-	//First find the return instruction and push the return value if the return is int type
+	//Find the return instruction and push the return value if the return is a supported type
 	Instruction *target = NULL;
 	for(Function::iterator bbItr = func->begin(); bbItr != func->end(); ++bbItr) {
 		Instruction *ii = bbItr->getTerminator();
@@ -193,14 +200,30 @@ void DaikonTrace::hookAtFunctionEnd(Function *func) {
 		}
 	}
 
+	vector<string> varNames;
+	vector<uint32_t> varTypes;
+	for(vector<Value*>::iterator ArgItr = Arguments.begin(); ArgItr != Arguments.end(); ++ArgItr) {
+		varNames.push_back((*ArgItr)->getName().trim().str());
+		varTypes.push_back(getTypeCode((*ArgItr)->getType()));
+	}
 	if(hasReturn) {
 		ReturnInst *retInst = static_cast<ReturnInst*>(target);
-		Value *val= retInst->getReturnValue();
-		Value *valName = getValueForString("return",module);
-		Value *type=getValueForString(StringRef(getTypeString(val).c_str()).trim(),module);
-		argList.push_back(valName);
-		argList.push_back(type);
-		argList.push_back(val);
+		Arguments.push_back(retInst->getReturnValue());
+		varNames.push_back("return");
+		varTypes.push_back(getTypeCode(func->getReturnType()));
+	}
+
+	string funcNameStr = func->getName().str();
+	string pptName = ".."+getDemangledFunctionName(funcNameStr.c_str())+":::EXIT0";
+
+	Function *hookFunctionEnd = cast<Function>(module->getOrInsertFunction("clap_hookPptEnd",pptHookType));
+	vector<Value*> argList;
+	argList.push_back(getProgramPointDescriptor(pptName,varNames,varTypes,getSampleLimit(func),module));
+	for(vector<Value*>::iterator ArgItr = Arguments.begin(); ArgItr != Arguments.end(); ++ArgItr) {
+		argList.push_back(getRawValue(*ArgItr,target));
+		if(isArrayType(*ArgItr)) {
+			argList.push_back(getArrayExtent(func,*ArgItr,target));
+		}
 	}
 
 	Instruction *hookFunctionEndInstruction = CallInst::Create(hookFunctionEnd,argList);
@@ -228,7 +251,7 @@ void DaikonTrace::dumpDeclFileAtEntryAndExit(Function *func, string EntryOrExit)
 		fstream declFileHeader(declFileName,ios::in);
 
 		if (isFileEmpty(declFileHeader)) {
-			versionInfo = "input-language C/C++\ndecl-version 2.0\nvar-comparability none\n\n";
+			versionInfo = "input-language C/C++\ndecl-version 2.0\nvar-comparability implicit\n\n";
 			flagToWriteVersionIntoDtrace = false;
 			declFileHeader.close();
 		}
@@ -286,6 +309,8 @@ void DaikonTrace::dumpDeclFileAtEntryAndExit(Function *func, string EntryOrExit)
 				declFile<<"dec-type "<<getTypeString(v)<<"\n";
 				putTabInFile(declFile,tabCount);
 				declFile<<"flags is_param\n";
+				putTabInFile(declFile,tabCount);
+				declFile<<"comparability "<<varComparability[varName]<<"\n";
 			}
 
 			if(EntryOrExit == "EXIT") {
@@ -301,6 +326,8 @@ void DaikonTrace::dumpDeclFileAtEntryAndExit(Function *func, string EntryOrExit)
 				declFile<<"rep-type "<<returnType<<"\n";
 				putTabInFile(declFile,tabCount);
 				declFile<<"dec-type "<<returnType<<"\n";
+				putTabInFile(declFile,tabCount);
+				declFile<<"comparability "<<varComparability["return"]<<"\n";
 			    }
 			}
 
@@ -310,6 +337,177 @@ void DaikonTrace::dumpDeclFileAtEntryAndExit(Function *func, string EntryOrExit)
 	}
 }
 
+/**
+ * Union-find over the values of a function. Every class can point to the class
+ * of the values stored in its memory and to the class of the indices it is
+ * accessed with, unifying two classes unifies what they point to
+ */
+struct ComparabilityClasses {
+	map<Value*,int> nodes;
+	vector<int> parent;
+	vector<int> pointee;
+	vector<int> index;
+
+	int addNode() {
+		parent.push_back(parent.size());
+		pointee.push_back(-1);
+		index.push_back(-1);
+		return parent.size() - 1;
+	}
+
+	//Constants are comparable to everything and get no node
+	int getNode(Value *value) {
+		if(!isa<Instruction>(value) && !isa<Argument>(value)) {
+			return -1;
+		}
+		map<Value*,int>::iterator itr = nodes.find(value);
+		if(itr != nodes.end()) {
+			return itr->second;
+		}
+		int node = addNode();
+		nodes[value] = node;
+		return node;
+	}
+
+	int find(int node) {
+		while(parent[node] != node) {
+			parent[node] = parent[parent[node]];
+			node = parent[node];
+		}
+		return node;
+	}
+
+	void unite(int a, int b) {
+		if(a < 0 || b < 0) {
+			return;
+		}
+		a = find(a);
+		b = find(b);
+		if(a == b) {
+			return;
+		}
+		parent[b] = a;
+		if(pointee[a] < 0) {
+			pointee[a] = pointee[b];
+		} else {
+			unite(pointee[a],pointee[b]);
+		}
+		a = find(a);
+		if(index[a] < 0) {
+			index[a] = index[b];
+		} else {
+			unite(index[a],index[b]);
+		}
+	}
+
+	void unite(Value *a, Value *b) {
+		unite(getNode(a),getNode(b));
+	}
+
+	int getPointee(Value *pointer) {
+		int node = getNode(pointer);
+		if(node < 0) {
+			return -1;
+		}
+		node = find(node);
+		if(pointee[node] < 0) {
+			int target = addNode();
+			pointee[node] = target;
+		}
+		return pointee[node];
+	}
+
+	int getIndex(Value *pointer) {
+		int node = getNode(pointer);
+		if(node < 0) {
+			return -1;
+		}
+		node = find(node);
+		if(index[node] < 0) {
+			int target = addNode();
+			index[node] = target;
+		}
+		return index[node];
+	}
+};
+
+/**
+ * Comparability classes for var-comparability implicit: values are comparable when
+ * they meet in an arithmetic operation, a comparison, a phi or select, or in memory,
+ * including the allocas the parameters are spilled to. Calls are not followed.
+ * Arrays are written "elements[indices]"
+ */
+void DaikonTrace::computeComparability(Function *func) {
+	ComparabilityClasses classes;
+	vector<Value*> returnValues;
+	for(inst_iterator instItr = inst_begin(func); instItr != inst_end(func); ++instItr) {
+		Instruction *inst = &*instItr;
+		if(isa<BinaryOperator>(inst)) {
+			classes.unite(inst,inst->getOperand(0));
+			classes.unite(inst,inst->getOperand(1));
+		} else if(isa<CmpInst>(inst)) {
+			classes.unite(inst->getOperand(0),inst->getOperand(1));
+		} else if(isa<CastInst>(inst)) {
+			classes.unite(inst,inst->getOperand(0));
+		} else if(SelectInst *select = dyn_cast<SelectInst>(inst)) {
+			classes.unite(select,select->getTrueValue());
+			classes.unite(select,select->getFalseValue());
+		} else if(PHINode *phi = dyn_cast<PHINode>(inst)) {
+			for(unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+				classes.unite(phi,phi->getIncomingValue(i));
+			}
+		} else if(LoadInst *load = dyn_cast<LoadInst>(inst)) {
+			classes.unite(classes.getNode(load),classes.getPointee(load->getPointerOperand()));
+		} else if(StoreInst *store = dyn_cast<StoreInst>(inst)) {
+			classes.unite(classes.getNode(store->getValueOperand()),classes.getPointee(store->getPointerOperand()));
+		} else if(GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(inst)) {
+			classes.unite(gep,gep->getPointerOperand());
+			for(User::op_iterator idx = gep->idx_begin(); idx != gep->idx_end(); ++idx) {
+				classes.unite(classes.getNode(*idx),classes.getIndex(gep->getPointerOperand()));
+			}
+		} else if(ReturnInst *ret = dyn_cast<ReturnInst>(inst)) {
+			if(ret->getReturnValue() != NULL) {
+				returnValues.push_back(ret->getReturnValue());
+			}
+		}
+	}
+	int returnNode = classes.addNode();
+	for(vector<Value*>::iterator retItr = returnValues.begin(); retItr != returnValues.end(); ++retItr) {
+		classes.unite(returnNode,classes.getNode(*retItr));
+	}
+
+	//Class numbers are unique in the module
+	map<int,int> classNumbers;
+	varComparability.clear();
+	for(Function::arg_iterator argItr = func->arg_begin(); argItr != func->arg_end(); ++argItr) {
+		Argument *arg = &*argItr;
+		string varName = arg->getName().trim().str();
+		vector<int> varClasses(1,classes.getNode(arg));
+		if(isArrayType(arg)) {
+			varClasses[0] = classes.getPointee(arg);
+			varClasses.push_back(classes.getIndex(arg));
+		}
+		string comparability;
+		for(unsigned i = 0; i < varClasses.size(); ++i) {
+			int rep = classes.find(varClasses[i]);
+			if(classNumbers.find(rep) == classNumbers.end()) {
+				classNumbers[rep] = ++numComparabilityClasses;
+			}
+			ostringstream number;
+			number<<classNumbers[rep];
+			comparability += i == 0 ? number.str() : "[" + number.str() + "]";
+		}
+		varComparability[varName] = comparability;
+	}
+	int rep = classes.find(returnNode);
+	if(classNumbers.find(rep) == classNumbers.end()) {
+		classNumbers[rep] = ++numComparabilityClasses;
+	}
+	ostringstream number;
+	number<<classNumbers[rep];
+	varComparability["return"] = number.str();
+}
+
 void DaikonTrace::generateProgramPoints(Module *module) {
 	fstream pptFile("ProgramPoints.ppts",ios::out);
 	if(pptFile.is_open()) { 		
@@ -367,6 +565,8 @@ void DaikonTrace::doInit(Module *module) {
 	ptr8Type  = PointerType::get(int8Type,0);
 	ptr32Type = PointerType::get(int32Type,0);
 	ptr64Type = PointerType::get(int64Type,0);
+	ptrPtr8Type = PointerType::get(ptr8Type,0);
+	doubleType = Type::getDoubleTy(module->getContext());
 
 	ptrPtr32Type = PointerType::get(ptr32Type,0);
 	ptrPtr64Type = PointerType::get(ptr64Type,0);
@@ -380,7 +580,13 @@ void DaikonTrace::doInit(Module *module) {
 	ptrStructType = PointerType::get(structType,0);
 	ptrPtrStructType = PointerType::get(ptrStructType,0);
 
-	functionType = FunctionType::get(voidType,true);
+	//Layout of struct DaikonPpt in runtime_lib/DaikonTrace.h
+	Type *pptFields[] = { ptr8Type, int32Type, int32Type, ptrPtr8Type, ptr32Type, int32Type };
+	pptType = StructType::get(module->getContext(),pptFields);
+	Type *hookParams[] = { PointerType::get(pptType,0) };
+	pptHookType = FunctionType::get(voidType,hookParams,true);
+	numProgramPoints = 0;
+	numComparabilityClasses = 0;
 	isInit = true;
 }
 
@@ -407,9 +613,181 @@ bool DaikonTrace::doNotInstrument(StringRef funcName) {
 	|| funcName.find("sha") != StringRef::npos) {
 		return true;
 	}
+	return excludedFunctions.count(funcName.str()) != 0;
+}
+
+/**
+ * Applies -daikonpptfile and the call profile to the functions of the module
+ */
+void DaikonTrace::loadPptSelection(Module *module) {
+	vector<string> includePatterns, excludePatterns;
+	vector<pair<string,int32_t> > limitPatterns;
+	if(!daikonpptfile.empty()) {
+		ifstream pptFile(daikonpptfile.c_str());
+		if(!pptFile.is_open()) {
+			errs()<<"ERROR: Unable to open the program point file "<<daikonpptfile<<"\n";
+			exit(1);
+		}
+		string line;
+		while(getline(pptFile,line)) {
+			istringstream words(line);
+			string action, pattern;
+			if(!(words>>action) || action[0] == '#') {
+				continue;
+			}
+			int32_t limit = 0;
+			if(action == "limit" && !(words>>limit)) {
+				limit = -1;
+			}
+			getline(words,pattern);
+			pattern = trimString(pattern);
+			if(pattern.empty() || limit < 0) {
+				errs()<<"ERROR: Malformed line in "<<daikonpptfile<<": "<<line<<"\n";
+				exit(1);
+			}
+			if(action == "include") {
+				includePatterns.push_back(pattern);
+			} else if(action == "exclude") {
+				excludePatterns.push_back(pattern);
+			} else if(action == "limit") {
+				limitPatterns.push_back(make_pair(pattern,limit));
+			} else {
+				errs()<<"ERROR: Unknown action "<<action<<" in "<<daikonpptfile<<"\n";
+				exit(1);
+			}
+		}
+	}
+
+	map<string,unsigned long long> calls;
+	if(!daikoncallprofile.empty()) {
+		ifstream profileFile(daikoncallprofile.c_str());
+		if(!profileFile.is_open()) {
+			errs()<<"ERROR: Unable to open the call profile "<<daikoncallprofile<<"\n";
+			exit(1);
+		}
+		unsigned long long count;
+		string pptName;
+		while(profileFile>>count && getline(profileFile,pptName)) {
+			calls[getPptFunctionName(trimString(pptName))] += count;
+		}
+	}
+
+	//Invariants of all the program points of a function, in the format read by ValidateInvariants
+	map<string,unsigned> invariants;
+	if(!daikoninvariants.empty()) {
+		ifstream invariantFile(daikoninvariants.c_str());
+		if(!invariantFile.is_open()) {
+			errs()<<"ERROR: Unable to open the invariants "<<daikoninvariants<<"\n";
+			exit(1);
+		}
+		string line, funcName;
+		bool inPpt = false;
+		while(getline(invariantFile,line)) {
+			if(line.compare(0,2,"==") == 0) {
+				inPpt = false;
+			} else if(line.compare(0,7,"Exiting") == 0) {
+				break;
+			} else if(line.compare(0,2,"..") == 0) {
+				funcName = getPptFunctionName(trimString(line));
+				inPpt = true;
+			} else if(inPpt && !trimString(line).empty()) {
+				++invariants[funcName];
+			}
+		}
+	}
+
+	unsigned numExcluded = 0, numLimited = 0;
+	for(Module::iterator funcItr = module->begin(); funcItr != module->end(); ++funcItr) {
+		if(funcItr->isDeclaration()) {
+			continue;
+		}
+		string name = funcItr->getName().str();
+		string funcName = getDemangledFunctionName(name.c_str());
+
+		bool excluded = false;
+		if(!includePatterns.empty()) {
+			excluded = true;
+			for(vector<string>::iterator itr = includePatterns.begin(); itr != includePatterns.end(); ++itr) {
+				if(matchesPattern(*itr,funcName)) {
+					excluded = false;
+				}
+			}
+		}
+		for(vector<string>::iterator itr = excludePatterns.begin(); itr != excludePatterns.end(); ++itr) {
+			if(matchesPattern(*itr,funcName)) {
+				excluded = true;
+			}
+		}
+		//the last matching limit line applies
+		int32_t limit = 0;
+		for(vector<pair<string,int32_t> >::iterator itr = limitPatterns.begin(); itr != limitPatterns.end(); ++itr) {
+			if(matchesPattern(itr->first,funcName)) {
+				limit = itr->second;
+			}
+		}
+
+		map<string,unsigned long long>::iterator callItr = calls.find(funcName);
+		if(!excluded && limit == 0 && callItr != calls.end()) {
+			double callsPerInvariant = (double)callItr->second / max(1u,invariants[funcName]);
+			bool hot = (daikonmaxcalls > 0 && callItr->second > daikonmaxcalls) ||
+				(daikonmaxcallsperinvariant > 0 && callsPerInvariant > daikonmaxcallsperinvariant);
+			if(hot && daikonhotlimit > 0) {
+				limit = daikonhotlimit;
+			} else if(hot) {
+				excluded = true;
+			}
+		}
+
+		if(excluded) {
+			excludedFunctions.insert(name);
+			++numExcluded;
+		} else if(limit > 0) {
+			functionSampleLimits[name] = limit;
+			++numLimited;
+		}
+	}
+	if(numExcluded != 0 || numLimited != 0) {
+		errs()<<"DaikonTrace: "<<numExcluded<<" functions excluded, "<<numLimited<<" rate limited\n";
+	}
+}
+
+/**
+ * Glob match of a -daikonpptfile pattern against "func(int)" or "func"
+ */
+bool DaikonTrace::matchesPattern(const string &pattern, const string &funcName) {
+	string baseName = funcName.substr(0,funcName.find('('));
+	for(int i = 0; i < 2; ++i) {
+		const string &name = i == 0 ? funcName : baseName;
+		size_t p = 0, n = 0, star = string::npos, mark = 0;
+		while(n < name.size()) {
+			if(p < pattern.size() && pattern[p] == '*') {
+				star = p++;
+				mark = n;
+			} else if(p < pattern.size() && pattern[p] == name[n]) {
+				++p;
+				++n;
+			} else if(star != string::npos) {
+				p = star + 1;
+				n = ++mark;
+			} else {
+				break;
+			}
+		}
+		while(p < pattern.size() && pattern[p] == '*') {
+			++p;
+		}
+		if(n == name.size() && p == pattern.size()) {
+			return true;
+		}
+	}
 	return false;
 }
 
+int32_t DaikonTrace::getSampleLimit(Function *func) {
+	map<string,int32_t>::iterator itr = functionSampleLimits.find(func->getName().str());
+	return itr != functionSampleLimits.end() ? itr->second : 0;
+}
+
 void DaikonTrace::putTabInFile(fstream &stream, int tabCount) {
 	if(stream.is_open()) {
 		for(int i = 0 ; i  < tabCount; ++i) {
@@ -422,12 +800,265 @@ bool DaikonTrace::isFileEmpty(fstream &inputFile) {
 	return ( inputFile.peek() == istream::traits_type::eof() );
 }
 
-Value* DaikonTrace::getValueForString(StringRef variableName, Module *module) {
+/**
+ * Strings are emitted once per module and shared by every program point
+ */
+Constant* DaikonTrace::getValueForString(StringRef variableName, Module *module) {
+	map<string,Constant*>::iterator itr = stringTable.find(variableName.str());
+	if(itr != stringTable.end()) {
+		return itr->second;
+	}
 	Constant *valueName = ConstantDataArray::getString(module->getContext(), variableName,true);
-	Value *val = new GlobalVariable(*module,valueName->getType(), true, GlobalValue::InternalLinkage,valueName);
+	GlobalVariable *var = new GlobalVariable(*module,valueName->getType(), true, GlobalValue::InternalLinkage,valueName,"daikon.str");
+	var->setUnnamedAddr(true);
+	Constant *val = ConstantExpr::getBitCast(var,ptr8Type);
+	stringTable[variableName.str()] = val;
 	return val;
 }
 
+Constant* DaikonTrace::getProgramPointDescriptor(string pptName, vector<string> &varNames, vector<uint32_t> &varTypes,
+	int32_t sampleLimit, Module *module) {
+	Constant *names = ConstantPointerNull::get(ptrPtr8Type);
+	Constant *types = ConstantPointerNull::get(ptr32Type);
+
+	if(!varNames.empty()) {
+		vector<Constant*> nameValues;
+		for(vector<string>::iterator itr = varNames.begin(); itr != varNames.end(); ++itr) {
+			nameValues.push_back(getValueForString(*itr,module));
+		}
+		ArrayType *namesType = ArrayType::get(ptr8Type,nameValues.size());
+		GlobalVariable *namesVar = new GlobalVariable(*module,namesType,true,GlobalValue::InternalLinkage,
+			ConstantArray::get(namesType,nameValues),"daikon.ppt.names");
+		names = ConstantExpr::getBitCast(namesVar,ptrPtr8Type);
+
+		Constant *typeCodes = ConstantDataArray::get(module->getContext(),varTypes);
+		GlobalVariable *typesVar = new GlobalVariable(*module,typeCodes->getType(),true,GlobalValue::InternalLinkage,
+			typeCodes,"daikon.ppt.types");
+		types = ConstantExpr::getBitCast(typesVar,ptr32Type);
+	}
+
+	Constant *fields[] = {
+		getValueForString(pptName,module),
+		ConstantInt::get(int32Type,numProgramPoints++),
+		ConstantInt::get(int32Type,varNames.size()),
+		names,
+		types,
+		ConstantInt::get(int32Type,sampleLimit)
+	};
+	return new GlobalVariable(*module,pptType,true,GlobalValue::InternalLinkage,
+		ConstantStruct::get(pptType,fields),"daikon.ppt");
+}
+
+/**
+ * Integers are passed as 64 bit and floats as doubles, so the runtime can read every
+ * scalar with a single va_arg per type code
+ */
+Value* DaikonTrace::getRawValue(Value *value, Instruction *insertPoint) {
+	Type *type = value->getType();
+	if(type->isIntegerTy() && type != int64Type) {
+		return CastInst::CreateIntegerCast(value,int64Type,!type->isIntegerTy(1),"",insertPoint);
+	}
+	if(type->isFloatTy()) {
+		return new FPExtInst(value,doubleType,"",insertPoint);
+	}
+	return value;
+}
+
+bool DaikonTrace::isArrayType(Value *value) {
+	uint32_t typeCode = getTypeCode(value->getType());
+	return typeCode == DAIKON_TYPE_INT_ARRAY || typeCode == DAIKON_TYPE_INT64_ARRAY ||
+		typeCode == DAIKON_TYPE_DOUBLE_ARRAY;
+}
+
+/**
+ * Lengths of array parameters can be annotated on the function, e.g.
+ *   __attribute__((annotate("daikon_len:data=n"), annotate("daikon_len:buf=16")))
+ * where the length is another parameter or a constant
+ */
+void DaikonTrace::loadArrayAnnotations(Module *module) {
+	GlobalVariable *annotations = module->getGlobalVariable("llvm.global.annotations");
+	if(annotations == NULL || !annotations->hasInitializer()) {
+		return;
+	}
+	ConstantArray *entries = dyn_cast<ConstantArray>(annotations->getInitializer());
+	if(entries == NULL) {
+		return;
+	}
+	for(unsigned i = 0; i < entries->getNumOperands(); ++i) {
+		ConstantStruct *entry = dyn_cast<ConstantStruct>(entries->getOperand(i));
+		if(entry == NULL || entry->getNumOperands() < 2) {
+			continue;
+		}
+		Function *func = dyn_cast<Function>(entry->getOperand(0)->stripPointerCasts());
+		GlobalVariable *textVar = dyn_cast<GlobalVariable>(entry->getOperand(1)->stripPointerCasts());
+		if(func == NULL || textVar == NULL || !textVar->hasInitializer()) {
+			continue;
+		}
+		ConstantDataArray *text = dyn_cast<ConstantDataArray>(textVar->getInitializer());
+		if(text == NULL || !text->isCString()) {
+			continue;
+		}
+		StringRef annotation = text->getAsCString();
+		if(!annotation.startswith("daikon_len:")) {
+			continue;
+		}
+		pair<StringRef,StringRef> arrayAndLength = annotation.substr(11).split('=');
+		arrayAnnotations[func][arrayAndLength.first.trim().str()] = arrayAndLength.second.trim().str();
+	}
+}
+
+/**
+ * Number of elements of an array variable as an i64 value, -1 when it can not be recovered.
+ * In order: an annotation, a parameter named after the length of the array, the constant
+ * size of the allocation the array points to (for parameters, the smallest over all callers)
+ */
+Value* DaikonTrace::getArrayExtent(Function *func, Value *array, Instruction *insertPoint) {
+	Type *elementType = cast<PointerType>(array->getType())->getElementType();
+	Argument *arrayArg = dyn_cast<Argument>(array);
+	int64_t extent = -1;
+
+	if(arrayArg != NULL) {
+		string arrayName = arrayArg->getName().trim().str();
+		map<Function*,map<string,string> >::iterator annotated = arrayAnnotations.find(func);
+		if(annotated != arrayAnnotations.end() && annotated->second.count(arrayName)) {
+			string length = annotated->second[arrayName];
+			if(!length.empty() && isdigit(length[0])) {
+				return ConstantInt::get(int64Type,atoll(length.c_str()),true);
+			}
+			Value *lengthArg = getLengthArgument(func,length);
+			if(lengthArg != NULL) {
+				return getRawValue(lengthArg,insertPoint);
+			}
+			errs()<<"WARNING: Unknown length "<<length<<" annotated for "<<arrayName<<" in "<<func->getName()<<"\n";
+		}
+
+		//Only parameters named after the array count as its length ("a_len", "n_a", "nA"),
+		//a parameter like "n" may as well be the length of another array. Sizes are taken
+		//as byte counts and divided by the element size
+		const char *lengthNames[] = { "_len", "_length", "_count", "Len", "Length", "Count" };
+		const char *byteNames[] = { "_size", "_bytes", "Size", "Bytes" };
+		const char *lengthPrefixes[] = { "n_", "len_", "num_", "n", "num", "len" };
+		string capitalized = arrayName;
+		if(!capitalized.empty()) {
+			capitalized[0] = toupper(capitalized[0]);
+		}
+		Value *lengthArg = NULL;
+		for(unsigned i = 0; lengthArg == NULL && i < sizeof(lengthNames)/sizeof(lengthNames[0]); ++i) {
+			lengthArg = getLengthArgument(func,arrayName+lengthNames[i]);
+		}
+		for(unsigned i = 0; lengthArg == NULL && i < sizeof(lengthPrefixes)/sizeof(lengthPrefixes[0]); ++i) {
+			lengthArg = getLengthArgument(func,lengthPrefixes[i]+arrayName);
+			if(lengthArg == NULL && capitalized != arrayName) {
+				lengthArg = getLengthArgument(func,lengthPrefixes[i]+capitalized);
+			}
+		}
+		if(lengthArg != NULL) {
+			return getRawValue(lengthArg,insertPoint);
+		}
+		for(unsigned i = 0; lengthArg == NULL && i < sizeof(byteNames)/sizeof(byteNames[0]); ++i) {
+			lengthArg = getLengthArgument(func,arrayName+byteNames[i]);
+		}
+		if(lengthArg != NULL) {
+			uint64_t elementSize = dataLayout->getTypeAllocSize(elementType);
+			Value *bytes = getRawValue(lengthArg,insertPoint);
+			if(elementSize <= 1) {
+				return bytes;
+			}
+			return BinaryOperator::CreateSDiv(bytes,ConstantInt::get(int64Type,elementSize),"",insertPoint);
+		}
+
+		//Every caller has to pass an allocation of known size
+		for(Value::use_iterator useItr = func->use_begin(); useItr != func->use_end(); ++useItr) {
+			CallSite callSite(*useItr);
+			if(!callSite || callSite.getCalledValue() != func) {
+				extent = -1;
+				break;
+			}
+			int64_t elements = getAllocatedElements(callSite.getArgument(arrayArg->getArgNo()),elementType);
+			if(elements < 0) {
+				extent = -1;
+				break;
+			}
+			if(extent < 0 || elements < extent) {
+				extent = elements;
+			}
+		}
+	}else {
+		extent = getAllocatedElements(array,elementType);
+	}
+	return ConstantInt::get(int64Type,extent,true);
+}
+
+Value* DaikonTrace::getLengthArgument(Function *func, string name) {
+	for(Function::arg_iterator argItr = func->arg_begin(); argItr != func->arg_end(); ++argItr) {
+		if(argItr->getType()->isIntegerTy() && argItr->getName().trim() == name) {
+			return &*argItr;
+		}
+	}
+	return NULL;
+}
+
+int64_t DaikonTrace::getAllocatedElements(Value *pointer, Type *elementType) {
+	uint64_t elementSize = dataLayout->getTypeAllocSize(elementType);
+	Value *base = pointer->stripPointerCasts();
+	uint64_t bytes = 0;
+	if(elementSize == 0) {
+		return -1;
+	}
+
+	if(AllocaInst *alloca = dyn_cast<AllocaInst>(base)) {
+		ConstantInt *count = dyn_cast<ConstantInt>(alloca->getArraySize());
+		if(count == NULL) {
+			return -1;
+		}
+		bytes = dataLayout->getTypeAllocSize(alloca->getAllocatedType()) * count->getZExtValue();
+	}else if(GlobalVariable *global = dyn_cast<GlobalVariable>(base)) {
+		bytes = dataLayout->getTypeAllocSize(global->getType()->getElementType());
+	}else if(CallInst *call = dyn_cast<CallInst>(base)) {
+		Function *callee = call->getCalledFunction();
+		if(callee == NULL) {
+			return -1;
+		}
+		if(callee->getName() == "malloc" && call->getNumArgOperands() == 1) {
+			ConstantInt *size = dyn_cast<ConstantInt>(call->getArgOperand(0));
+			if(size == NULL) {
+				return -1;
+			}
+			bytes = size->getZExtValue();
+		}else if(callee->getName() == "calloc" && call->getNumArgOperands() == 2) {
+			ConstantInt *count = dyn_cast<ConstantInt>(call->getArgOperand(0));
+			ConstantInt *size = dyn_cast<ConstantInt>(call->getArgOperand(1));
+			if(count == NULL || size == NULL) {
+				return -1;
+			}
+			bytes = count->getZExtValue() * size->getZExtValue();
+		}else {
+			return -1;
+		}
+	}else {
+		return -1;
+	}
+	return bytes / elementSize;
+}
+
+uint32_t DaikonTrace::getTypeCode(Type *type) {
+	string typeStr = getTypeString(type);
+	if(typeStr == "int") {
+		return DAIKON_TYPE_INT;
+	}else if(typeStr == "char") {
+		return DAIKON_TYPE_CHAR;
+	}else if(typeStr == "float" || typeStr == "double") {
+		return DAIKON_TYPE_DOUBLE;
+	}else if(typeStr == "int[]") {
+		return type == ptr64Type ? DAIKON_TYPE_INT64_ARRAY : DAIKON_TYPE_INT_ARRAY;
+	}else if(typeStr == "double[]") {
+		return DAIKON_TYPE_DOUBLE_ARRAY;
+	}else if(typeStr == "char*") {
+		return DAIKON_TYPE_STRING;
+	}
+	return DAIKON_TYPE_UNKNOWN;
+}
+
 string DaikonTrace::find_and_replace(string source, const char find, const string replace) {
 	for(string::size_type i = 0; (i = source.find(find, i)) != string::npos;)
 	{
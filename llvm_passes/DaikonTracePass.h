@@ -8,6 +8,13 @@ Authors: Arijit Chattopadhyay (https://github.com/arijitvt/RTool), Abraham Chan
   This pass injects a function call at the entry and exit points of 
   every function that prints variable type and value 
   to a file specified during the pass.
+
+  Which functions are instrumented can be narrowed with a program point
+  file (-daikonpptfile) and the call profile of a profiling run
+  (-daikoncallprofile), see DaikonTracePass.cpp.
+
+  The declarations use var-comparability implicit, variables only get the
+  same comparability class when their values meet in the function.
 ***************/
 
 #ifndef DAIKONTRACE_PASS_H
@@ -25,14 +32,19 @@ Authors: Arijit Chattopadhyay (https://github.com/arijitvt/RTool), Abraham Chan
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/InstIterator.h"
+#include "llvm/Support/CallSite.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/IR/DataLayout.h"
 
 #include <cmath>
+#include <cctype>
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
 #include <fstream>
+#include <sstream>
+#include <cstdlib>
 #include <algorithm>
 
 using namespace llvm;
@@ -41,6 +53,18 @@ using namespace std;
 
 namespace llfi {
 
+//Variable type codes, must match the DAIKON_TYPE_* values of runtime_lib/DaikonTrace.h
+enum DaikonTypeCode {
+	DAIKON_TYPE_INT = 0,
+	DAIKON_TYPE_CHAR = 1,
+	DAIKON_TYPE_DOUBLE = 2,
+	DAIKON_TYPE_INT_ARRAY = 3,
+	DAIKON_TYPE_INT64_ARRAY = 4,
+	DAIKON_TYPE_DOUBLE_ARRAY = 5,
+	DAIKON_TYPE_STRING = 6,
+	DAIKON_TYPE_UNKNOWN = 255
+};
+
 class DaikonTrace : public FunctionPass {
 
   public:
@@ -58,6 +82,8 @@ class DaikonTrace : public FunctionPass {
 	PointerType *ptr8Type; 
 	PointerType *ptr32Type;
 	PointerType *ptr64Type;
+	PointerType *ptrPtr8Type;
+	Type *doubleType;
 
 	PointerType *ptrPtr32Type;
 	PointerType *ptrPtr64Type;
@@ -71,7 +97,17 @@ class DaikonTrace : public FunctionPass {
 	PointerType *ptrStructType;
 	PointerType *ptrPtrStructType;
 
-	FunctionType *functionType;
+	StructType *pptType;
+	FunctionType *pptHookType;
+	int numProgramPoints;
+	map<string,Constant*> stringTable;
+	map<Function*,map<string,string> > arrayAnnotations;
+	set<string> excludedFunctions;
+	map<string,int32_t> functionSampleLimits;
+	//Comparability of the variables of the current function, "return" for the return value
+	map<string,string> varComparability;
+	int numComparabilityClasses;
+	DataLayout *dataLayout;
 	Value *clapDummyVar;
 
   public:
@@ -94,14 +130,29 @@ class DaikonTrace : public FunctionPass {
 	void generateProgramPoints(Module *);
 	void loadProgramPoints(Module *);
 	void dumpDeclFileAtEntryAndExit(Function*, string);
+	void computeComparability(Function *func);
 
 	//Utilities
 	bool isGlobal(Value *value);
 	bool isSupportedType(StringRef typeName);
 	bool doNotInstrument(StringRef funcName);
+	void loadPptSelection(Module *module);
+	bool matchesPattern(const string &pattern, const string &funcName);
+	int32_t getSampleLimit(Function *func);
 	void putTabInFile(fstream &stream, int tabCount);
 	bool isFileEmpty(fstream &inputFile);
-	Value* getValueForString(StringRef variableName,Module *module);
+	Constant* getValueForString(StringRef variableName,Module *module);
+	Constant* getProgramPointDescriptor(string pptName, vector<string> &varNames, vector<uint32_t> &varTypes,
+		int32_t sampleLimit, Module *module);
+	Value* getRawValue(Value *value, Instruction *insertPoint);
+	uint32_t getTypeCode(Type *type);
+
+	//Array extents
+	bool isArrayType(Value *value);
+	void loadArrayAnnotations(Module *module);
+	Value* getArrayExtent(Function *func, Value *array, Instruction *insertPoint);
+	Value* getLengthArgument(Function *func, string name);
+	int64_t getAllocatedElements(Value *pointer, Type *elementType);
 	string find_and_replace(string source, const char find, const string replace);
 	string demangle(const char* name);
 	string getDemangledFunctionName(const char* name);
@@ -110,9 +161,5 @@ class DaikonTrace : public FunctionPass {
 
 };//Class DaikonTrace
 
-//Initialize the pass
-char DaikonTrace::ID = 0;
-bool DaikonTrace::isInit = false;
-
 }//namespace llfi
 #endif
@@ -0,0 +1,477 @@
+/***************
+InvariantCheckPass.cpp
+  Compiles the Daikon invariants of the golden run into checks at the
+  program points instrumented by the DaikonTrace pass
+
+  Run the pass with the opt -daikontracepass -invariantcheckpass
+  -invariantfile=<Daikon invariants> options after loading LLFI.so
+
+  The invariants file is read like tools/ValidateInvariants.py reads it, and
+  the invariants get the same classes. Supported are
+    not-null            v != null
+    order               v sorted by <, <=, > or >=  (arrays)
+    multi-value         v one of { 1, 2, 3 }        (scalars)
+    bounds, equality    v OP c, v OP w, v OP orig(w) with OP one of
+                        >=, >, <=, <, ==, != (classes minimum-condition,
+                        maximum-condition, equality-condition,
+                        inequality-condition, initialization, return-value)
+  every other invariant is not checked. The Daikon trace hooks stay in the
+  functions with invariants that are not checked, so that their dtrace can be
+  validated with ValidateInvariants, and in all functions with
+  -invariantkeeptrace.
+  Doubles are compared at the precision of the trace (printed with %f).
+***************/
+
+#include "InvariantCheckPass.h"
+
+#include <cerrno>
+
+
+namespace llfi {
+
+char InvariantCheck::ID = 0;
+
+static cl::opt<string> invariantfile("invariantfile",
+	cl::desc("Daikon invariants to compile into checks"),
+	cl::init(""));
+
+static cl::opt<bool> invariantkeeptrace("invariantkeeptrace",
+	cl::desc("Keep the Daikon trace hooks of all program points"),
+	cl::init(false));
+
+//Half of the last digit printed for doubles in the trace
+static const double traceDoublePrecision = 5e-7;
+
+//Classes of tools/ValidateInvariants.py, the first match wins
+static const char *invariantStrings[][2] = {
+	{ "has only one value", "uniqueness" },
+	{ "!= null", "not-null" },
+	{ "sorted by", "order" },
+	{ "one of", "multi-value" },
+	{ "== orig", "initialization" },
+	{ "== [", "array-equality" },
+	{ "elements ==", "element-initialization" },
+	{ "elementwise", "elementwise" },
+	{ "elements", "elementwise" },
+	{ "orig", "initialization" },
+	{ "return", "return-value" },
+	{ ">", "minimum-condition" },
+	{ "<", "maximum-condition" },
+	{ "==", "equality-condition" },
+	{ "!=", "inequality-condition" },
+};
+
+static bool getConstantString(Value *value, string &str) {
+	GlobalVariable *global = dyn_cast<GlobalVariable>(value->stripPointerCasts());
+	if(global == NULL || !global->hasInitializer()) {
+		return false;
+	}
+	ConstantDataArray *text = dyn_cast<ConstantDataArray>(global->getInitializer());
+	if(text == NULL || !text->isCString()) {
+		return false;
+	}
+	str = text->getAsCString().str();
+	return true;
+}
+
+//"a[]" and "a[..]" stand for the array variable a
+static string getVariableName(string token) {
+	size_t bracket = token.find('[');
+	if(bracket != string::npos && bracket > 0) {
+		token = token.substr(0,bracket);
+	}
+	return token;
+}
+
+static bool isCompareOperator(const string &op) {
+	return op == ">=" || op == ">" || op == "<=" || op == "<" || op == "==" || op == "!=";
+}
+
+bool InvariantCheck::runOnModule(Module &M) {
+	doInit(M);
+	loadInvariants();
+
+	vector<CallInst*> hooks;
+	for(Module::iterator funcItr = M.begin(); funcItr != M.end(); ++funcItr) {
+		for(inst_iterator instItr = inst_begin(*funcItr); instItr != inst_end(*funcItr); ++instItr) {
+			CallInst *call = dyn_cast<CallInst>(&*instItr);
+			if(call == NULL || call->getCalledFunction() == NULL) {
+				continue;
+			}
+			StringRef callee = call->getCalledFunction()->getName();
+			if(callee == "clap_hookPptBegin" || callee == "clap_hookPptEnd") {
+				hooks.push_back(call);
+			}
+		}
+	}
+	vector<string> hookFunctions;
+	for(vector<CallInst*>::iterator hookItr = hooks.begin(); hookItr != hooks.end(); ++hookItr) {
+		hookFunctions.push_back(instrumentProgramPoint(*hookItr));
+	}
+
+	//The hooks of both program points of a function are kept, ValidateInvariants needs the ENTER values for orig()
+	for(unsigned i = 0; i < hooks.size(); ++i) {
+		if(!invariantkeeptrace && !hookFunctions[i].empty() && tracedFunctions.count(hookFunctions[i]) == 0) {
+			hooks[i]->eraseFromParent();
+		}
+	}
+
+	errs()<<"InvariantCheck: "<<numCompiled<<" invariants compiled, "<<numSkipped<<" not checked\n";
+	if(numSkipped > 0) {
+		errs()<<"WARNING: "<<numSkipped<<" invariants are not checked, the dtrace of their "<<tracedFunctions.size()
+			<<" functions is still written for ValidateInvariants\n";
+	}
+	return true;
+}
+
+void InvariantCheck::doInit(Module &M) {
+	LLVMContext &context = M.getContext();
+	module = &M;
+	int32Type = IntegerType::get(context,32);
+	int64Type = IntegerType::get(context,64);
+	ptr8Type = PointerType::get(IntegerType::get(context,8),0);
+	doubleType = Type::getDoubleTy(context);
+
+	//Layout of struct DaikonInvariant in runtime_lib/DaikonTrace.h
+	Type *invariantFields[] = { ptr8Type, ptr8Type, ptr8Type };
+	invariantType = StructType::get(context,invariantFields);
+
+	Type *violatedParams[] = { PointerType::get(invariantType,0) };
+	violatedFunction = cast<Function>(M.getOrInsertFunction("clap_invariantViolated",
+		FunctionType::get(Type::getVoidTy(context),violatedParams,false)));
+	Type *checkSortedParams[] = { ptr8Type, int64Type, int32Type, int32Type };
+	checkSortedFunction = cast<Function>(M.getOrInsertFunction("clap_checkSorted",
+		FunctionType::get(int32Type,checkSortedParams,false)));
+
+	numCompiled = 0;
+	numSkipped = 0;
+}
+
+void InvariantCheck::loadInvariants() {
+	if(invariantfile.empty()) {
+		errs()<<"ERROR: -invariantcheckpass needs the Daikon invariants in -invariantfile\n";
+		exit(1);
+	}
+	ifstream invariants(invariantfile.c_str());
+	if(!invariants.is_open()) {
+		errs()<<"ERROR: Unable to open the invariants "<<invariantfile<<"\n";
+		exit(1);
+	}
+
+	string line, functionKey;
+	bool beginFile = false;
+	while(getline(invariants,line)) {
+		if(line.compare(0,2,"==") == 0) {
+			beginFile = true;
+		} else if(line.compare(0,7,"Exiting") == 0) {
+			break;
+		} else if(beginFile && line.compare(0,2,"..") == 0) {
+			string pptName = line.substr(line.find_first_not_of('.'));
+			string functionName = pptName.substr(0,pptName.find('('));
+			functionName = functionName.substr(0,functionName.find(":::"));
+			functionKey = functionName + "." + pptName.substr(pptName.rfind(":::") + 3);
+		} else if(beginFile && !functionKey.empty()) {
+			size_t begin = line.find_first_not_of(':');
+			if(begin != string::npos && !StringRef(line).trim().empty()) {
+				functionInvariants[functionKey].push_back(line.substr(begin));
+			}
+		}
+	}
+	invariants.close();
+}
+
+string InvariantCheck::classifyInvariant(const string &predicate) {
+	for(unsigned i = 0; i < sizeof(invariantStrings)/sizeof(invariantStrings[0]); ++i) {
+		if(predicate.find(invariantStrings[i][0]) != string::npos) {
+			return invariantStrings[i][1];
+		}
+	}
+	return "other";
+}
+
+/**
+ * Name, variable names and type codes of the DaikonPpt descriptor passed to a hook
+ */
+bool InvariantCheck::readProgramPoint(Value *ppt, string &pptName, vector<string> &varNames, vector<uint32_t> &varTypes) {
+	GlobalVariable *pptVar = dyn_cast<GlobalVariable>(ppt->stripPointerCasts());
+	if(pptVar == NULL || !pptVar->hasInitializer()) {
+		return false;
+	}
+	ConstantStruct *descriptor = dyn_cast<ConstantStruct>(pptVar->getInitializer());
+	if(descriptor == NULL || descriptor->getNumOperands() < 5 || !getConstantString(descriptor->getOperand(0),pptName)) {
+		return false;
+	}
+	unsigned varCount = cast<ConstantInt>(descriptor->getOperand(2))->getZExtValue();
+	if(varCount == 0) {
+		return true;
+	}
+
+	GlobalVariable *namesVar = dyn_cast<GlobalVariable>(descriptor->getOperand(3)->stripPointerCasts());
+	GlobalVariable *typesVar = dyn_cast<GlobalVariable>(descriptor->getOperand(4)->stripPointerCasts());
+	if(namesVar == NULL || typesVar == NULL) {
+		return false;
+	}
+	ConstantArray *names = dyn_cast<ConstantArray>(namesVar->getInitializer());
+	ConstantDataArray *types = dyn_cast<ConstantDataArray>(typesVar->getInitializer());
+	if(names == NULL || types == NULL || names->getNumOperands() != varCount || types->getNumElements() != varCount) {
+		return false;
+	}
+	for(unsigned i = 0; i < varCount; ++i) {
+		string varName;
+		if(!getConstantString(names->getOperand(i),varName)) {
+			return false;
+		}
+		varNames.push_back(varName);
+		varTypes.push_back(types->getElementAsInteger(i));
+	}
+	return true;
+}
+
+/**
+ * Function of the program point, empty when it cannot be read
+ */
+string InvariantCheck::instrumentProgramPoint(CallInst *hook) {
+	string pptName;
+	vector<string> varNames;
+	vector<uint32_t> varTypes;
+	if(!readProgramPoint(hook->getArgOperand(0),pptName,varNames,varTypes)) {
+		errs()<<"WARNING: Unable to read the program point of "<<*hook<<"\n";
+		return "";
+	}
+
+	//Function key of ValidateInvariants, EXIT0 program points are checked with the EXIT invariants
+	string name = pptName.substr(pptName.find_first_not_of('.'));
+	string functionName = name.substr(0,name.find('('));
+	functionName = functionName.substr(0,functionName.find(":::"));
+	string point = name.substr(name.rfind(":::") + 3);
+	string functionKey = functionName + "." + (point == "EXIT0" ? "EXIT" : point);
+
+	map<string,vector<string> >::iterator invariants = functionInvariants.find(functionKey);
+	if(invariants != functionInvariants.end()) {
+		//The hook gets the raw values in the order of the variables, arrays followed by their extent
+		map<string,PptVariable> variables;
+		unsigned operand = 1;
+		for(unsigned i = 0; i < varNames.size() && operand < hook->getNumArgOperands(); ++i) {
+			PptVariable variable;
+			variable.typeCode = varTypes[i];
+			variable.value = hook->getArgOperand(operand++);
+			variable.extent = NULL;
+			if(varTypes[i] == DAIKON_TYPE_INT_ARRAY || varTypes[i] == DAIKON_TYPE_INT64_ARRAY ||
+				varTypes[i] == DAIKON_TYPE_DOUBLE_ARRAY) {
+				variable.extent = hook->getArgOperand(operand++);
+			}
+			variables[varNames[i]] = variable;
+		}
+
+		for(vector<string>::iterator predItr = invariants->second.begin(); predItr != invariants->second.end(); ++predItr) {
+			Value *holds = compileInvariant(*predItr,variables,hook);
+			if(holds == NULL) {
+				tracedFunctions.insert(functionName);
+				++numSkipped;
+				continue;
+			}
+			insertViolationCheck(holds,getInvariantDescriptor(functionKey,*predItr,classifyInvariant(*predItr)),hook);
+			++numCompiled;
+		}
+	}
+	return functionName;
+}
+
+/**
+ * An i1 value that is true when the invariant holds
+ */
+Value* InvariantCheck::compileInvariant(const string &predicate, map<string,PptVariable> &variables, Instruction *insertPoint) {
+	vector<string> tokens;
+	istringstream words(predicate);
+	string word;
+	while(words>>word) {
+		tokens.push_back(word);
+	}
+	if(tokens.size() < 3) {
+		return NULL;
+	}
+	map<string,PptVariable>::iterator variable = variables.find(getVariableName(tokens[0]));
+
+	//v != null
+	if(tokens.size() == 3 && tokens[1] == "!=" && tokens[2] == "null") {
+		if(variable == variables.end() || !variable->second.value->getType()->isPointerTy()) {
+			return NULL;
+		}
+		Value *pointer = variable->second.value;
+		return new ICmpInst(insertPoint,ICmpInst::ICMP_NE,pointer,ConstantPointerNull::get(cast<PointerType>(pointer->getType())));
+	}
+
+	//v sorted by OP
+	if(tokens.size() == 4 && tokens[1] == "sorted" && tokens[2] == "by") {
+		if(variable == variables.end() || variable->second.extent == NULL) {
+			return NULL;
+		}
+		int order;
+		if(tokens[3] == "<") {
+			order = 0;
+		} else if(tokens[3] == "<=") {
+			order = 1;
+		} else if(tokens[3] == ">") {
+			order = 2;
+		} else if(tokens[3] == ">=") {
+			order = 3;
+		} else {
+			return NULL;
+		}
+		Value *args[] = {
+			CastInst::CreatePointerCast(variable->second.value,ptr8Type,"",insertPoint),
+			variable->second.extent,
+			ConstantInt::get(int32Type,variable->second.typeCode),
+			ConstantInt::get(int32Type,order)
+		};
+		Value *sorted = CallInst::Create(checkSortedFunction,args,"",insertPoint);
+		return new ICmpInst(insertPoint,ICmpInst::ICMP_NE,sorted,ConstantInt::get(int32Type,0));
+	}
+
+	//v one of { a, b, c }
+	if(tokens[1] == "one" && tokens[2] == "of") {
+		size_t open = predicate.find('{'), close = predicate.rfind('}');
+		Value *value = getScalarOperand(tokens[0],variables);
+		if(value == NULL || open == string::npos || close == string::npos || close < open) {
+			return NULL;
+		}
+		vector<Value*> constants;
+		istringstream values(predicate.substr(open + 1,close - open - 1));
+		string element;
+		while(getline(values,element,',')) {
+			Value *constant = getScalarOperand(StringRef(element).trim().str(),variables);
+			if(constant == NULL || !isa<Constant>(constant)) {
+				return NULL;
+			}
+			constants.push_back(constant);
+		}
+		Value *holds = NULL;
+		for(vector<Value*>::iterator constItr = constants.begin(); constItr != constants.end(); ++constItr) {
+			Value *equal = compareScalars("==",value,*constItr,insertPoint);
+			holds = holds == NULL ? equal : BinaryOperator::CreateOr(holds,equal,"",insertPoint);
+		}
+		return holds;
+	}
+
+	//v OP c, v OP w, v OP orig(w)
+	if(tokens.size() == 3 && isCompareOperator(tokens[1])) {
+		Value *lhs = getScalarOperand(tokens[0],variables);
+		Value *rhs = getScalarOperand(tokens[2],variables);
+		if(lhs == NULL || rhs == NULL) {
+			return NULL;
+		}
+		return compareScalars(tokens[1],lhs,rhs,insertPoint);
+	}
+	return NULL;
+}
+
+/**
+ * A number, or an int/double variable. orig(w) is w, parameters are not
+ * reassigned in the values passed to the hooks
+ */
+Value* InvariantCheck::getScalarOperand(const string &token, map<string,PptVariable> &variables) {
+	string name = token;
+	if(name.compare(0,5,"orig(") == 0 && name[name.size() - 1] == ')') {
+		name = name.substr(5,name.size() - 6);
+	}
+	if(name.empty()) {
+		return NULL;
+	}
+
+	const char *text = name.c_str();
+	char *end;
+	errno = 0;
+	long long intValue = strtoll(text,&end,10);
+	if(*end == '\0' && errno == 0) {
+		return ConstantInt::get(int64Type,intValue,true);
+	}
+	double doubleValue = strtod(text,&end);
+	if(*end == '\0' && (isdigit(name[0]) || name[0] == '-' || name[0] == '.')) {
+		return ConstantFP::get(doubleType,doubleValue);
+	}
+
+	map<string,PptVariable>::iterator variable = variables.find(name);
+	if(variable == variables.end()) {
+		return NULL;
+	}
+	uint32_t typeCode = variable->second.typeCode;
+	if(typeCode == DAIKON_TYPE_INT || typeCode == DAIKON_TYPE_CHAR || typeCode == DAIKON_TYPE_DOUBLE) {
+		return variable->second.value;
+	}
+	return NULL;
+}
+
+Value* InvariantCheck::compareScalars(const string &op, Value *lhs, Value *rhs, Instruction *insertPoint) {
+	if(!lhs->getType()->isDoubleTy() && !rhs->getType()->isDoubleTy()) {
+		ICmpInst::Predicate predicate = op == "==" ? ICmpInst::ICMP_EQ : op == "!=" ? ICmpInst::ICMP_NE :
+			op == "<" ? ICmpInst::ICMP_SLT : op == "<=" ? ICmpInst::ICMP_SLE :
+			op == ">" ? ICmpInst::ICMP_SGT : ICmpInst::ICMP_SGE;
+		return new ICmpInst(insertPoint,predicate,lhs,rhs);
+	}
+
+	if(!lhs->getType()->isDoubleTy()) {
+		lhs = new SIToFPInst(lhs,doubleType,"",insertPoint);
+	}
+	if(!rhs->getType()->isDoubleTy()) {
+		rhs = new SIToFPInst(rhs,doubleType,"",insertPoint);
+	}
+	//Daikon saw the values rounded to the precision of the trace, give them the benefit of the doubt
+	Constant *precision = ConstantFP::get(doubleType,traceDoublePrecision);
+	Value *difference = BinaryOperator::CreateFSub(lhs,rhs,"",insertPoint);
+	if(op == "==" || op == "!=") {
+		Value *below = new FCmpInst(insertPoint,FCmpInst::FCMP_OLE,difference,precision);
+		Value *above = new FCmpInst(insertPoint,FCmpInst::FCMP_OGE,difference,ConstantExpr::getFNeg(precision));
+		Value *equal = BinaryOperator::CreateAnd(below,above,"",insertPoint);
+		return op == "==" ? equal : BinaryOperator::CreateNot(equal,"",insertPoint);
+	}
+	if(op == "<" || op == "<=") {
+		return new FCmpInst(insertPoint,op == "<" ? FCmpInst::FCMP_OLT : FCmpInst::FCMP_OLE,difference,precision);
+	}
+	return new FCmpInst(insertPoint,op == ">" ? FCmpInst::FCMP_OGT : FCmpInst::FCMP_OGE,difference,
+		ConstantExpr::getFNeg(precision));
+}
+
+/**
+ * Branch to a call of clap_invariantViolated when the check fails
+ */
+void InvariantCheck::insertViolationCheck(Value *holds, Constant *invariant, Instruction *insertPoint) {
+	BasicBlock *head = insertPoint->getParent();
+	BasicBlock *tail = head->splitBasicBlock(insertPoint,"invariant.check");
+	BasicBlock *violation = BasicBlock::Create(module->getContext(),"invariant.violated",head->getParent(),tail);
+	CallInst::Create(violatedFunction,invariant,"",violation);
+	BranchInst::Create(tail,violation);
+
+	head->getTerminator()->eraseFromParent();
+	BranchInst::Create(tail,violation,holds,head);
+}
+
+Constant* InvariantCheck::getInvariantDescriptor(const string &functionKey, const string &predicate, const string &invariantClass) {
+	Constant *fields[] = {
+		getValueForString(functionKey),
+		getValueForString(predicate),
+		getValueForString(invariantClass)
+	};
+	return new GlobalVariable(*module,invariantType,true,GlobalValue::InternalLinkage,
+		ConstantStruct::get(invariantType,fields),"daikon.inv");
+}
+
+Constant* InvariantCheck::getValueForString(const string &str) {
+	map<string,Constant*>::iterator itr = stringTable.find(str);
+	if(itr != stringTable.end()) {
+		return itr->second;
+	}
+	Constant *text = ConstantDataArray::getString(module->getContext(),str,true);
+	GlobalVariable *textVar = new GlobalVariable(*module,text->getType(),true,GlobalValue::InternalLinkage,
+		text,"daikon.str");
+	textVar->setUnnamedAddr(true);
+	Constant *value = ConstantExpr::getBitCast(textVar,ptr8Type);
+	stringTable[str] = value;
+	return value;
+}
+
+//Register the pass with llvm
+static RegisterPass<InvariantCheck> X("invariantcheckpass",
+    "Compile Daikon invariants into checks at the program points of the Daikon trace",
+    false, false);
+
+}//namespace llfi
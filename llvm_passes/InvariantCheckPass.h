@@ -0,0 +1,76 @@
+/***************
+InvariantCheckPass.h
+  Compiles the Daikon invariants of the golden run into checks at the
+  program points instrumented by the DaikonTrace pass
+
+  Run the pass with the opt -daikontracepass -invariantcheckpass
+  -invariantfile=<Daikon invariants> options after loading LLFI.so
+
+  The checks are inserted before every clap_hookPptBegin/clap_hookPptEnd
+  call and use the values passed to it. A failing check calls
+  clap_invariantViolated (runtime_lib/InvariantCheckLib.c), the hooks
+  themselves are removed so faulty runs do not write a dtrace.
+***************/
+
+#ifndef INVARIANTCHECK_PASS_H
+#define INVARIANTCHECK_PASS_H
+
+#include "DaikonTracePass.h"
+
+namespace llfi {
+
+class InvariantCheck : public ModulePass {
+
+  public:
+	static char ID;
+
+  private:
+	//A variable of a program point as passed to its hook
+	struct PptVariable {
+		uint32_t typeCode;
+		Value *value;
+		Value *extent;   //number of elements of arrays
+	};
+
+	//Predicates per function key ("func.ENTER" / "func.EXIT")
+	map<string,vector<string> > functionInvariants;
+
+	Module *module;
+	IntegerType *int32Type;
+	IntegerType *int64Type;
+	PointerType *ptr8Type;
+	Type *doubleType;
+	StructType *invariantType;
+	Function *violatedFunction;
+	Function *checkSortedFunction;
+	map<string,Constant*> stringTable;
+
+	unsigned numCompiled;
+	unsigned numSkipped;
+	//Functions with invariants that are not checked, which keep their trace hooks
+	set<string> tracedFunctions;
+
+  public:
+	InvariantCheck() : ModulePass(ID) {}
+	virtual bool runOnModule(Module &M);
+
+  private:
+	void doInit(Module &M);
+	void loadInvariants();
+	string classifyInvariant(const string &predicate);
+	bool readProgramPoint(Value *ppt, string &pptName, vector<string> &varNames, vector<uint32_t> &varTypes);
+	string instrumentProgramPoint(CallInst *hook);
+
+	//Checks, NULL when the invariant is not supported
+	Value* compileInvariant(const string &predicate, map<string,PptVariable> &variables, Instruction *insertPoint);
+	Value* getScalarOperand(const string &token, map<string,PptVariable> &variables);
+	Value* compareScalars(const string &op, Value *lhs, Value *rhs, Instruction *insertPoint);
+	void insertViolationCheck(Value *holds, Constant *invariant, Instruction *insertPoint);
+
+	Constant* getInvariantDescriptor(const string &functionKey, const string &predicate, const string &invariantClass);
+	Constant* getValueForString(const string &str);
+
+};//Class InvariantCheck
+
+}//namespace llfi
+#endif
@@ -23,6 +23,7 @@
 #include "llvm/Support/raw_ostream.h"
 
 #include <vector>
+#include <cstdio>
 
 #include "FaultInjectionPass.h"
 #include "Controller.h"
@@ -250,12 +251,42 @@ bool FaultInjectionPass::runOnModule(Module &M) {
   std::map<Instruction*, std::list< int >* > *fi_inst_regs_map;
   Controller *ctrl = Controller::getInstance(M);
   ctrl->getFIInstRegsMap(&fi_inst_regs_map);
+  writeTargetTable(fi_inst_regs_map);
   insertInjectionFuncCall(fi_inst_regs_map, M);
 
   finalize(M);
   return true;
 }
 
+void FaultInjectionPass::writeTargetTable(
+    std::map<Instruction*, std::list< int >* > *inst_regs_map) {
+  // one line per injection target: llfi index, opcode and the bit width of
+  // each of its fault injection registers, in reg index order. injectfault
+  // enumerates the registers and bits of stratified and exhaustive campaigns
+  // from it
+  FILE *targetFile = fopen("llfi.stat.fi.targets.txt", "w");
+  if (targetFile == NULL)
+    return;
+  DataLayout &td = getAnalysis<DataLayout>();
+  for (std::map<Instruction*, std::list< int >* >::iterator inst_reg_it =
+       inst_regs_map->begin(); inst_reg_it != inst_regs_map->end(); 
+       ++inst_reg_it) {
+    Instruction *fi_inst = inst_reg_it->first;
+    std::list<int> *fi_reg_pos_list = inst_reg_it->second;
+    fprintf(targetFile, "%ld %s", getLLFIIndexofInst(fi_inst),
+            fi_inst->getOpcodeName());
+    for (std::list<int>::iterator reg_pos_it = fi_reg_pos_list->begin(); 
+         reg_pos_it != fi_reg_pos_list->end(); ++reg_pos_it) {
+      Value *fi_reg = *reg_pos_it == DST_REG_POS ? fi_inst :
+                      fi_inst->getOperand(*reg_pos_it);
+      fprintf(targetFile, " %u",
+              (unsigned)td.getTypeSizeInBits(fi_reg->getType()));
+    }
+    fprintf(targetFile, "\n");
+  }
+  fclose(targetFile);
+}
+
 void FaultInjectionPass::checkforMainFunc(Module &M) {
   Function* mainfunc = M.getFunction("main");
   if (mainfunc == NULL) {
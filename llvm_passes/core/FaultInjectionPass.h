@@ -28,6 +28,8 @@ class FaultInjectionPass: public ModulePass {
   void checkforMainFunc(Module &M);
   void finalize(Module& M);
 
+  void writeTargetTable(
+      std::map<Instruction*, std::list< int >* > *inst_regs_map);
   void insertInjectionFuncCall(
       std::map<Instruction*, std::list< int >* > *inst_regs_map, Module &M);
   void createInjectionFuncforType(Module &M, Type *functype, 
@@ -24,6 +24,10 @@ static RegisterPass<GenLLFIIndexPass> X(
 bool GenLLFIIndexPass::runOnModule(Module &M) {
   Instruction *currinst;
 
+  //site table, the function and opcode of every llfi index, used by
+  //injectfault to stratify the outcomes of a campaign
+  FILE *siteFile = fopen("llfi.stat.sites.txt", "w");
+
   for (Module::iterator m_it = M.begin(); m_it != M.end(); ++m_it) {
     if (!m_it->isDeclaration()) {
       //m_it is a function  
@@ -31,9 +35,14 @@ bool GenLLFIIndexPass::runOnModule(Module &M) {
            ++f_it) {
         currinst = &(*f_it);
         setLLFIIndexofInst(currinst);
+        if (siteFile)
+          fprintf(siteFile, "%ld %s %s\n", getLLFIIndexofInst(currinst),
+                  m_it->getName().str().c_str(), currinst->getOpcodeName());
       }
     }
   }
+  if (siteFile)
+    fclose(siteFile);
   
   if (currinst) {
     long totalindex = getLLFIIndexofInst(currinst);
@@ -8,10 +8,14 @@ Author: Sam Coulter
   This pass injects a function call before every non-void-returning, 
   non-phi-node instruction that prints trace information about the executed
   instruction to a file specified during the pass.
+  Calls to pthread_create and pthread synchronization functions are also
+  instrumented so that every thread writes its own trace stream, tagged with
+  the thread creation order and a logical clock.
 ***************/
 
 #include <vector>
 #include <cmath>
+#include <algorithm>
 
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
@@ -37,9 +41,58 @@ cl::opt<bool> debugtrace("debugtrace",
 cl::opt<int> maxtrace( "maxtrace",
     cl::desc("Maximum number of dynamic instructions that will be traced after fault injection"),
             cl::init(1000));
+cl::opt<int> tracehashwindow("tracehashwindow",
+    cl::desc("Record a rolling hash per window of this many traced instructions "
+             "instead of the full golden trace, 0 disables (default)"),
+            cl::init(0));
+cl::list<std::string> tracefunc("tracefunc",
+    cl::desc("Only trace instructions of this function (all functions if none given)"),
+    cl::ZeroOrMore);
+cl::list<std::string> traceinst("traceinst",
+    cl::desc("Only trace instructions of this opcode name (all opcodes if none given)"),
+    cl::ZeroOrMore);
+cl::opt<int> tracesamplerate("tracesamplerate",
+    cl::desc("Trace 1 of every N dynamic instances of each traced instruction"),
+            cl::init(1));
 
 namespace llfi {
 
+// pthread calls that order the trace streams of different threads. Release
+// hooks run before the call, acquire hooks after it; arg is the index of the
+// synchronization object in the call's argument list.
+static const struct {
+  const char *name;
+  bool release;
+  unsigned arg;
+} syncCalls[] = {
+  {"pthread_mutex_lock", false, 0},
+  {"pthread_mutex_trylock", false, 0},
+  {"pthread_mutex_timedlock", false, 0},
+  {"pthread_mutex_unlock", true, 0},
+  {"pthread_spin_lock", false, 0},
+  {"pthread_spin_trylock", false, 0},
+  {"pthread_spin_unlock", true, 0},
+  {"pthread_rwlock_rdlock", false, 0},
+  {"pthread_rwlock_wrlock", false, 0},
+  {"pthread_rwlock_tryrdlock", false, 0},
+  {"pthread_rwlock_trywrlock", false, 0},
+  {"pthread_rwlock_unlock", true, 0},
+  {"pthread_cond_wait", true, 1},
+  {"pthread_cond_wait", false, 0},
+  {"pthread_cond_wait", false, 1},
+  {"pthread_cond_timedwait", true, 1},
+  {"pthread_cond_timedwait", false, 0},
+  {"pthread_cond_timedwait", false, 1},
+  {"pthread_cond_signal", true, 0},
+  {"pthread_cond_broadcast", true, 0},
+  {"pthread_barrier_wait", true, 0},
+  {"pthread_barrier_wait", false, 0},
+  {"sem_wait", false, 0},
+  {"sem_trywait", false, 0},
+  {"sem_timedwait", false, 0},
+  {"sem_post", true, 0},
+};
+
 struct InstTrace : public FunctionPass {
 
   static char ID;
@@ -65,6 +118,19 @@ struct InstTrace : public FunctionPass {
     }
 
     LLVMContext &context = M.getContext();
+    std::vector<Type*> initParams(2, Type::getInt32Ty(context));
+    FunctionType *initfunctype = FunctionType::get(
+        Type::getVoidTy(context), initParams, false);
+    Constant *inittracingfunc = M.getOrInsertFunction("initInstTracer",
+                                                      initfunctype);
+    std::vector<Value*> initArgs;
+    initArgs.push_back(ConstantInt::get(Type::getInt32Ty(context),
+                                        tracehashwindow));
+    initArgs.push_back(ConstantInt::get(Type::getInt32Ty(context),
+                                        tracesamplerate));
+    CallInst::Create(inittracingfunc, initArgs, "",
+                     mainfunc->front().getFirstNonPHI());
+
     FunctionType *postinjectfunctype = FunctionType::get(
         Type::getVoidTy(context), false); 
     Constant *postracingfunc = M.getOrInsertFunction("postTracing",
@@ -88,11 +154,85 @@ struct InstTrace : public FunctionPass {
     return llfi::getLLFIIndexofInst(targetInst);
   }
 
+  // Give every thread its own trace stream: thread creation goes through
+  // tracePthreadCreate, and pthread synchronization advances the Lamport
+  // clocks recorded in the streams
+  void instrumentThreadSync(Function &F) {
+    LLVMContext& context = F.getContext();
+    Module *M = F.getParent();
+
+    std::vector<CallInst*> calls;
+    for (inst_iterator it = inst_begin(F), ie = inst_end(F); it != ie; ++it) {
+      if (CallInst *call = dyn_cast<CallInst>(&*it))
+        calls.push_back(call);
+    }
+
+    Type *voidTy = Type::getVoidTy(context);
+    Type *i8PtrTy = PointerType::get(Type::getInt8Ty(context), 0);
+    Type *i64Ty = Type::getInt64Ty(context);
+    Constant *acquireFunc = M->getOrInsertFunction("traceSyncAcquire",
+        FunctionType::get(voidTy, i8PtrTy, false));
+    Constant *releaseFunc = M->getOrInsertFunction("traceSyncRelease",
+        FunctionType::get(voidTy, i8PtrTy, false));
+    Constant *joinFunc = M->getOrInsertFunction("traceThreadJoin",
+        FunctionType::get(voidTy, i64Ty, false));
+    Constant *exitFunc = M->getOrInsertFunction("traceThreadExit",
+        FunctionType::get(voidTy, false));
+
+    for (std::vector<CallInst*>::iterator it = calls.begin();
+         it != calls.end(); ++it) {
+      CallInst *call = *it;
+      Function *callee =
+          dyn_cast<Function>(call->getCalledValue()->stripPointerCasts());
+      if (callee == NULL)
+        continue;
+      std::string name = callee->getName().str();
+      BasicBlock::iterator next = call;
+      Instruction *afterCall = ++next;
+
+      if (name == "pthread_create") {
+        PointerType *calleeTy = cast<PointerType>(call->getCalledValue()->getType());
+        Constant *createFunc = M->getOrInsertFunction("tracePthreadCreate",
+            cast<FunctionType>(calleeTy->getElementType()));
+        call->setCalledFunction(createFunc);
+      } else if (name == "pthread_join") {
+        Value *thread = call->getArgOperand(0);
+        if (thread->getType()->isIntegerTy())
+          thread = CastInst::CreateIntegerCast(thread, i64Ty, false, "", afterCall);
+        else
+          thread = CastInst::CreatePointerCast(thread, i64Ty, "", afterCall);
+        CallInst::Create(joinFunc, thread, "", afterCall);
+      } else if (name == "pthread_exit") {
+        CallInst::Create(exitFunc, "", call);
+      } else {
+        for (unsigned i = 0; i < sizeof(syncCalls) / sizeof(syncCalls[0]); ++i) {
+          if (name != syncCalls[i].name ||
+              syncCalls[i].arg >= call->getNumArgOperands())
+            continue;
+          Value *obj = call->getArgOperand(syncCalls[i].arg);
+          if (!obj->getType()->isPointerTy())
+            continue;
+          Instruction *insertPoint = syncCalls[i].release ? call : afterCall;
+          obj = CastInst::CreatePointerCast(obj, i8PtrTy, "", insertPoint);
+          CallInst::Create(syncCalls[i].release ? releaseFunc : acquireFunc,
+                           obj, "", insertPoint);
+        }
+      }
+    }
+  }
+
   virtual bool runOnFunction(Function &F) {
     //Create handles to the functions parent module and context
     LLVMContext& context = F.getContext();
     Module *M = F.getParent();
 
+    instrumentThreadSync(F);
+
+    if (!tracefunc.empty() &&
+        std::find(tracefunc.begin(), tracefunc.end(), F.getName().str()) ==
+            tracefunc.end())
+      return true;
+
     //iterate through each basicblock of the function
     inst_iterator lastInst;
     for (inst_iterator instIterator = inst_begin(F), 
@@ -105,6 +245,11 @@ struct InstTrace : public FunctionPass {
       if (isa<LoadInst>(inst) || isa<GetElementPtrInst>(inst) || isa<AllocaInst>(inst) || isa<BitCastInst>(inst)) {
 		  continue;
 	  }
+      if (!traceinst.empty() &&
+          std::find(traceinst.begin(), traceinst.end(),
+                    std::string(inst->getOpcodeName())) == traceinst.end()) {
+        continue;
+      }
 
       if (debugtrace) {
         if (!llfi::isLLFIIndexedInst(inst)) {
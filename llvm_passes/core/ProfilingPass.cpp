@@ -38,6 +38,7 @@ bool ProfilingPass::runOnModule(Module &M) {
   Controller *ctrl = Controller::getInstance(M);
   ctrl->getFIInstRegsMap(&fi_inst_regs_map);
 
+  long sitecount_len = 0;
   for (std::map<Instruction*, std::list< int >* >::const_iterator 
        inst_reg_it = fi_inst_regs_map->begin(); 
        inst_reg_it != fi_inst_regs_map->end(); ++inst_reg_it) {
@@ -50,23 +51,42 @@ bool ProfilingPass::runOnModule(Module &M) {
     Constant* profilingfunc = getLLFILibProfilingFunc(M);
 
     // prepare for the calling argument and call the profiling function
-    std::vector<Value*> profilingarg(1);
+    std::vector<Value*> profilingarg(2);
     const IntegerType* itype = IntegerType::get(context, 32);
 
     //LLVM 3.3 Upgrading
     IntegerType* itype_non_const = const_cast<IntegerType*>(itype);
     Value* opcode = ConstantInt::get(itype_non_const, fi_inst->getOpcode());
     profilingarg[0] = opcode; 
+    // llfi index, to count the dynamic instances of every injection target
+    long llfi_index = getLLFIIndexofInst(fi_inst);
+    if (llfi_index >= sitecount_len)
+      sitecount_len = llfi_index + 1;
+    profilingarg[1] = ConstantInt::get(Type::getInt64Ty(context), llfi_index);
     ArrayRef<Value*> profilingarg_array_ref(profilingarg);
 
     CallInst::Create(profilingfunc, profilingarg_array_ref,
                      "", insertptr);
   }
 
+  addSiteCountArray(M, sitecount_len);
   addEndProfilingFuncCall(M);
   return true;
 }
 
+// The counters of doProfiling(), one per llfi index of the injection targets,
+// so the library never resizes them while the program runs
+void ProfilingPass::addSiteCountArray(Module &M, long sitecount_len) {
+  LLVMContext &context = M.getContext();
+  Type *counttype = Type::getInt64Ty(context);
+  ArrayType *arraytype = ArrayType::get(counttype, sitecount_len);
+  new GlobalVariable(M, arraytype, false, GlobalValue::ExternalLinkage,
+                     ConstantAggregateZero::get(arraytype), "llfi_sitecount");
+  new GlobalVariable(M, counttype, true, GlobalValue::ExternalLinkage,
+                     ConstantInt::get(counttype, sitecount_len),
+                     "llfi_sitecount_len");
+}
+
 
 void ProfilingPass::addEndProfilingFuncCall(Module &M) {
   Function* mainfunc = M.getFunction("main");
@@ -93,8 +113,9 @@ void ProfilingPass::addEndProfilingFuncCall(Module &M) {
 
 Constant *ProfilingPass::getLLFILibProfilingFunc(Module &M) {
 	LLVMContext& context = M.getContext();
-  std::vector<Type*> paramtypes(1);
+  std::vector<Type*> paramtypes(2);
   paramtypes[0] = Type::getInt32Ty(context);
+  paramtypes[1] = Type::getInt64Ty(context);
 
   // LLVM 3.3 Upgrading
   ArrayRef<Type*> paramtypes_array_ref(paramtypes);
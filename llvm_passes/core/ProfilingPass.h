@@ -18,6 +18,7 @@ class ProfilingPass: public ModulePass {
 
  private: 
   void addEndProfilingFuncCall(Module &M);
+  void addSiteCountArray(Module &M, long sitecount_len);
  private:
   Constant *getLLFILibProfilingFunc(Module &M);
   Constant *getLLFILibEndProfilingFunc(Module &M);
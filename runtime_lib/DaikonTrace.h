@@ -0,0 +1,99 @@
+/************
+/DaikonTrace.h
+/  Program point descriptors shared between the DaikonTrace LLVM pass and
+/  DaikonTraceLib.c
+/
+/  The pass emits one constant DaikonPpt per ENTER and EXIT program point and
+/  calls clap_hookPptBegin/clap_hookPptEnd with a pointer to it followed by
+/  the raw variable values, in the order of varNames:
+/    DAIKON_TYPE_INT, DAIKON_TYPE_CHAR   long long (sign extended)
+/    DAIKON_TYPE_DOUBLE                  double (floats are extended)
+/    DAIKON_TYPE_*_ARRAY                 pointer, then the number of
+/                                        elements as long long (-1: unknown)
+/    all other types                     pointer
+/  The EXIT program point of a function has the id of its ENTER program point
+/  plus one, the runtime pairs the two hooks of an invocation with it.
+/  The layout of DaikonPpt and the type codes are mirrored in
+/  llvm_passes/DaikonTracePass.h and have to be kept in sync.
+*************/
+
+#ifndef DAIKON_TRACE_H
+#define DAIKON_TRACE_H
+
+#include <stdint.h>
+
+#define DAIKON_TYPE_INT 0
+#define DAIKON_TYPE_CHAR 1
+#define DAIKON_TYPE_DOUBLE 2
+#define DAIKON_TYPE_INT_ARRAY 3
+#define DAIKON_TYPE_INT64_ARRAY 4
+#define DAIKON_TYPE_DOUBLE_ARRAY 5
+#define DAIKON_TYPE_STRING 6
+
+struct DaikonPpt {
+	const char *name;          // "..func:::ENTER" / "..func:::EXIT0"
+	int32_t id;                // index of the program point in the module
+	int32_t varCount;
+	const char *const *varNames;
+	const int32_t *varTypes;   // DAIKON_TYPE_* per variable
+	int32_t sampleLimit;       // recorded invocations, 0: sample_limit of the runtime
+};
+
+/*
+ * Binary dtrace (program.bdtrace, written with dtrace_format=binary).
+ * Little-endian and unaligned. A file is a sequence of streams, one per
+ * process that appended to it, each starting with the stream header
+ *   char magic[8] = DTRACE_BINARY_MAGIC, uint32 version
+ * followed by records starting with a one byte tag:
+ *   DTRACE_RECORD_PPT    uint32 ppt id, string name, uint32 varCount,
+ *                        varCount x (uint8 type code, string name)
+ *                        Declares a program point before its first use.
+ *   DTRACE_RECORD_ENTER  uint32 ppt id, uint32 thread, int64 nonce, values
+ *   DTRACE_RECORD_EXIT   same as DTRACE_RECORD_ENTER
+ *   DTRACE_RECORD_FAULT  nothing, the fault was injected here
+ * strings are uint32 length + bytes. Values follow the declared types:
+ *   INT, CHAR     int64
+ *   DOUBLE        float64
+ *   *_ARRAY       uint32 captured elements, then int32 (INT_ARRAY), int64
+ *                 (INT64_ARRAY) or float64 (DOUBLE_ARRAY) elements
+ *   STRING        string
+ * An array or string length of DTRACE_BINARY_NULL stands for NULL.
+ * tools/dtraceconvert turns a binary dtrace into Daikon's text format.
+ */
+#define DTRACE_BINARY_MAGIC "LLFIBDT\0"
+#define DTRACE_BINARY_VERSION 1
+#define DTRACE_BINARY_NULL 0xffffffffu
+
+#define DTRACE_RECORD_PPT 'D'
+#define DTRACE_RECORD_ENTER 'E'
+#define DTRACE_RECORD_EXIT 'X'
+#define DTRACE_RECORD_FAULT 'F'
+
+void clap_hookPptBegin(const struct DaikonPpt *ppt, ...);
+void clap_hookPptEnd(const struct DaikonPpt *ppt, ...);
+
+/*
+ * Invariant checks compiled by llvm_passes/InvariantCheckPass.cpp from the
+ * Daikon invariants of the golden run. Every compiled invariant has a
+ * constant DaikonInvariant and a failing check calls clap_invariantViolated
+ * with it (see InvariantCheckLib.c). The layout is mirrored in
+ * llvm_passes/InvariantCheckPass.h.
+ */
+struct DaikonInvariant {
+	const char *functionKey;     // "func.ENTER" / "func.EXIT" as in tools/ValidateInvariants.py
+	const char *predicate;       // as printed by Daikon
+	const char *invariantClass;  // class assigned by tools/ValidateInvariants.py
+};
+
+// order operators of "sorted by" invariants
+#define DAIKON_ORDER_LT 0
+#define DAIKON_ORDER_LE 1
+#define DAIKON_ORDER_GT 2
+#define DAIKON_ORDER_GE 3
+
+void clap_invariantViolated(const struct DaikonInvariant *invariant);
+// non-zero when consecutive captured elements of the array satisfy the order,
+// the elements are captured as for the trace (array_policy, see DaikonTraceLib.c)
+int clap_checkSorted(const void *data, long long extent, int32_t type, int32_t order);
+
+#endif
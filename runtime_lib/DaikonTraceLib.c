@@ -3,13 +3,50 @@
 /authors: Arijit Chattopadhyay (https://github.com/arijitvt/RTool), Abraham Chan (Integration with LLFI)
 /  This library should be linked against programs that have had the LLFI DaikonTrace LLVM
 /  pass performed on them
+/
+/  program.dtrace is opened once. Every thread formats its records into its own
+/  buffer, and full buffers (which only ever hold whole records) are handed to a
+/  background writer thread, so records stay whole and in order per thread.
+/  Buffers are flushed when a thread exits and at program exit.
+/
+/  The variables of a program point are described by a static DaikonPpt table
+/  emitted by the pass (see DaikonTrace.h), the hooks only receive its address
+/  and the raw values.
+/
+/  Arrays are passed with their number of elements when the pass could recover
+/  it. How much of an array is captured is set in llfi.config.daikon.txt:
+/    array_policy=first|stride|full   (default first)
+/    array_max=<elements>             (default 8, not used by full)
+/    array_unknown=<elements>         elements of arrays of unknown length (default 1)
+/
+/  With dtrace_format=binary in the same file, records are written to
+/  program.bdtrace in the binary format described in DaikonTrace.h instead.
+/
+/  Invocations of hot functions can be sampled per program point:
+/    sample_policy=none|first|reservoir|backoff   (default none)
+/    sample_limit=<invocations>                   (default 1000)
+/  first records the first sample_limit invocations, backoff records them and
+/  then every 2^k-th invocation once sample_limit * 2^k have been made, and
+/  reservoir keeps a uniform sample of sample_limit invocations that is
+/  written at program exit. The ENTER and EXIT records of an invocation are
+/  always kept or dropped together. A program point with its own sampleLimit
+/  (set by the pass) uses it instead of sample_limit, and the first policy
+/  when sample_policy is none.
+/
+/  With call_profile=<file>, the number of invocations of every program point
+/  is written to <file> at program exit ("<calls> <ENTER ppt name>" per line),
+/  the DaikonTrace pass can select program points with it.
 *************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <pthread.h>
 #include <math.h>
+#include <stdint.h>
+
+#include "DaikonTrace.h"
 
 #define TRUE 1
 #define FALSE 0
@@ -18,336 +55,939 @@
 #define BIGSIZE 1000
 #define SMALL 30
 
+// a thread buffer is handed to the writer once it holds this many bytes
+#define DTRACE_FLUSH_SIZE (64 * 1024)
+// producers wait while more than this many bytes are queued for the writer
+#define DTRACE_QUEUE_LIMIT (64 * 1024 * 1024)
+
+// capture policies for array variables, set with array_policy in llfi.config.daikon.txt
+#define ARRAY_POLICY_FIRST 0   // the first array_max elements
+#define ARRAY_POLICY_STRIDE 1  // array_max elements evenly spread over the array
+#define ARRAY_POLICY_FULL 2    // every element of the array
+
+// sampling of invocations per program point, set with sample_policy in llfi.config.daikon.txt
+#define SAMPLE_POLICY_NONE 0       // every invocation
+#define SAMPLE_POLICY_FIRST 1      // the first sample_limit invocations
+#define SAMPLE_POLICY_RESERVOIR 2  // a uniform sample of sample_limit invocations
+#define SAMPLE_POLICY_BACKOFF 3    // sample_limit invocations per doubling of the calls
+
+// initial size of the buffer holding the records of a reservoir sample
+#define SAMPLE_CHUNK_SIZE 512
+
 typedef int bool;
 
+static const char *configFileName = "llfi.config.daikon.txt";
+static int arrayPolicy = ARRAY_POLICY_FIRST;
+static long long arrayMax = 8;
+// elements captured when the pass could not recover the length of an array
+static long long arrayUnknown = 1;
+
+// dtrace_format=binary
+static bool binaryFormat = FALSE;
+
+static int samplePolicy = SAMPLE_POLICY_NONE;
+static long long sampleLimit = 1000;
+
+// call_profile=<file>
+static char *callProfileName = NULL;
+
 static __thread int callStackCounter  = 0 ;
 static const char *fileName = "program.dtrace";
+static const char *binaryFileName = "program.bdtrace";
 FILE *fp;
 static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
-static __thread int threadId;
+// ordinal of the thread in binary records, assigned on its first record
+static __thread int threadId = -1;
+static int threadCount = 0;
+
+// per program point state is kept for ppt ids below MAX_PPTS, program points
+// beyond it are always declared and recorded
+#define MAX_PPTS (1 << 20)
+
+// program points already declared in the binary dtrace, by ppt id
+static unsigned char pptDeclared[MAX_PPTS];
+static pthread_mutex_t declareLock = PTHREAD_MUTEX_INITIALIZER;
+
+// invocations made so far of every ENTER program point, counted when sampling
+// or writing the call profile
+static unsigned long long pptCalls[MAX_PPTS];
+// descriptor of every ENTER program point called so far, for the call profile
+static const struct DaikonPpt *pptEnter[MAX_PPTS];
+static int32_t pptCount = 0;
 
 //This contains the ower-threadid from inpect;
-static int currentLockOwerId = -1; 
+static int currentLockOwerId = -1;
 static bool isCurrentOwnerOfLock();
-//Use this api to lock unlock instead of the 
+//Use this api to lock unlock instead of the
 //pthread_mutex_lock or
 //pthread_mutex_unlock
 void std_lock();
 void std_unlock();
 
-						
-static int flagToWriteVersionIntoDtrace = 0;
+typedef struct DtraceChunk {
+	char *data;
+	size_t len;
+	size_t cap;
+	struct DtraceChunk *next;
+} DtraceChunk;
+
+// records of the current thread not yet handed to the writer
+static __thread DtraceChunk *threadBuffer = NULL;
+
+// sampling decision of an invocation in progress, pushed at ENTER and popped
+// at the matching EXIT (ppt id of the ENTER + 1)
+typedef struct SampleFrame {
+	int32_t enterId;
+	bool record;
+	long long limit;        // sample limit of the program point
+	long long slot;         // reservoir slot of the invocation
+	DtraceChunk *pending;   // reservoir sample: ENTER record waiting for the EXIT
+} SampleFrame;
+
+static __thread SampleFrame *sampleStack = NULL;
+static __thread size_t sampleDepth = 0;
+static __thread size_t sampleCapacity = 0;
+static __thread unsigned long long sampleSeed = 0;
+
+// reservoir of an ENTER program point, the records of up to size ENTER/EXIT pairs
+typedef struct Reservoir {
+	long long size;
+	DtraceChunk *samples[];
+} Reservoir;
+
+static Reservoir *reservoirs[MAX_PPTS];
+static int32_t reservoirCount = 0;
+static bool reservoirsWritten = FALSE;
+static pthread_mutex_t reservoirLock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t configOnce = PTHREAD_ONCE_INIT;
+static pthread_once_t writerOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t threadBufferKey;
+static pthread_t writerThread;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueNotEmpty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queueNotFull = PTHREAD_COND_INITIALIZER;
+static DtraceChunk *queueHead = NULL;
+static DtraceChunk *queueTail = NULL;
+static size_t queuedBytes = 0;
+static bool writerStopping = FALSE;
+static bool writerStarted = FALSE;
+
+static void freeChunk(DtraceChunk *chunk) {
+	if (chunk == NULL)
+		return;
+	free(chunk->data);
+	free(chunk);
+}
+
+static void *dtraceWriter(void *arg) {
+	(void) arg;
+	pthread_mutex_lock(&queueLock);
+	while (TRUE) {
+		while (queueHead == NULL && !writerStopping)
+			pthread_cond_wait(&queueNotEmpty, &queueLock);
+		if (queueHead == NULL)
+			break;
+		DtraceChunk *chunk = queueHead;
+		queueHead = chunk->next;
+		if (queueHead == NULL)
+			queueTail = NULL;
+		pthread_mutex_unlock(&queueLock);
+
+		if (fp != NULL)
+			fwrite(chunk->data, 1, chunk->len, fp);
+
+		pthread_mutex_lock(&queueLock);
+		queuedBytes -= chunk->len;
+		pthread_cond_broadcast(&queueNotFull);
+		free(chunk->data);
+		free(chunk);
+	}
+	pthread_mutex_unlock(&queueLock);
+	if (fp != NULL)
+		fflush(fp);
+	return NULL;
+}
+
+static void handOffBuffer(DtraceChunk *chunk) {
+	if (chunk == NULL || chunk->len == 0)
+		return;
+	pthread_mutex_lock(&queueLock);
+	while (queuedBytes > DTRACE_QUEUE_LIMIT && !writerStopping)
+		pthread_cond_wait(&queueNotFull, &queueLock);
+	chunk->next = NULL;
+	if (queueTail != NULL)
+		queueTail->next = chunk;
+	else
+		queueHead = chunk;
+	queueTail = chunk;
+	queuedBytes += chunk->len;
+	pthread_cond_signal(&queueNotEmpty);
+	pthread_mutex_unlock(&queueLock);
+}
+
+static void flushThreadBuffer(void *arg) {
+	DtraceChunk *chunk = (DtraceChunk *) arg;
+	if (chunk != NULL && chunk->len == 0) {
+		freeChunk(chunk);
+		return;
+	}
+	handOffBuffer(chunk);
+}
+
+// the reservoir samples are only complete at program exit
+static void writeReservoirs() {
+	int32_t id;
+	long long slot;
+	pthread_mutex_lock(&reservoirLock);
+	reservoirsWritten = TRUE;
+	for (id = 0; id < reservoirCount; ++id) {
+		if (reservoirs[id] == NULL)
+			continue;
+		for (slot = 0; slot < reservoirs[id]->size; ++slot) {
+			if (reservoirs[id]->samples[slot] != NULL)
+				handOffBuffer(reservoirs[id]->samples[slot]);
+		}
+		free(reservoirs[id]);
+		reservoirs[id] = NULL;
+	}
+	pthread_mutex_unlock(&reservoirLock);
+}
+
+static void writeCallProfile() {
+	int32_t id, count = __atomic_load_n(&pptCount, __ATOMIC_ACQUIRE);
+	if (callProfileName == NULL)
+		return;
+	FILE *profile = fopen(callProfileName, "w");
+	if (profile == NULL) {
+		fprintf(stderr, "ERROR: Unable to write the call profile %s\n", callProfileName);
+		return;
+	}
+	for (id = 0; id < count; ++id) {
+		const struct DaikonPpt *ppt = __atomic_load_n(&pptEnter[id], __ATOMIC_ACQUIRE);
+		if (ppt != NULL)
+			fprintf(profile, "%llu %s\n", __atomic_load_n(&pptCalls[id], __ATOMIC_RELAXED), ppt->name);
+	}
+	fclose(profile);
+}
+
+// at program exit: flush the exiting thread, drain the queue and close
+static void stopDtraceWriter() {
+	flushThreadBuffer(threadBuffer);
+	threadBuffer = NULL;
+	pthread_setspecific(threadBufferKey, NULL);
+	writeReservoirs();
+	writeCallProfile();
+
+	pthread_mutex_lock(&queueLock);
+	writerStopping = TRUE;
+	pthread_cond_broadcast(&queueNotEmpty);
+	pthread_cond_broadcast(&queueNotFull);
+	pthread_mutex_unlock(&queueLock);
+	if (writerStarted)
+		pthread_join(writerThread, NULL);
+	if (fp != NULL) {
+		fclose(fp);
+		fp = NULL;
+	}
+}
 
 void writeInfoIntoDtrace() {
-	flagToWriteVersionIntoDtrace = 1;
-	fp = fopen(fileName,"a");
-	const char *data = "input-language C/C++\ndecl-version 2.0\nvar-comparability none\n\n";
+	const char *data = "input-language C/C++\ndecl-version 2.0\nvar-comparability implicit\n\n";
 	if(fp != NULL) {
 		fputs(data,fp);
 		fputs("\n",fp);
-		fclose(fp);
 	}
 }
 
-//Must be called after acquiring a lock
-void write_thread_nonce(FILE *fp) {
-	pthread_t tt = pthread_self();
-	int id = (int) tt;
-	char buffer[SIZE];
+static void parseDaikonConfigFile() {
+	FILE *configFile = fopen(configFileName,"r");
+	if(configFile == NULL)
+		return;
+
+	char line[BIGSIZE];
+	while(fgets(line,BIGSIZE,configFile) != NULL) {
+		if(line[0] == '#' || line[0] == '\n')
+			continue;
+		char *option = strtok(line,"=");
+		char *value = strtok(NULL,"=\n");
+		if(value == NULL) {
+			fprintf(stderr,"ERROR: Missing value for option %s in %s\n",option,configFileName);
+			exit(1);
+		}
+
+		if(strcmp(option,"array_policy") == 0) {
+			if(strcmp(value,"first") == 0)
+				arrayPolicy = ARRAY_POLICY_FIRST;
+			else if(strcmp(value,"stride") == 0)
+				arrayPolicy = ARRAY_POLICY_STRIDE;
+			else if(strcmp(value,"full") == 0)
+				arrayPolicy = ARRAY_POLICY_FULL;
+			else {
+				fprintf(stderr,"ERROR: Unknown array_policy %s in %s\n",value,configFileName);
+				exit(1);
+			}
+		} else if(strcmp(option,"array_max") == 0) {
+			arrayMax = atoll(value);
+			if(arrayMax < 1) arrayMax = 1;
+		} else if(strcmp(option,"dtrace_format") == 0) {
+			if(strcmp(value,"text") == 0)
+				binaryFormat = FALSE;
+			else if(strcmp(value,"binary") == 0)
+				binaryFormat = TRUE;
+			else {
+				fprintf(stderr,"ERROR: Unknown dtrace_format %s in %s\n",value,configFileName);
+				exit(1);
+			}
+		} else if(strcmp(option,"array_unknown") == 0) {
+			arrayUnknown = atoll(value);
+			if(arrayUnknown < 0) arrayUnknown = 0;
+		} else if(strcmp(option,"sample_policy") == 0) {
+			if(strcmp(value,"none") == 0)
+				samplePolicy = SAMPLE_POLICY_NONE;
+			else if(strcmp(value,"first") == 0)
+				samplePolicy = SAMPLE_POLICY_FIRST;
+			else if(strcmp(value,"reservoir") == 0)
+				samplePolicy = SAMPLE_POLICY_RESERVOIR;
+			else if(strcmp(value,"backoff") == 0)
+				samplePolicy = SAMPLE_POLICY_BACKOFF;
+			else {
+				fprintf(stderr,"ERROR: Unknown sample_policy %s in %s\n",value,configFileName);
+				exit(1);
+			}
+		} else if(strcmp(option,"sample_limit") == 0) {
+			sampleLimit = atoll(value);
+			if(sampleLimit < 1) sampleLimit = 1;
+		} else if(strcmp(option,"call_profile") == 0) {
+			free(callProfileName);
+			callProfileName = strdup(value);
+		} else {
+			fprintf(stderr,"ERROR: Unknown option %s for LLFI Daikon tracing\n",option);
+			exit(1);
+		}
+	}
+	fclose(configFile);
+}
 
-	fputs("this_invocation_nonce",fp);
-	fputs("\n",fp);
+// A forked child has the queue but not the writer thread. Before the fork
+// the records so far are written out, so neither process writes them twice,
+// and the child starts a writer of its own. Reservoir samples taken before
+// the fork are left to the parent
+static void prepareDtraceFork() {
+	DtraceChunk *chunk = threadBuffer;
+	threadBuffer = NULL;
+	pthread_setspecific(threadBufferKey, NULL);
+	flushThreadBuffer(chunk);
+	pthread_mutex_lock(&reservoirLock);
+	pthread_mutex_lock(&queueLock);
+	while (queuedBytes > 0 && !writerStopping)
+		pthread_cond_wait(&queueNotFull, &queueLock);
+	if (fp != NULL)
+		fflush(fp);
+}
 
-	memset(buffer,'\0',SIZE);
-	sprintf(buffer,"%d",id+callStackCounter);
-	fputs(buffer,fp);
-	fputs("\n",fp);
+static void parentDtraceFork() {
+	pthread_mutex_unlock(&queueLock);
+	pthread_mutex_unlock(&reservoirLock);
 }
 
-void clap_hookFuncBegin(int varCount, ...) {
-	std_lock();
+static void childDtraceFork() {
+	int32_t id;
+	for (id = 0; id < reservoirCount; ++id)
+		reservoirs[id] = NULL;
+	queueHead = queueTail = NULL;
+	queuedBytes = 0;
+	pthread_cond_init(&queueNotEmpty, NULL);
+	pthread_cond_init(&queueNotFull, NULL);
+	pthread_mutex_unlock(&queueLock);
+	pthread_mutex_unlock(&reservoirLock);
+	if (writerStarted && !writerStopping)
+		writerStarted = pthread_create(&writerThread, NULL, dtraceWriter, NULL) == 0;
+}
 
-	if(flagToWriteVersionIntoDtrace == 0) {
+static void startDtraceWriter() {
+	pthread_once(&configOnce, parseDaikonConfigFile);
+	if(binaryFormat) {
+		uint32_t version = DTRACE_BINARY_VERSION;
+		fp = fopen(binaryFileName,"ab");
+		if(fp != NULL) {
+			fwrite(DTRACE_BINARY_MAGIC,1,8,fp);
+			fwrite(&version,sizeof(version),1,fp);
+		}
+	} else {
+		fp = fopen(fileName,"a");
 		writeInfoIntoDtrace();
 	}
-	fp = fopen(fileName,"a");
-	if(fp != NULL) {
+	pthread_key_create(&threadBufferKey, flushThreadBuffer);
+	writerStarted = pthread_create(&writerThread, NULL, dtraceWriter, NULL) == 0;
+	pthread_atfork(prepareDtraceFork, parentDtraceFork, childDtraceFork);
+	atexit(stopDtraceWriter);
+}
 
-		char buffer[BIGSIZE];
-		va_list vararg;
-		va_start(vararg,varCount);
-		char *funcName = va_arg(vararg,char*);
-		
-		fputs(funcName,fp);
-		fputs("\n",fp);
+static DtraceChunk *currentBuffer() {
+	pthread_once(&writerOnce, startDtraceWriter);
+	if (threadId < 0)
+		threadId = __atomic_fetch_add(&threadCount, 1, __ATOMIC_RELAXED);
+	if (threadBuffer == NULL) {
+		threadBuffer = (DtraceChunk *) calloc(1, sizeof(DtraceChunk));
+		if (threadBuffer == NULL)
+			return NULL;
+		pthread_setspecific(threadBufferKey, threadBuffer);
+	}
+	return threadBuffer;
+}
 
-		write_thread_nonce(fp);
-
-		int i ;
-		int j ;
-
-		for( i = 0 ; i < varCount ;++i) {
-			char *varName = va_arg(vararg,char*);
-			char *varType = va_arg(vararg,char*);
-			
-			if(strcmp(varType,"int[]") ==0 ) {
-				int *data = va_arg(vararg,int*);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-
-				fputs("[",fp);
-				for( j = 0 ; j < sizeof(data) ;++j) {
-					if (isnan(data[j])) {
-						sprintf(buffer," NaN");
-					}
-					else {
-						sprintf(buffer," %d",data[j]);
-					}
-					fputs(buffer,fp);
-				}		
-				fputs(" ]",fp);
-
-				fputs("\n",fp);
-				fputs("1\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-			}
-			else if(strcmp(varType,"int") ==0 ){
-				int data = va_arg(vararg,int);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-				sprintf(buffer,"%d",data);
-				fputs(buffer,fp);
-				fputs("\n",fp);
-				fputs("1\n",fp);
-			}
-			else if(strcmp(varType,"float") ==0 ){
-				double data = va_arg(vararg,double);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-				sprintf(buffer,"%f",data);
-				fputs(buffer,fp);
-				fputs("\n",fp);
-				fputs("1\n",fp);
-			}
-			else if(strcmp(varType,"double") ==0 ){
-				double data = va_arg(vararg,double);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-				sprintf(buffer,"%f",data);
-				fputs(buffer,fp);
-				fputs("\n",fp);
-				fputs("1\n",fp);
-			}
-			else if(strcmp(varType,"double[]") ==0 ){
-				double *data = va_arg(vararg,double*);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-			
-				fputs("[",fp);
-				for( j = 0 ; j < sizeof(data) ;++j) {
-					if (isnan(data[j])) {
-						sprintf(buffer," NaN");
-					}
-					else {
-						sprintf(buffer," %f",data[j]);
-					}
-					fputs(buffer,fp);
-				}		
-				fputs(" ]",fp);
-			
-				fputs("\n",fp);
-				fputs("1\n",fp);
-			}
-			else if(strcmp(varType,"char") ==0 ){
-				int data = va_arg(vararg,int);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-				sprintf(buffer,"%d",data);
-				fputs(buffer,fp);
-				fputs("\n",fp);
-				fputs("1\n",fp);
-			}
-			else if(strcmp(varType,"char*") ==0 ){
-				char *data = (char *) va_arg(vararg,int*);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-			
-				sprintf(buffer,"%s",data);
-				fputs(buffer,fp);
-
-				fputs("\n",fp);
-				fputs("1\n",fp);
-			}
+static void reserve(DtraceChunk *buf, size_t extra) {
+	if (buf->len + extra + 1 <= buf->cap)
+		return;
+	size_t cap = buf->cap == 0 ? 2 * DTRACE_FLUSH_SIZE : buf->cap;
+	while (buf->len + extra + 1 > cap)
+		cap *= 2;
+	char *data = (char *) realloc(buf->data, cap);
+	if (data == NULL) {
+		fprintf(stderr, "ERROR: Out of memory for the dtrace buffer\n");
+		exit(1);
+	}
+	buf->data = data;
+	buf->cap = cap;
+}
+
+static void bufPuts(DtraceChunk *buf, const char *str) {
+	size_t len = strlen(str);
+	reserve(buf, len);
+	memcpy(buf->data + buf->len, str, len);
+	buf->len += len;
+}
 
+static void bufPrintf(DtraceChunk *buf, const char *format, ...) {
+	va_list args;
+	int len;
+	reserve(buf, SIZE);
+	va_start(args, format);
+	len = vsnprintf(buf->data + buf->len, buf->cap - buf->len, format, args);
+	va_end(args);
+	if (len >= (int) (buf->cap - buf->len)) {
+		reserve(buf, len);
+		va_start(args, format);
+		vsnprintf(buf->data + buf->len, buf->cap - buf->len, format, args);
+		va_end(args);
+	}
+	buf->len += len;
+}
+
+// the record is complete, hand the buffer off once it is large enough
+static void endRecord(DtraceChunk *buf) {
+	if (buf->len < DTRACE_FLUSH_SIZE)
+		return;
+	handOffBuffer(buf);
+	threadBuffer = (DtraceChunk *) calloc(1, sizeof(DtraceChunk));
+	pthread_setspecific(threadBufferKey, threadBuffer);
+	if (threadBuffer == NULL) {
+		fprintf(stderr, "ERROR: Out of memory for the dtrace buffer\n");
+		exit(1);
+	}
+}
+
+static char *formatDigits(char *out, unsigned long long value) {
+	char digits[24];
+	int n = 0;
+	do {
+		digits[n++] = '0' + (char) (value % 10);
+		value /= 10;
+	} while(value != 0);
+	while(n > 0)
+		*out++ = digits[--n];
+	return out;
+}
+
+// " %lld" without going through printf
+static char *formatInt(char *out, long long value) {
+	*out++ = ' ';
+	if(value < 0) {
+		*out++ = '-';
+		return formatDigits(out,0ULL - (unsigned long long) value);
+	}
+	return formatDigits(out,(unsigned long long) value);
+}
+
+// " %f" (or " NaN"). The fixed point fast path is only taken when value * 1e6
+// is far enough from a rounding boundary to round like printf, everything
+// else goes through snprintf
+static char *formatDouble(char *out, double value) {
+	int i;
+	if(isnan(value)) {
+		memcpy(out," NaN",4);
+		return out + 4;
+	}
+	double scaledValue = fabs(value) * 1e6;
+	double rounding = scaledValue - floor(scaledValue);
+	if(!(scaledValue < 1e15) || (rounding > 0.4 && rounding < 0.6)) {
+		return out + snprintf(out,SIZE," %f",value);
+	}
+	long long scaled = (long long) floor(scaledValue) + (rounding >= 0.5);
+	long long frac = scaled % 1000000;
+	*out++ = ' ';
+	if(signbit(value))
+		*out++ = '-';
+	out = formatDigits(out,(unsigned long long) (scaled / 1000000));
+	*out++ = '.';
+	for(i = 5 ; i >= 0 ; --i) {
+		out[i] = '0' + (char) (frac % 10);
+		frac /= 10;
+	}
+	return out + 6;
+}
+
+static int currentNonce() {
+	pthread_t tt = pthread_self();
+	int id = (int) tt;
+	return id+callStackCounter;
+}
+
+void write_thread_nonce(DtraceChunk *buf) {
+	bufPuts(buf,"this_invocation_nonce\n");
+	bufPrintf(buf,"%d\n",currentNonce());
+}
+
+static void bufWrite(DtraceChunk *buf, const void *data, size_t len) {
+	reserve(buf, len);
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void bufU8(DtraceChunk *buf, uint8_t value) {
+	bufWrite(buf, &value, sizeof(value));
+}
+
+static void bufU32(DtraceChunk *buf, uint32_t value) {
+	bufWrite(buf, &value, sizeof(value));
+}
+
+static void bufI64(DtraceChunk *buf, int64_t value) {
+	bufWrite(buf, &value, sizeof(value));
+}
+
+static void bufF64(DtraceChunk *buf, double value) {
+	bufWrite(buf, &value, sizeof(value));
+}
+
+static void bufString(DtraceChunk *buf, const char *str) {
+	if(str == NULL) {
+		bufU32(buf, DTRACE_BINARY_NULL);
+		return;
+	}
+	size_t len = strlen(str);
+	bufU32(buf, (uint32_t) len);
+	bufWrite(buf, str, len);
+}
+
+// the declaration is queued on its own before any record of the program point
+// can be, so it always precedes them in the file
+static void declarePpt(const struct DaikonPpt *ppt) {
+	int i;
+	bool tracked = ppt->id >= 0 && ppt->id < MAX_PPTS;
+	if(tracked && __atomic_load_n(&pptDeclared[ppt->id], __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_mutex_lock(&declareLock);
+	if(!tracked || !pptDeclared[ppt->id]) {
+		DtraceChunk *decl = (DtraceChunk *) calloc(1, sizeof(DtraceChunk));
+		if(decl == NULL) {
+			fprintf(stderr, "ERROR: Out of memory for the dtrace buffer\n");
+			exit(1);
 		}
-		fputs("\n",fp);
-		fclose(fp);
-		++callStackCounter;
+		bufU8(decl, DTRACE_RECORD_PPT);
+		bufU32(decl, (uint32_t) ppt->id);
+		bufString(decl, ppt->name);
+		bufU32(decl, (uint32_t) ppt->varCount);
+		for(i = 0 ; i < ppt->varCount ; ++i) {
+			bufU8(decl, (uint8_t) ppt->varTypes[i]);
+			bufString(decl, ppt->varNames[i]);
+		}
+		handOffBuffer(decl);
+		if(tracked)
+			__atomic_store_n(&pptDeclared[ppt->id], 1, __ATOMIC_RELEASE);
 	}
-	std_unlock();
+	pthread_mutex_unlock(&declareLock);
 }
 
+// formatted in batches so a single reserve covers many elements
+#define ARRAY_BATCH 4096
+#define ARRAY_ELEMENT_SIZE 32
+
+// number of elements captured from an array with extent elements (-1: unknown)
+static long long arrayCaptureCount(long long extent) {
+	if(extent < 0)
+		return arrayUnknown;
+	if(arrayPolicy == ARRAY_POLICY_FULL || extent <= arrayMax)
+		return extent;
+	return arrayMax;
+}
 
-void clap_hookFuncEnd(int varCount, ...) {
-	std_lock();
+static long long arrayCaptureIndex(long long i, long long count, long long extent) {
+	if(arrayPolicy == ARRAY_POLICY_STRIDE && extent > count)
+		return i * extent / count;
+	return i;
+}
 
-	fp = fopen(fileName,"a");
-	if(fp != NULL) {
-		--callStackCounter;
+// the elements of an array variable, bounded by the capture policy
+static void writeArray(DtraceChunk *buf, int type, const void *data, long long extent) {
+	long long count = arrayCaptureCount(extent), i;
+	if(data == NULL) {
+		bufPuts(buf,"\nnull\n1\n");
+		return;
+	}
 
-		char buffer[BIGSIZE];
-		va_list vararg;
-		va_start(vararg,varCount);
-		char *funcName = va_arg(vararg,char*);
+	bufPuts(buf,"\n[");
+	for(i = 0 ; i < count ; ++i) {
+		if(i % ARRAY_BATCH == 0)
+			reserve(buf,ARRAY_BATCH * ARRAY_ELEMENT_SIZE);
+		long long index = arrayCaptureIndex(i,count,extent);
+
+		char *out = buf->data + buf->len;
+		switch(type) {
+			case DAIKON_TYPE_INT_ARRAY:
+				out = formatInt(out,((const int *) data)[index]);
+				break;
+			case DAIKON_TYPE_INT64_ARRAY:
+				out = formatInt(out,((const long long *) data)[index]);
+				break;
+			default:
+				out = formatDouble(out,((const double *) data)[index]);
+				break;
+		}
+		buf->len = out - buf->data;
+	}
+	bufPuts(buf," ]\n1\n");
+}
 
-		fputs(funcName,fp);
-		fputs("\n",fp);
+static void writeVariables(DtraceChunk *buf, const struct DaikonPpt *ppt, va_list *vararg) {
+	int i ;
 
-		write_thread_nonce(fp);
-
-		int i ;
-		int j ;
-
-		for( i = 0 ; i < varCount ;++i) {
-			char *varName = va_arg(vararg,char*);
-			char *varType = va_arg(vararg,char*);
-
-			if(strcmp(varType,"int[]") ==0 ) {
-				int *data = va_arg(vararg,int*);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-
-				fputs("[",fp);
-				for( j = 0 ; j < sizeof(data) ;++j) {
-					if (isnan(data[j])) {
-						sprintf(buffer," NaN");
-					}
-					else {
-						sprintf(buffer," %d",data[j]);
-					}
-					fputs(buffer,fp);
-				}		
-				fputs(" ]",fp);
-
-				fputs("\n",fp);
-				fputs("1\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-			}
-			else if(strcmp(varType,"int") ==0 ){
-				int data = va_arg(vararg,int);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-				sprintf(buffer,"%d",data);
-				fputs(buffer,fp);
-				fputs("\n",fp);
-				fputs("1\n",fp);
+	for( i = 0 ; i < ppt->varCount ;++i) {
+		bufPuts(buf,ppt->varNames[i]);
+
+		switch(ppt->varTypes[i]) {
+			case DAIKON_TYPE_INT:
+			case DAIKON_TYPE_CHAR: {
+				long long data = va_arg(*vararg,long long);
+				bufPrintf(buf,"\n%lld\n1\n",data);
+				break;
 			}
-			else if(strcmp(varType,"float") ==0 ){
-				double data = va_arg(vararg,double);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-				sprintf(buffer,"%f",data);
-				fputs(buffer,fp);
-				fputs("\n",fp);
-				fputs("1\n",fp);
+			case DAIKON_TYPE_DOUBLE: {
+				double data = va_arg(*vararg,double);
+				bufPrintf(buf,"\n%f\n1\n",data);
+				break;
 			}
-			else if(strcmp(varType,"double") ==0 ){
-				double data = va_arg(vararg,double);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-				sprintf(buffer,"%f",data);
-				fputs(buffer,fp);
-				fputs("\n",fp);
-				fputs("1\n",fp);
+			case DAIKON_TYPE_INT_ARRAY:
+			case DAIKON_TYPE_INT64_ARRAY:
+			case DAIKON_TYPE_DOUBLE_ARRAY: {
+				void *data = va_arg(*vararg,void*);
+				long long extent = va_arg(*vararg,long long);
+				writeArray(buf,ppt->varTypes[i],data,extent);
+				break;
 			}
-			else if(strcmp(varType,"double[]") ==0 ){
-				double *data = va_arg(vararg,double*);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-			
-				fputs("[",fp);
-				for( j = 0 ; j < sizeof(data) ;++j) {
-					if (isnan(data[j])) {
-						sprintf(buffer," NaN");
-					}
-					else {
-						sprintf(buffer," %f",data[j]);
-					}
-					fputs(buffer,fp);
-				}		
-				fputs(" ]",fp);
-			
-				fputs("\n",fp);
-				fputs("1\n",fp);
+			case DAIKON_TYPE_STRING: {
+				char *data = va_arg(*vararg,char*);
+				bufPuts(buf,"\n");
+				bufPuts(buf,data != NULL ? data : "(null)");
+				bufPuts(buf,"\n1\n");
+				break;
 			}
-			else if(strcmp(varType,"char") ==0 ){
-				int data = va_arg(vararg,int);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-				sprintf(buffer,"%d",data);
-				fputs(buffer,fp);
-				fputs("\n",fp);
-				fputs("1\n",fp);
+			default:
+				// unknown type codes are passed as pointers
+				va_arg(*vararg,void*);
+				bufPuts(buf,"\nnonsensical\n2\n");
+				break;
+		}
+	}
+	bufPuts(buf,"\n");
+}
+
+static void writeBinaryArray(DtraceChunk *buf, int type, const void *data, long long extent) {
+	long long count = arrayCaptureCount(extent), i;
+	size_t elementSize = type == DAIKON_TYPE_INT_ARRAY ? sizeof(int) : 8;
+	if(data == NULL) {
+		bufU32(buf,DTRACE_BINARY_NULL);
+		return;
+	}
+	bufU32(buf,(uint32_t) count);
+	if(arrayCaptureIndex(count - 1,count,extent) == count - 1) {
+		// contiguous prefix of the array
+		bufWrite(buf,data,count * elementSize);
+		return;
+	}
+	for(i = 0 ; i < count ; ++i) {
+		bufWrite(buf,(const char *) data + arrayCaptureIndex(i,count,extent) * elementSize,elementSize);
+	}
+}
+
+static void writeBinaryRecord(DtraceChunk *buf, uint8_t tag, const struct DaikonPpt *ppt, va_list *vararg) {
+	int i ;
+
+	declarePpt(ppt);
+	bufU8(buf,tag);
+	bufU32(buf,(uint32_t) ppt->id);
+	bufU32(buf,(uint32_t) threadId);
+	bufI64(buf,currentNonce());
+
+	for( i = 0 ; i < ppt->varCount ;++i) {
+		switch(ppt->varTypes[i]) {
+			case DAIKON_TYPE_INT:
+			case DAIKON_TYPE_CHAR:
+				bufI64(buf,va_arg(*vararg,long long));
+				break;
+			case DAIKON_TYPE_DOUBLE:
+				bufF64(buf,va_arg(*vararg,double));
+				break;
+			case DAIKON_TYPE_INT_ARRAY:
+			case DAIKON_TYPE_INT64_ARRAY:
+			case DAIKON_TYPE_DOUBLE_ARRAY: {
+				void *data = va_arg(*vararg,void*);
+				long long extent = va_arg(*vararg,long long);
+				writeBinaryArray(buf,ppt->varTypes[i],data,extent);
+				break;
 			}
-			else if(strcmp(varType,"char*") ==0 ){
-				char *data = (char *) va_arg(vararg,int*);
-
-				fputs(varName,fp);
-				fputs("\n",fp);
-				memset(buffer,'\0',BIGSIZE);
-			
-				sprintf(buffer,"%s",data);
-				fputs(buffer,fp);
-
-				fputs("\n",fp);
-				fputs("1\n",fp);
+			case DAIKON_TYPE_STRING:
+				bufString(buf,va_arg(*vararg,char*));
+				break;
+			default:
+				// unknown type codes are passed as pointers and have no value in the record
+				va_arg(*vararg,void*);
+				break;
+		}
+	}
+}
+
+static void writeRecord(DtraceChunk *buf, uint8_t tag, const struct DaikonPpt *ppt, va_list *vararg) {
+	if(binaryFormat) {
+		writeBinaryRecord(buf,tag,ppt,vararg);
+	} else {
+		bufPuts(buf,ppt->name);
+		bufPuts(buf,"\n");
+		write_thread_nonce(buf);
+		writeVariables(buf,ppt,vararg);
+	}
+}
+
+// xorshift64*, seeded per thread so the samples of a run are reproducible
+static unsigned long long nextRandom() {
+	if(sampleSeed == 0)
+		sampleSeed = 0x9E3779B97F4A7C15ULL * (unsigned long long) (threadId + 1);
+	sampleSeed ^= sampleSeed >> 12;
+	sampleSeed ^= sampleSeed << 25;
+	sampleSeed ^= sampleSeed >> 27;
+	return sampleSeed * 0x2545F4914F6CDD1DULL;
+}
+
+static bool isSampled(const struct DaikonPpt *ppt) {
+	return samplePolicy != SAMPLE_POLICY_NONE || ppt->sampleLimit > 0;
+}
+
+// the invocations made before this one of an ENTER program point in range
+static unsigned long long countCall(const struct DaikonPpt *ppt) {
+	unsigned long long calls = __atomic_fetch_add(&pptCalls[ppt->id], 1, __ATOMIC_RELAXED);
+	if(calls == 0) {
+		int32_t count = __atomic_load_n(&pptCount, __ATOMIC_RELAXED);
+		__atomic_store_n(&pptEnter[ppt->id], ppt, __ATOMIC_RELEASE);
+		while(count <= ppt->id && !__atomic_compare_exchange_n(&pptCount, &count, ppt->id + 1,
+			FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+	return calls;
+}
+
+// decide whether the calls-th invocation (0 based) of a program point is recorded
+static bool sampleInvocation(unsigned long long calls, long long sampleSize, long long *slot) {
+	unsigned long long limit = (unsigned long long) sampleSize, step;
+	*slot = (long long) calls;
+	if(calls < limit)
+		return TRUE;
+	switch(samplePolicy) {
+		case SAMPLE_POLICY_BACKOFF:
+			// step is the largest power of two not above calls / limit
+			for(step = 1 ; step <= calls / limit / 2 ; step <<= 1)
+				;
+			return (calls & (step - 1)) == 0;
+		case SAMPLE_POLICY_RESERVOIR:
+			*slot = (long long) (nextRandom() % (calls + 1));
+			return *slot < sampleSize;
+		default:
+			// first, also used by program points with their own limit
+			return FALSE;
+	}
+}
+
+static SampleFrame *pushSampleFrame(const struct DaikonPpt *ppt) {
+	if(sampleDepth == sampleCapacity) {
+		size_t capacity = sampleCapacity == 0 ? 64 : 2 * sampleCapacity;
+		SampleFrame *stack = (SampleFrame *) realloc(sampleStack, capacity * sizeof(SampleFrame));
+		if(stack == NULL) {
+			fprintf(stderr, "ERROR: Out of memory for the sampling stack\n");
+			exit(1);
+		}
+		sampleStack = stack;
+		sampleCapacity = capacity;
+	}
+	SampleFrame *frame = &sampleStack[sampleDepth++];
+	frame->enterId = ppt->id;
+	frame->record = TRUE;
+	frame->limit = ppt->sampleLimit > 0 ? ppt->sampleLimit : sampleLimit;
+	frame->slot = 0;
+	frame->pending = NULL;
+	if(ppt->id < 0 || ppt->id >= MAX_PPTS)
+		return frame;
+
+	frame->record = sampleInvocation(countCall(ppt), frame->limit, &frame->slot);
+	if(frame->record && samplePolicy == SAMPLE_POLICY_RESERVOIR) {
+		// grown by reserve() from a small buffer, the reservoirs hold many of them
+		frame->pending = (DtraceChunk *) calloc(1, sizeof(DtraceChunk));
+		if(frame->pending == NULL || (frame->pending->data = (char *) malloc(SAMPLE_CHUNK_SIZE)) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory for the dtrace buffer\n");
+			exit(1);
+		}
+		frame->pending->cap = SAMPLE_CHUNK_SIZE;
+	}
+	return frame;
+}
+
+// the frame of the invocation an EXIT program point ends. Frames above it
+// belong to invocations left without an EXIT (longjmp, exceptions) and are dropped
+static bool popSampleFrame(const struct DaikonPpt *ppt, SampleFrame *frame) {
+	size_t depth = sampleDepth;
+	while(depth > 0 && sampleStack[depth - 1].enterId != ppt->id - 1)
+		--depth;
+	if(depth == 0)
+		return FALSE;
+	*frame = sampleStack[depth - 1];
+	while(sampleDepth > depth)
+		freeChunk(sampleStack[--sampleDepth].pending);
+	sampleDepth = depth - 1;
+	return TRUE;
+}
+
+// replace the sample in the reservoir slot of the invocation by its ENTER/EXIT records
+static void storeReservoirSample(const SampleFrame *frame) {
+	DtraceChunk *old = frame->pending;
+	pthread_mutex_lock(&reservoirLock);
+	if(!reservoirsWritten) {
+		Reservoir *reservoir = reservoirs[frame->enterId];
+		if(reservoir == NULL) {
+			reservoir = (Reservoir *) calloc(1, sizeof(Reservoir) + frame->limit * sizeof(DtraceChunk *));
+			if(reservoir == NULL) {
+				fprintf(stderr, "ERROR: Out of memory for the reservoir samples\n");
+				exit(1);
 			}
+			reservoir->size = frame->limit;
+			reservoirs[frame->enterId] = reservoir;
+			if(frame->enterId >= reservoirCount)
+				reservoirCount = frame->enterId + 1;
 		}
-		fputs("\n",fp);
-		fclose(fp);
+		old = reservoir->samples[frame->slot];
+		reservoir->samples[frame->slot] = frame->pending;
 	}
-	std_unlock();
+	pthread_mutex_unlock(&reservoirLock);
+	freeChunk(old);
 }
 
-void hookFaultInjection() {
-	std_lock();
+void clap_hookPptBegin(const struct DaikonPpt *ppt, ...) {
+	DtraceChunk *buf = currentBuffer();
+	if(buf == NULL)
+		return;
+
+	DtraceChunk *target = buf;
+	if(isSampled(ppt)) {
+		SampleFrame *frame = pushSampleFrame(ppt);
+		if(!frame->record) {
+			++callStackCounter;
+			return;
+		}
+		if(frame->pending != NULL)
+			target = frame->pending;
+	} else if(callProfileName != NULL && ppt->id >= 0 && ppt->id < MAX_PPTS) {
+		countCall(ppt);
+	}
 
-	fp = fopen(fileName,"a");
+	va_list vararg;
+	va_start(vararg,ppt);
+	writeRecord(target,DTRACE_RECORD_ENTER,ppt,&vararg);
+	va_end(vararg);
 
-	if(fp != NULL) {
-		fputs("FaultInjection",fp);
-		fputs("\n",fp);
-		fclose(fp);
+	++callStackCounter;
+	if(target == buf)
+		endRecord(buf);
+}
+
+
+void clap_hookPptEnd(const struct DaikonPpt *ppt, ...) {
+	DtraceChunk *buf = currentBuffer();
+	if(buf == NULL)
+		return;
+
+	--callStackCounter;
+
+	DtraceChunk *target = buf;
+	SampleFrame frame;
+	if(isSampled(ppt)) {
+		if(!popSampleFrame(ppt,&frame) || !frame.record)
+			return;
+		if(frame.pending != NULL)
+			target = frame.pending;
 	}
 
-	std_unlock();
+	va_list vararg;
+	va_start(vararg,ppt);
+	writeRecord(target,DTRACE_RECORD_EXIT,ppt,&vararg);
+	va_end(vararg);
+
+	if(target == buf)
+		endRecord(buf);
+	else
+		storeReservoirSample(&frame);
+}
+
+// -1, 0 or 1 as the first element compares to the second, 2 when unordered (NaN)
+static int compareElements(const void *data, int32_t type, long long first, long long second) {
+	if(type == DAIKON_TYPE_DOUBLE_ARRAY) {
+		double a = ((const double *) data)[first], b = ((const double *) data)[second];
+		return a < b ? -1 : a > b ? 1 : a == b ? 0 : 2;
+	}
+	long long a, b;
+	if(type == DAIKON_TYPE_INT_ARRAY) {
+		a = ((const int *) data)[first];
+		b = ((const int *) data)[second];
+	} else {
+		a = ((const long long *) data)[first];
+		b = ((const long long *) data)[second];
+	}
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+int clap_checkSorted(const void *data, long long extent, int32_t type, int32_t order) {
+	long long count, i;
+	pthread_once(&configOnce, parseDaikonConfigFile);
+	if(data == NULL)
+		return TRUE;
+	count = arrayCaptureCount(extent);
+	for(i = 0 ; i + 1 < count ; ++i) {
+		int cmp = compareElements(data,type,arrayCaptureIndex(i,count,extent),arrayCaptureIndex(i + 1,count,extent));
+		if(cmp == 2 || (order == DAIKON_ORDER_LT && cmp >= 0) || (order == DAIKON_ORDER_LE && cmp > 0) ||
+			(order == DAIKON_ORDER_GT && cmp <= 0) || (order == DAIKON_ORDER_GE && cmp < 0))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+void hookFaultInjection() {
+	DtraceChunk *buf = currentBuffer();
+	if(buf != NULL) {
+		if(binaryFormat)
+			bufU8(buf,DTRACE_RECORD_FAULT);
+		else
+			bufPuts(buf,"FaultInjection\n");
+		endRecord(buf);
+	}
 }
 
 void std_lock() {
@@ -375,4 +1015,3 @@ bool isCurrentOwnerOfLock() {
 	pthread_mutex_destroy(&localLock);
 	return result;
 }
-
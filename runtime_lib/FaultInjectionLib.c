@@ -4,6 +4,9 @@
 #include <stdbool.h>
 #include <time.h>
 #include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "Utils.h"
 #define OPTION_LENGTH 512
@@ -16,6 +19,11 @@ static int fiFlag = 1;	// Should we turn on fault injections ?
 
 static int opcodecyclearray[OPCODE_CYCLE_ARRAY_LEN];
 static bool is_fault_injected_in_curr_dyn_inst = false;
+static long long fi_index_instance = 0;
+// for the crash record: the last target executed and the cycle of the first
+// injection
+static long last_llfi_index = -1;
+static long long injected_cycle = -1;
 
 static struct {
   char fi_type[OPTION_LENGTH];
@@ -23,6 +31,9 @@ static struct {
   // if both fi_cycle and fi_index are specified, use fi_cycle
   long long fi_cycle;
   long fi_index;
+  // with fi_index, only inject into this dynamic instance (counting from 0)
+  // of the instruction instead of into every one
+  long long fi_instance;
 
   // NOTE: the following config are randomly generated if not specified
   // in practice, use the following two configs only when you want to reproduce
@@ -35,7 +46,10 @@ static struct {
   //======== Add second corrupted regs QINING @MAR 27th===========
   long long fi_second_cycle;
   //==============================================================
-} config = {"bitflip", false, -1, -1, -1, -1, 1, -1}; 
+  // how the hang fault injectors hang: "park" blocks in pause(), "spin" burns
+  // the CPU like a real infinite loop
+  char hang_mode[OPTION_LENGTH];
+} config = {"bitflip", false, -1, -1, -1, -1, -1, 1, -1, "park"}; 
 // -1 to tell the value is not specified in the config file
 
 // declaration of the real implementation of the fault injection function
@@ -59,6 +73,53 @@ bool _getDecision(double probability) {
   return (rand() / (RAND_MAX * 1.0)) <= probability;
 }
 
+// Crashes are recorded in the heartbeat page and the run exits at once,
+// without a core dump or the teardown of the default action. The handler runs
+// on an alternate stack of the thread that initialized the runtime, so
+// overflows of its stack are caught too. Other threads have none, an overflow
+// of their stack is a crash without a record
+static void _crashHandler(int sig, siginfo_t *info, void *context) {
+  (void) context;
+  llfi_heartbeat->crash_signal = sig;
+  llfi_heartbeat->crash_address =
+      sig == SIGABRT ? 0 : (uint64_t)(uintptr_t)info->si_addr;
+  llfi_heartbeat->crash_index = last_llfi_index;
+  llfi_heartbeat->crash_latency =
+      injected_cycle < 0 ? -1 : curr_cycle - injected_cycle;
+  __sync_synchronize();
+  llfi_heartbeat->state = LLFI_HEARTBEAT_CRASHED;
+  _exit(128 + sig);
+}
+
+// Forked children share the heartbeat page of the run, their crashes must not
+// be taken for the crash of the run
+static const int crashSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+static void _uninstallCrashHandlers() {
+  unsigned i;
+  for (i = 0; i < sizeof(crashSignals) / sizeof(crashSignals[0]); ++i)
+    signal(crashSignals[i], SIG_DFL);
+}
+
+void _installCrashHandlers() {
+  static char crashstack[65536];
+  stack_t ss;
+  ss.ss_sp = crashstack;
+  ss.ss_size = sizeof(crashstack);
+  ss.ss_flags = 0;
+  sigaltstack(&ss, NULL);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = _crashHandler;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  sigemptyset(&sa.sa_mask);
+  unsigned i;
+  for (i = 0; i < sizeof(crashSignals) / sizeof(crashSignals[0]); ++i)
+    sigaction(crashSignals[i], &sa, NULL);
+  pthread_atfork(NULL, NULL, _uninstallCrashHandlers);
+}
+
 void _parseLLFIConfigFile() {
   char ficonfigfilename[80];
   strncpy(ficonfigfilename, "llfi.config.runtime.txt", 80);
@@ -95,6 +156,9 @@ void _parseLLFIConfigFile() {
     } else if (strcmp(option, "fi_index") == 0) {
       config.fi_index = atol(value);
       assert(config.fi_index >= 0 && "invalid fi_index in config file");
+    } else if (strcmp(option, "fi_instance") == 0) {
+      config.fi_instance = atoll(value);
+      assert(config.fi_instance >= 0 && "invalid fi_instance in config file");
     } else if (strcmp(option, "fi_reg_index") == 0) {
       config.fi_reg_index = atoi(value);
       assert(config.fi_reg_index >= 0 && "invalid fi_reg_index in config file");
@@ -111,6 +175,31 @@ void _parseLLFIConfigFile() {
     	config.fi_second_cycle = atoll(value);
     	assert(config.fi_second_cycle >= 0 && "invalid fi_second_cycle in config file");
     //==============================================================
+    } else if (strcmp(option, "hang_mode") == 0) {
+      strncpy(config.hang_mode, value, OPTION_LENGTH - 1);
+      if (strlen(config.hang_mode) > 0 &&
+          config.hang_mode[strlen(config.hang_mode) - 1] == '\n')
+        config.hang_mode[strlen(config.hang_mode) - 1] = '\0';
+      assert((strcmp(config.hang_mode, "park") == 0 ||
+              strcmp(config.hang_mode, "spin") == 0) &&
+             "invalid hang_mode in config file");
+    } else if (strcmp(option, "virtual_time") == 0) {
+      if (atoi(value) != 0)
+        enableVirtualTime();
+    } else if (strcmp(option, "memory_budget") == 0) {
+      long long memory_budget = atoll(value);
+      assert(memory_budget >= 0 && "invalid memory_budget in config file");
+      setMemoryBudget(memory_budget);
+    } else if (strcmp(option, "heartbeat_file") == 0) {
+      if (strlen(value) > 0 && value[strlen(value) - 1] == '\n')
+        value[strlen(value) - 1] = '\0';
+      if (strlen(value) > 0)
+        openHeartbeat(value);
+    } else if (strcmp(option, "trace_hash_golden") == 0) {
+      strncpy(trace_hash_golden, value, TRACE_HASH_GOLDEN_LENGTH - 1);
+      if (strlen(trace_hash_golden) > 0 &&
+          trace_hash_golden[strlen(trace_hash_golden) - 1] == '\n')
+        trace_hash_golden[strlen(trace_hash_golden) - 1] = '\0';
     } else {
       fprintf(stderr, 
               "ERROR: Unknown option %s for LLFI runtime fault injection\n",
@@ -133,6 +222,10 @@ void initInjections() {
   _initRandomSeed();
   _parseLLFIConfigFile();
   getOpcodeExecCycleArray(OPCODE_CYCLE_ARRAY_LEN, opcodecyclearray);
+  // only with a harness to read the record, otherwise crashes keep the
+  // default action (and core dumps)
+  if (llfi_heartbeat != NULL)
+    _installCrashHandlers();
 
   char injectedfaultsfilename[80];
   strncpy(injectedfaultsfilename, "llfi.stat.fi.injectedfaults.txt", 80);
@@ -151,6 +244,7 @@ bool preFunc(long llfi_index, unsigned opcode, unsigned my_reg_index,
   assert(opcodecyclearray[opcode] >= 0 && 
           "opcode does not exist, need to update instructions.def");
   
+   last_llfi_index = llfi_index;
    if (! fiFlag) return false;
    if (my_reg_index == 0)
     is_fault_injected_in_curr_dyn_inst = false;
@@ -162,9 +256,11 @@ bool preFunc(long llfi_index, unsigned opcode, unsigned my_reg_index,
         config.fi_cycle < curr_cycle + opcodecyclearray[opcode])
       inst_selected = true;
   } else {
-    // inject into every runtime instance of the specified instruction
+    // inject into every runtime instance of the specified instruction, or
+    // into the fi_instance-th one
     if (llfi_index == config.fi_index)
-      inst_selected = true;
+      inst_selected = config.fi_instance < 0 ||
+                      fi_index_instance == config.fi_instance;
   }
 
   // each register target of the instruction get equal probability of getting
@@ -182,8 +278,13 @@ bool preFunc(long llfi_index, unsigned opcode, unsigned my_reg_index,
     }
   }
 
-  if (my_reg_index == total_reg_target_num - 1)
+  if (my_reg_index == total_reg_target_num - 1) {
+    if (llfi_index == config.fi_index)
+      fi_index_instance++;
     curr_cycle += opcodecyclearray[opcode];
+    if (llfi_heartbeat != NULL)
+      llfi_heartbeat->cycles = curr_cycle;
+  }
 
   return reg_selected;
 }
@@ -193,6 +294,8 @@ void injectFunc(long llfi_index, unsigned size,
   fprintf(stderr, "MSG: injectFunc() has being called\n");
   if (! fiFlag) return;
   start_tracing_flag = TRACING_FI_RUN_FAULT_INSERTED; //Tell instTraceLib that we have injected a fault
+  if (injected_cycle < 0)
+    injected_cycle = curr_cycle;
 
   unsigned fi_bit, fi_bytepos, fi_bitpos;
   unsigned char oldbuf;
@@ -251,6 +354,19 @@ void injectFunc(long llfi_index, unsigned size,
 */
 }
 
+long long getCurrentCycle() {
+  return curr_cycle;
+}
+
+void injectHang() {
+  if (llfi_heartbeat != NULL)
+    llfi_heartbeat->state = LLFI_HEARTBEAT_HANG_INJECTED;
+  if (strcmp(config.hang_mode, "spin") == 0)
+    while (1);
+  while (1)
+    pause();
+}
+
 void turnOffInjections() {
 	fiFlag = 0;
 }
@@ -261,4 +377,6 @@ void turnOnInjections() {
 
 void postInjections() {
 	fclose(injectedfaultsFile); 
+	if (llfi_heartbeat != NULL)
+		llfi_heartbeat->state = LLFI_HEARTBEAT_EXITED;
 }
@@ -7,7 +7,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <sys/syscall.h>
 
 #include "Utils.h"
 #include "unistd.h"
@@ -17,65 +19,488 @@ static int currentLockOwerId = -1;
 void std_inst_lock();
 void std_inst_unlock();
 
-//Open a file (once) for writing. This file is not explicitly closed, must flush often!
-static FILE* ofile = NULL;
-extern  long g_flag;
-FILE* OutputFile() {
-  if (ofile == NULL) {
-    ofile = fopen("llfi.stat.trace.txt", "w");
+/* Each thread writes its own trace stream, so the hot path takes no lock and
+ * the order of records within a stream does not depend on scheduling.
+ * Thread 0 (main) keeps the historical llfi.stat.trace.txt name, thread k
+ * (k-th thread created through tracePthreadCreate) writes
+ * llfi.stat.trace.t<k>.txt. Streams are not explicitly closed while the
+ * thread runs, so they must be flushed often!
+ */
+typedef struct {
+  FILE *ofile;
+  bool closed;
+  long instCount;
+  long cutOff;
+  long epoch;           // fault injection this stream last started tracing for
+  int ordinal;          // thread creation order, -1 until known
+  unsigned long clock;  // Lamport clock, advanced at synchronization points
+
+  // rolling hash divergence detection, see initInstTracer()
+  int hashState;
+  unsigned long long hash;
+  long windowStart;     // instCount of the first record of the current window
+  FILE *hashFile;       // golden run: hashes written, faulty run: hashes read
+  char *window;         // faulty run: records of the current window
+  size_t windowLen;
+  size_t windowCap;
+  // faulty run, for the injected instance seen by this stream: the record
+  // number tracing starts at (the injected one, or the next one when sampling
+  // skipped it), its offset in the window and the record itself
+  long faultStart;
+  size_t faultOffset;
+  char *faultRec;
+  bool faultTraced;
+
+  // dynamic instances seen per llfi index, for sampled tracing
+  unsigned long *siteCounts;
+  long numSites;
+} TraceStream;
+
+#define HASH_UNDECIDED 0
+#define HASH_OFF 1
+#define HASH_COMPARING 2
+#define HASH_DIVERGED 3
+
+static __thread TraceStream stream = {.ordinal = -1, .hashState = HASH_UNDECIDED};
+static int threadCount = 0;
+static long traceEpoch = 0;
+
+// Logical clocks of synchronization objects, indexed by a hash of their
+// address. A collision only adds a spurious happens-before edge.
+#define SYNC_CLOCK_TABLE_SIZE 4096
+static unsigned long syncClocks[SYNC_CLOCK_TABLE_SIZE];
+
+// Records per hash window, 0 traces every record as before
+static int hashWindow = 0;
+// Only 1 of every sampleRate dynamic instances of each instruction is traced
+static int sampleRate = 1;
+
+// Golden window replay: only the listed records are written, to
+// llfi.stat.goldtrace[.t<k>].txt
+#define MAX_REPLAY_WINDOWS 64
+static struct {
+  int ordinal;
+  long start;
+  long count;
+} replayWindows[MAX_REPLAY_WINDOWS];
+static int replayCount = 0;
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/* Called at the entry of main.
+ * With a hash window of N, the golden run writes one FNV-1a hash per N
+ * records (llfi.stat.tracehash[.t<k>].txt) instead of the full trace. A
+ * faulty run given the golden hashes (trace_hash_golden in the runtime
+ * config) hashes its own records and starts full tracing, for maxtrace
+ * records, at the beginning of the first window whose hash differs.
+ * The golden records of that window are then replayed on demand by running
+ * the profiling executable with LLFI_TRACE_WINDOW=<thread>:<start>:<count>[,...]
+ * With a sample rate of K, only the 1st, (K+1)th, ... dynamic instance of
+ * each instruction in each thread is traced. Skipped instances are not
+ * counted, so golden and faulty record numbers stay aligned. An injected
+ * instance skipped by sampling is named by a #FaultRecord header and tracing
+ * starts at the next sampled record.
+ */
+void initInstTracer(int window, int rate) {
+  hashWindow = window > 0 ? window : 0;
+  sampleRate = rate > 1 ? rate : 1;
+
+  const char *windows = getenv("LLFI_TRACE_WINDOW");
+  while (windows != NULL && *windows != '\0' && replayCount < MAX_REPLAY_WINDOWS) {
+    int ordinal;
+    long start, count;
+    if (sscanf(windows, "%d:%ld:%ld", &ordinal, &start, &count) != 3) {
+      fprintf(stderr, "ERROR: Invalid LLFI_TRACE_WINDOW entry %s\n", windows);
+      exit(1);
+    }
+    replayWindows[replayCount].ordinal = ordinal;
+    replayWindows[replayCount].start = start;
+    replayWindows[replayCount].count = count;
+    replayCount++;
+    windows = strchr(windows, ',');
+    if (windows != NULL)
+      windows++;
   }
-  return ofile;
 }
 
-static long instCount = 0;
-static long cutOff = 0;
-void printInstTracer(long instID, char *opcode, int size, char* ptr, int maxPrints) {
-  std_lock();
+static TraceStream *currentStream() {
+  if (stream.ordinal < 0) {
+    // not created through tracePthreadCreate: either main or a thread
+    // started by uninstrumented code
+    if (syscall(SYS_gettid) == getpid())
+      stream.ordinal = 0;
+    else
+      stream.ordinal = __sync_add_and_fetch(&threadCount, 1);
+  }
+  return &stream;
+}
+
+static void streamFileName(char *name, size_t len, const char *prefix,
+                           const char *suffix, int ordinal) {
+  if (ordinal == 0)
+    snprintf(name, len, "%s%s.txt", prefix, suffix);
+  else
+    snprintf(name, len, "%s.t%d%s.txt", prefix, ordinal, suffix);
+}
+
+static FILE* OutputFile(TraceStream *ts) {
+  if (ts->ofile == NULL && !ts->closed) {
+    char name[64];
+    streamFileName(name, sizeof(name), replayCount > 0 ?
+                   "llfi.stat.goldtrace" : "llfi.stat.trace", "", ts->ordinal);
+    ts->ofile = fopen(name, "w");
+  }
+  return ts->ofile;
+}
+
+static bool isTracing(TraceStream *ts) {
+  if (start_tracing_flag == TRACING_GOLDEN_RUN)
+    return hashWindow == 0 && replayCount == 0;
+  return ts->instCount < ts->cutOff;
+}
+
+// Format one trace record, returns its length. rec must hold
+// TRACE_RECORD_LENGTH(opcode, size) bytes.
+#define TRACE_RECORD_LENGTH(opcode, size) (48 + strlen(opcode) + 2 * (size))
+static size_t formatRecord(char *rec, long instID, const char *opcode,
+                           int size, const char *ptr) {
+  static const char hex[] = "0123456789abcdef";
+  int i;
+  size_t len = sprintf(rec, "ID: %ld\tOPCode: %s\tValue: ", instID, opcode);
+  //Handle endian switch
+  if (isLittleEndian()) {
+    for (i = size - 1; i >= 0; i--) {
+      rec[len++] = hex[(ptr[i] >> 4) & 0xf];
+      rec[len++] = hex[ptr[i] & 0xf];
+    }
+  } else {
+    for (i = 0; i < size; i++) {
+      rec[len++] = hex[(ptr[i] >> 4) & 0xf];
+      rec[len++] = hex[ptr[i] & 0xf];
+    }
+  }
+  rec[len++] = '\n';
+  rec[len] = '\0';
+  return len;
+}
+
+static void decideHashState(TraceStream *ts) {
+  char name[64], path[TRACE_HASH_GOLDEN_LENGTH + 64];
+  ts->hashState = HASH_OFF;
+  ts->hash = FNV_OFFSET_BASIS;
+  ts->windowStart = 1;
+  if (hashWindow == 0 || replayCount > 0)
+    return;
+  if (start_tracing_flag == TRACING_GOLDEN_RUN) {
+    streamFileName(name, sizeof(name), "llfi.stat.tracehash", "", ts->ordinal);
+    ts->hashFile = fopen(name, "w");
+    ts->hashState = ts->hashFile != NULL ? HASH_COMPARING : HASH_OFF;
+  } else if (trace_hash_golden[0] != '\0') {
+    streamFileName(name, sizeof(name), "llfi.stat.tracehash", ".prof", ts->ordinal);
+    snprintf(path, sizeof(path), "%s/%s", trace_hash_golden, name);
+    ts->hashFile = fopen(path, "r");
+    // without golden hashes for this thread, tracing starts at the fault
+    if (ts->hashFile != NULL)
+      ts->hashState = HASH_COMPARING;
+  }
+}
+
+static void appendWindow(TraceStream *ts, const char *rec, size_t len) {
+  if (ts->windowLen + len + 1 > ts->windowCap) {
+    size_t cap = ts->windowCap == 0 ? 4096 : ts->windowCap;
+    while (ts->windowLen + len + 1 > cap)
+      cap *= 2;
+    char *window = (char *)realloc(ts->window, cap);
+    if (window == NULL)
+      return;
+    ts->window = window;
+    ts->windowCap = cap;
+  }
+  memcpy(ts->window + ts->windowLen, rec, len);
+  ts->windowLen += len;
+}
+
+static void writeFaultRecord(TraceStream *ts) {
+  fprintf(OutputFile(ts), "#FaultRecord: %ld %s",
+          ts->faultTraced ? ts->faultStart : ts->faultStart - 1, ts->faultRec);
+}
+
+// Close the current hash window. The golden run records the hash, a faulty
+// run compares it and, on the first mismatch, writes out the buffered
+// records of the window and keeps tracing up to maxPrints records.
+// The written trace starts at the injected record when the fault is in this
+// window, as traces without hashing do. A fault in an earlier window that
+// did not change its hash, or skipped by sampling, is named by a #FaultRecord
+// header instead, since tracediff can no longer take it from the first record.
+static void closeHashWindow(TraceStream *ts, int maxPrints) {
+  if (start_tracing_flag == TRACING_GOLDEN_RUN) {
+    fprintf(ts->hashFile, "%016llx\n", ts->hash);
+  } else {
+    unsigned long long golden;
+    if (fscanf(ts->hashFile, "%llx", &golden) != 1 || golden != ts->hash) {
+      long start = ts->windowStart;
+      size_t offset = 0;
+      if (ts->faultRec != NULL && ts->faultStart >= ts->windowStart) {
+        start = ts->faultStart;
+        offset = ts->faultOffset;
+      }
+      ts->hashState = HASH_DIVERGED;
+      ts->cutOff = start + maxPrints;
+      if (OutputFile(ts) != NULL) {
+        fprintf(OutputFile(ts), "#TraceStartInstNumber: %ld\n", start);
+        if (ts->faultRec != NULL && (!ts->faultTraced || ts->faultStart < start))
+          writeFaultRecord(ts);
+        fwrite(ts->window + offset, 1, ts->windowLen - offset, OutputFile(ts));
+        fflush(OutputFile(ts));
+      }
+      fclose(ts->hashFile);
+      ts->hashFile = NULL;
+      free(ts->window);
+      ts->window = NULL;
+      ts->windowLen = ts->windowCap = 0;
+      free(ts->faultRec);
+      ts->faultRec = NULL;
+      return;
+    }
+  }
+  ts->hash = FNV_OFFSET_BASIS;
+  ts->windowStart = ts->instCount + 1;
+  ts->windowLen = 0;
+}
 
+static void replayRecord(TraceStream *ts, const char *rec) {
   int i;
-  instCount++;
+  for (i = 0; i < replayCount; i++) {
+    if (replayWindows[i].ordinal != ts->ordinal ||
+        ts->instCount < replayWindows[i].start ||
+        ts->instCount >= replayWindows[i].start + replayWindows[i].count)
+      continue;
+    if (OutputFile(ts) == NULL)
+      return;
+    if (ts->instCount == replayWindows[i].start)
+      fprintf(OutputFile(ts), "#TraceStartInstNumber: %ld\n", ts->instCount);
+    fputs(rec, OutputFile(ts));
+    fflush(OutputFile(ts));
+    return;
+  }
+}
+
+static bool isSampled(TraceStream *ts, long instID) {
+  if (instID < 0)
+    return true;
+  if (instID >= ts->numSites) {
+    long numSites = ts->numSites == 0 ? 1024 : ts->numSites;
+    while (numSites <= instID)
+      numSites *= 2;
+    unsigned long *counts = (unsigned long *)realloc(ts->siteCounts,
+                                         numSites * sizeof(unsigned long));
+    if (counts == NULL)
+      return true;
+    memset(counts + ts->numSites, 0,
+           (numSites - ts->numSites) * sizeof(unsigned long));
+    ts->siteCounts = counts;
+    ts->numSites = numSites;
+  }
+  return ts->siteCounts[instID]++ % sampleRate == 0;
+}
+
+void printInstTracer(long instID, char *opcode, int size, char* ptr, int maxPrints) {
+  TraceStream *ts = currentStream();
+  char localRec[512];
+  char *rec = localRec;
+  size_t len;
+  bool sampled = sampleRate <= 1 || isSampled(ts, instID);
+
+  if (ts->hashState == HASH_UNDECIDED)
+    decideHashState(ts);
 
-  
-  if (start_tracing_flag == TRACING_FI_RUN_FAULT_INSERTED) {
-    start_tracing_flag = TRACING_FI_RUN_START_TRACING;
-    cutOff = instCount + maxPrints;
-    //Print faulty trace header (for analysis by traceDiff script)
-    fprintf(OutputFile(), "#TraceStartInstNumber: %ld\n", instCount);
+  // The first record after an injection is the injected instance, traced
+  // whether sampled or not. The first thread to see a newly injected fault
+  // opens a new tracing epoch, every thread then traces maxPrints of its own
+  // instructions from the point where it notices the epoch
+  if (start_tracing_flag == TRACING_FI_RUN_FAULT_INSERTED &&
+      __sync_bool_compare_and_swap(&start_tracing_flag,
+                                   TRACING_FI_RUN_FAULT_INSERTED,
+                                   TRACING_FI_RUN_START_TRACING)) {
+    __sync_add_and_fetch(&traceEpoch, 1);
+    if (ts->faultRec == NULL && ts->hashState != HASH_DIVERGED) {
+      ts->faultStart = ts->instCount + 1;
+      ts->faultOffset = ts->windowLen;
+      ts->faultTraced = sampled;
+      ts->faultRec = (char *)malloc(TRACE_RECORD_LENGTH(opcode, size));
+      if (ts->faultRec != NULL)
+        formatRecord(ts->faultRec, instID, opcode, size, ptr);
+    }
+  }
+  if (!sampled)
+    return;
+  ts->instCount++;
+
+  if (ts->hashState == HASH_COMPARING) {
+    if (TRACE_RECORD_LENGTH(opcode, size) > sizeof(localRec))
+      rec = (char *)malloc(TRACE_RECORD_LENGTH(opcode, size));
+    len = formatRecord(rec, instID, opcode, size, ptr);
+    for (size_t i = 0; i < len; i++)
+      ts->hash = (ts->hash ^ (unsigned char)rec[i]) * FNV_PRIME;
+    if (start_tracing_flag != TRACING_GOLDEN_RUN)
+      appendWindow(ts, rec, len);
+    if (ts->instCount - ts->windowStart + 1 == hashWindow)
+      closeHashWindow(ts, maxPrints);
+    if (rec != localRec)
+      free(rec);
+    return;
+  }
+
+  if (ts->hashState == HASH_OFF) {
+    if (start_tracing_flag != TRACING_GOLDEN_RUN && ts->epoch != traceEpoch) {
+      ts->epoch = traceEpoch;
+      ts->cutOff = ts->instCount + maxPrints;
+      //Print faulty trace header (for analysis by traceDiff script)
+      if (OutputFile(ts) != NULL) {
+        fprintf(OutputFile(ts), "#TraceStartInstNumber: %ld\n", ts->instCount);
+        if (ts->faultRec != NULL && !ts->faultTraced)
+          writeFaultRecord(ts);
+      }
+      free(ts->faultRec);
+      ts->faultRec = NULL;
+    }
   }
-  
+
+  if (replayCount > 0 && start_tracing_flag == TRACING_GOLDEN_RUN) {
+    if (TRACE_RECORD_LENGTH(opcode, size) > sizeof(localRec))
+      rec = (char *)malloc(TRACE_RECORD_LENGTH(opcode, size));
+    formatRecord(rec, instID, opcode, size, ptr);
+    replayRecord(ts, rec);
   //These flags are set by faultinjection_lib.c (Faulty Run) or left 
   // initialized in utils.c and left unchanged (Golden run)
-  if ((start_tracing_flag == TRACING_GOLDEN_RUN) || 
-      ((start_tracing_flag == TRACING_FI_RUN_START_TRACING) && 
-       (instCount < cutOff))) {
-    fprintf(OutputFile(), "ID: %ld\tOPCode: %s\tValue: ", instID, opcode);
-    
-    //Handle endian switch
-    if (isLittleEndian()) {
-      for (i = size - 1; i >= 0; i--) {
-        fprintf(OutputFile(), "%02hhx", ptr[i]);
-      }
+  } else if (isTracing(ts) && OutputFile(ts) != NULL) {
+    if (TRACE_RECORD_LENGTH(opcode, size) > sizeof(localRec))
+      rec = (char *)malloc(TRACE_RECORD_LENGTH(opcode, size));
+    formatRecord(rec, instID, opcode, size, ptr);
+    fputs(rec, OutputFile(ts));
+    fflush(OutputFile(ts)); 
+  }
+  if (rec != localRec)
+    free(rec);
+}
+
+// Flush the last, partial hash window of a stream at thread or program exit
+static void finishStream(TraceStream *ts) {
+  if (ts->hashState == HASH_COMPARING && ts->instCount >= ts->windowStart) {
+    if (start_tracing_flag == TRACING_GOLDEN_RUN) {
+      closeHashWindow(ts, 0);
     } else {
-      for (i = 0; i < size; i++) {
-        fprintf(OutputFile(), "%02hhx", ptr[i]);
-      }
+      // nothing executes after this window, trace it as far as it goes
+      closeHashWindow(ts, ts->instCount - ts->windowStart + 1);
     }
-    fprintf(OutputFile(), "\n");
+  }
+  if (ts->hashFile != NULL) {
+    fclose(ts->hashFile);
+    ts->hashFile = NULL;
+  }
+  free(ts->faultRec);
+  ts->faultRec = NULL;
+  ts->hashState = HASH_OFF;
+}
 
-    fflush(OutputFile()); 
+static unsigned syncClockSlot(const void *obj) {
+  unsigned long h = (unsigned long)obj;
+  h ^= h >> 17;
+  h *= 0x9E3779B97F4A7C15UL;
+  return (unsigned)(h >> 40) & (SYNC_CLOCK_TABLE_SIZE - 1);
+}
 
+static void recordSyncPoint(TraceStream *ts) {
+  if (isTracing(ts) && OutputFile(ts) != NULL) {
+    fprintf(OutputFile(ts), "#Sync: %lu\n", ts->clock);
+    fflush(OutputFile(ts));
   }
-  if ((start_tracing_flag != TRACING_GOLDEN_RUN) && instCount >= cutOff )
-  {
-	start_tracing_flag = TRACING_FI_RUN_END_TRACING;
+}
+
+// Called before an operation that publishes this thread's state (unlock,
+// signal, sem_post, barrier arrival, thread exit)
+void traceSyncRelease(void *obj) {
+  TraceStream *ts = currentStream();
+  unsigned long *slot = &syncClocks[syncClockSlot(obj)];
+  unsigned long old;
+  ts->clock++;
+  do {
+    old = *slot;
+  } while (old < ts->clock && !__sync_bool_compare_and_swap(slot, old, ts->clock));
+  recordSyncPoint(ts);
+}
+
+// Called after an operation that observes another thread's state (lock,
+// wait, barrier departure, join)
+void traceSyncAcquire(void *obj) {
+  TraceStream *ts = currentStream();
+  unsigned long c = __sync_fetch_and_add(&syncClocks[syncClockSlot(obj)], 0);
+  if (c > ts->clock)
+    ts->clock = c;
+  ts->clock++;
+  recordSyncPoint(ts);
+}
+
+void traceThreadExit() {
+  TraceStream *ts = currentStream();
+  traceSyncRelease((void *)pthread_self());
+  finishStream(ts);
+  free(ts->siteCounts);
+  ts->siteCounts = NULL;
+  ts->numSites = 0;
+  if (ts->ordinal != 0 && ts->ofile != NULL) {
+    fclose(ts->ofile);
+    ts->ofile = NULL;
+    ts->closed = true;
   }
+}
+
+void traceThreadJoin(unsigned long thread) {
+  traceSyncAcquire((void *)thread);
+}
+
+typedef struct {
+  void *(*start_routine)(void *);
+  void *arg;
+  int ordinal;
+  unsigned long clock;
+} TraceThreadStart;
+
+static void *traceThreadStart(void *p) {
+  TraceThreadStart start = *(TraceThreadStart *)p;
+  free(p);
+  stream.ordinal = start.ordinal;
+  stream.clock = start.clock;
+  void *ret = start.start_routine(start.arg);
+  traceThreadExit();
+  return ret;
+}
 
-  std_unlock();
+// Replaces calls to pthread_create in traced programs, the creation order
+// names the trace stream of the new thread
+int tracePthreadCreate(pthread_t *thread, const pthread_attr_t *attr,
+                       void *(*start_routine)(void *), void *arg) {
+  TraceStream *ts = currentStream();
+  TraceThreadStart *start = (TraceThreadStart *)malloc(sizeof(TraceThreadStart));
+  if (start == NULL)
+    return pthread_create(thread, attr, start_routine, arg);
+  start->start_routine = start_routine;
+  start->arg = arg;
+  start->ordinal = __sync_add_and_fetch(&threadCount, 1);
+  start->clock = ++ts->clock;
+  int ret = pthread_create(thread, attr, traceThreadStart, start);
+  if (ret != 0)
+    free(start);
+  return ret;
 }
 
 void postTracing() {
-  if (ofile != NULL)
-    fclose(ofile);
+  finishStream(&stream);
+  if (stream.ofile != NULL)
+    fclose(stream.ofile);
+  stream.ofile = NULL;
+  stream.closed = true;
 }
 
 void std_inst_lock() {
@@ -0,0 +1,62 @@
+/************
+/InvariantCheckLib.c
+/  Runtime of the InvariantCheck LLVM pass, which compiles the Daikon
+/  invariants of the golden run into checks at the ENTER/EXIT program points
+/  of the fault injection executable (see DaikonTrace.h).
+/
+/  Violations are appended to llfi.stat.invariants.txt and flushed as they
+/  happen, so runs that crash or are killed keep theirs. The file has the CSV
+/  schema of tools/ValidateInvariants.py and invariantvalidator, with the
+/  dynamic cycle of the violation as the LineNumber and an empty TraceID (the
+/  harness names the file after the run). Only the first INVARIANT_LOG_SIZE
+/  violations are written, the number of the others is written at the end of
+/  the file at a normal exit.
+*************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "DaikonTrace.h"
+#include "Utils.h"
+
+#define INVARIANT_LOG_SIZE (64 * 1024)
+
+static const char *violationFileName = "llfi.stat.invariants.txt";
+static FILE *violationFile = NULL;
+static unsigned long long violationCount = 0;
+static pthread_mutex_t violationLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void closeViolationLog() {
+	pthread_mutex_lock(&violationLock);
+	if (violationFile != NULL) {
+		if (violationCount > INVARIANT_LOG_SIZE)
+			fprintf(violationFile, "# %llu more violations not logged\n", violationCount - INVARIANT_LOG_SIZE);
+		fclose(violationFile);
+		violationFile = NULL;
+	}
+	pthread_mutex_unlock(&violationLock);
+}
+
+static void openViolationLog() {
+	violationFile = fopen(violationFileName, "w");
+	if (violationFile == NULL) {
+		fprintf(stderr, "ERROR: Unable to write the invariant violations to %s\n", violationFileName);
+		return;
+	}
+	fputs("\"LineNumber\",\"FunctionKey\",\"Invariant\",\"Class\",\"TraceID\"\n", violationFile);
+	atexit(closeViolationLog);
+}
+
+void clap_invariantViolated(const struct DaikonInvariant *invariant) {
+	long long cycle = getCurrentCycle();
+	pthread_mutex_lock(&violationLock);
+	if (violationCount++ == 0)
+		openViolationLog();
+	if (violationFile != NULL && violationCount <= INVARIANT_LOG_SIZE) {
+		fprintf(violationFile, "\"%lld\",\"%s\",\"%s\",\"%s\",\"\"\n", cycle,
+			invariant->functionKey, invariant->predicate, invariant->invariantClass);
+		fflush(violationFile);
+	}
+	pthread_mutex_unlock(&violationLock);
+}
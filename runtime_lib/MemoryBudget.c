@@ -0,0 +1,191 @@
+/************
+/MemoryBudget.c
+/  Simulated memory limit of the fault injection executable, used by the
+/  memory exhaustion fault injectors (see _SoftwareFaultInjectors.cpp) and the
+/  memory_budget option of the runtime config (see FaultInjectionLib.c).
+/
+/  llfi-rt interposes malloc, calloc, realloc, free, the aligned allocators
+/  (posix_memalign, memalign, aligned_alloc, valloc, pvalloc), mmap and munmap
+/  for the program it is linked into. Once a budget is set, allocations and
+/  anonymous mappings are charged to it and fail with ENOMEM when it does not
+/  cover them, and memory given back is credited again, so the program sees
+/  the failures of an exhausted machine without taking the memory from the
+/  host. Without a budget every call goes to the C library unchanged.
+/
+/  The budget counts the net use since it was set: memory is not tagged with
+/  whether it was charged, so what was allocated before and freed after it
+/  only pays back what is in use, the budget never grows past its size.
+*************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "Utils.h"
+
+// glibc's allocator, called directly so dlsym() is never needed for it
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static volatile int budget_enabled = 0;
+static volatile long long budget_size = 0;
+static volatile long long budget_used = 0;
+
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t) = NULL;
+static int (*real_munmap)(void *, size_t) = NULL;
+
+void setMemoryBudget(long long bytes) {
+  budget_size = bytes > 0 ? bytes : 0;
+  budget_used = 0;
+  __sync_synchronize();
+  budget_enabled = 1;
+}
+
+static int charge(long long bytes) {
+  long long used;
+  do {
+    used = budget_used;
+    if (bytes > budget_size - used) {
+      errno = ENOMEM;
+      return 0;
+    }
+  } while (!__sync_bool_compare_and_swap(&budget_used, used, used + bytes));
+  return 1;
+}
+
+// negative for the slack the allocator added to a charged allocation
+static void credit(long long bytes) {
+  long long used, left;
+  do {
+    used = budget_used;
+    left = used > bytes ? used - bytes : 0;
+  } while (!__sync_bool_compare_and_swap(&budget_used, used, left));
+}
+
+void *malloc(size_t size) {
+  if (!budget_enabled)
+    return __libc_malloc(size);
+  if (!charge(size))
+    return NULL;
+  void *ptr = __libc_malloc(size);
+  if (ptr == NULL)
+    credit(size);
+  else
+    credit((long long)size - (long long)malloc_usable_size(ptr));
+  return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  if (!budget_enabled)
+    return __libc_calloc(nmemb, size);
+  if (size != 0 && nmemb > (size_t)-1 / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (!charge(nmemb * size))
+    return NULL;
+  void *ptr = __libc_calloc(nmemb, size);
+  if (ptr == NULL)
+    credit(nmemb * size);
+  else
+    credit((long long)(nmemb * size) - (long long)malloc_usable_size(ptr));
+  return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+  if (!budget_enabled)
+    return __libc_realloc(ptr, size);
+  long long old = ptr != NULL ? (long long)malloc_usable_size(ptr) : 0;
+  if ((long long)size > old && !charge((long long)size - old))
+    return NULL;
+  void *newptr = __libc_realloc(ptr, size);
+  if (newptr == NULL && size != 0) {
+    if ((long long)size > old)
+      credit((long long)size - old);
+    return NULL;
+  }
+  long long now = newptr != NULL ? (long long)malloc_usable_size(newptr) : 0;
+  credit((long long)size > old ? (long long)size - now : old - now);
+  return newptr;
+}
+
+void *memalign(size_t alignment, size_t size) {
+  if (!budget_enabled)
+    return __libc_memalign(alignment, size);
+  if (!charge(size))
+    return NULL;
+  void *ptr = __libc_memalign(alignment, size);
+  if (ptr == NULL)
+    credit(size);
+  else
+    credit((long long)size - (long long)malloc_usable_size(ptr));
+  return ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+  if (alignment == 0 || alignment % sizeof(void *) != 0 ||
+      (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  int saved_errno = errno;
+  void *ptr = memalign(alignment, size);
+  errno = saved_errno;
+  if (ptr == NULL)
+    return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+void *valloc(size_t size) {
+  return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  if (size > (size_t)-1 - page) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return memalign(page, size == 0 ? page : (size + page - 1) & ~(page - 1));
+}
+
+void free(void *ptr) {
+  if (budget_enabled && ptr != NULL)
+    credit(malloc_usable_size(ptr));
+  __libc_free(ptr);
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd,
+           off_t offset) {
+  if (real_mmap == NULL)
+    real_mmap = dlsym(RTLD_NEXT, "mmap");
+  int charged = budget_enabled && (flags & MAP_ANONYMOUS);
+  if (charged && !charge(length))
+    return MAP_FAILED;
+  void *ptr = real_mmap(addr, length, prot, flags, fd, offset);
+  if (charged && ptr == MAP_FAILED)
+    credit(length);
+  return ptr;
+}
+
+int munmap(void *addr, size_t length) {
+  if (real_munmap == NULL)
+    real_munmap = dlsym(RTLD_NEXT, "munmap");
+  int ret = real_munmap(addr, length);
+  // mappings of files are not told apart from anonymous ones here, the budget
+  // only matters once it is exhausted and any unmapping frees memory then
+  if (ret == 0 && budget_enabled)
+    credit(length);
+  return ret;
+}
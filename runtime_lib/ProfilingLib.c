@@ -7,10 +7,36 @@
 
 static long long opcodecount[OPCODE_CYCLE_ARRAY_LEN] = {0};
 
-void doProfiling(int opcode) {
+// dynamic instances of every injection target, by llfi index. injectfault
+// plans stratified and exhaustive campaigns with them. The profiling pass
+// sizes the array for the program, weak as the fault injection executables
+// link this library without it
+extern long long llfi_sitecount[] __attribute__((weak));
+extern const long long llfi_sitecount_len __attribute__((weak));
+
+void doProfiling(int opcode, long llfi_index) {
   assert(opcodecount[opcode] >= 0 && 
          "dynamic instruction number too large to be handled by llfi");
   opcodecount[opcode]++;
+
+  if (&llfi_sitecount_len != NULL && llfi_index < llfi_sitecount_len)
+    __sync_fetch_and_add(&llfi_sitecount[llfi_index], 1);
+}
+
+static void writeSiteProfile() {
+  char sitefilename[80] = "llfi.stat.sitecount.txt";
+  FILE *siteFile = fopen(sitefilename, "w");
+  if (siteFile == NULL) {
+    fprintf(stderr, "ERROR: Unable to open site profile file %s\n",
+            sitefilename);
+    exit(1);
+  }
+  long i;
+  long len = &llfi_sitecount_len != NULL ? llfi_sitecount_len : 0;
+  for (i = 0; i < len; ++i)
+    if (llfi_sitecount[i] > 0)
+      fprintf(siteFile, "%ld %lld\n", i, llfi_sitecount[i]);
+  fclose(siteFile);
 }
 
 void endProfiling() {
@@ -43,4 +69,6 @@ void endProfiling() {
           "# cycle considered the execution cycle of each instruction type\n");
   fprintf(profileFile, "total_cycle=%lld\n", total_cycle);
 	fclose(profileFile); 
+
+  writeSiteProfile();
 }
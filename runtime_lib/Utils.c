@@ -1,9 +1,15 @@
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "Utils.h"
 
 int start_tracing_flag = TRACING_GOLDEN_RUN; //for instTraceLib: initialized to Golden Run setting
+char trace_hash_golden[TRACE_HASH_GOLDEN_LENGTH] = ""; //for instTraceLib: set by faultInjectionLib
+volatile struct LLFIHeartbeat *llfi_heartbeat = NULL;
 
 void getOpcodeExecCycleArray(const unsigned len, int *arr) {
   int i = 0;
@@ -23,3 +29,23 @@ bool isLittleEndian() {
   ptr = (char*)&data; 
   return *ptr == 0x1;
 }
+
+void openHeartbeat(const char *path) {
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    fprintf(stderr, "WARNING: Unable to open heartbeat file %s\n", path);
+    return;
+  }
+  void *page = mmap(NULL, sizeof(struct LLFIHeartbeat), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  if (page == MAP_FAILED) {
+    fprintf(stderr, "WARNING: Unable to map heartbeat file %s\n", path);
+    return;
+  }
+  llfi_heartbeat = (volatile struct LLFIHeartbeat *)page;
+  llfi_heartbeat->cycles = 0;
+  llfi_heartbeat->state = LLFI_HEARTBEAT_RUNNING;
+  memcpy((void *)llfi_heartbeat->magic, LLFI_HEARTBEAT_MAGIC,
+         sizeof(llfi_heartbeat->magic));
+}
@@ -2,6 +2,11 @@
 #define LLFI_LIB_UTILS_H
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 // TRACING =  Tracing flag
 #define TRACING_GOLDEN_RUN -1
@@ -11,6 +16,53 @@
 #define TRACING_FI_RUN_END_TRACING 3
 extern int start_tracing_flag;
 
+// directory holding the golden trace hashes (trace_hash_golden option of the
+// runtime config), empty when rolling hash divergence detection is off
+#define TRACE_HASH_GOLDEN_LENGTH 1024
+extern char trace_hash_golden[TRACE_HASH_GOLDEN_LENGTH];
+
+// Progress page shared with the fault injection harness (heartbeat_file
+// option of the runtime config). injectfault reads it to tell a hang from a
+// slow run, the layout must match HEARTBEAT_FORMAT in bin/injectfault.py
+#define LLFI_HEARTBEAT_MAGIC "LLFIHBT\0"
+#define LLFI_HEARTBEAT_RUNNING 1
+#define LLFI_HEARTBEAT_EXITED 2
+#define LLFI_HEARTBEAT_HANG_INJECTED 3  // the run hangs by design, see injectHang()
+#define LLFI_HEARTBEAT_CRASHED 4  // the crash record below is valid
+struct LLFIHeartbeat {
+  char magic[8];
+  int32_t state;
+  int32_t reserved;
+  uint64_t cycles;  // dynamic cycles executed so far (see FaultInjectionLib.c)
+  // crash record, written by the crash signal handler of FaultInjectionLib.c
+  // before the run exits with 128 + signal
+  int32_t crash_signal;
+  int32_t crash_reserved;
+  uint64_t crash_address;  // faulting address, 0 for SIGABRT
+  int64_t crash_index;  // llfi_index of the last target executed, -1 if none
+  int64_t crash_latency;  // cycles from the injection to the crash, -1 if none
+};
+extern volatile struct LLFIHeartbeat *llfi_heartbeat;
+void openHeartbeat(const char *path);
+
+// dynamic cycles executed so far by the fault injection runtime
+long long getCurrentCycle();
+
+// Hang of the hang fault injectors. Tells the harness through the heartbeat
+// that the run hangs from now on and blocks the calling thread, parked in
+// pause() or spinning, as the hang_mode option of the runtime config says
+void injectHang();
+
+// Sleeps advance a virtual clock instead of blocking and the wall clocks read
+// it, see VirtualClock.c. Set by the virtual_time option of the runtime config
+void enableVirtualTime();
+
+// From now on malloc, calloc, realloc and anonymous mmap fail with ENOMEM
+// once the allocations outstanding exceed bytes, see MemoryBudget.c. Set by
+// the memory exhaustion injectors and the memory_budget option of the runtime
+// config
+void setMemoryBudget(long long bytes);
+
 // assume the max opcode in instruction.def (LLVM) is smaller than 100
 #define OPCODE_CYCLE_ARRAY_LEN 100
 void getOpcodeExecCycleArray(const unsigned len, int *arr);
@@ -24,4 +76,8 @@ bool isLittleEndian();
 #define debug(x)
 #endif
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
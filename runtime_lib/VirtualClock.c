@@ -0,0 +1,213 @@
+/************
+/VirtualClock.c
+/  Virtual time of the fault injection executable, enabled by the virtual_time
+/  option of the runtime config (see FaultInjectionLib.c).
+/
+/  llfi-rt interposes sleep, usleep, nanosleep, clock_nanosleep, clock_gettime,
+/  gettimeofday and time for the program it is linked into. With virtual time
+/  on, a sleep returns at once and advances a process-wide offset by its
+/  duration instead (a sleep to an absolute time up to that time), and the
+/  wall clocks read the real time plus that offset, so the program observes
+/  the delays of the timing fault injectors (and its own) without waiting for
+/  them. CPU-time clocks are not affected.
+/
+/  The deadlines of pthread_cond_timedwait and sem_timedwait are read on the
+/  virtual clocks by the program, they are moved back by the offset so the
+/  waits time out when the program expects, in real time. Other timed waits
+/  (pthread_mutex_timedlock, select, poll, ...) are not interposed: their
+/  timeouts pass in real time and absolute ones expire early by the offset.
+/  Without virtual time every call goes to the C library unchanged.
+*************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "Utils.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+static int virtual_time_enabled = 0;
+static volatile long long virtual_offset_ns = 0;
+
+static unsigned int (*real_sleep)(unsigned int) = NULL;
+static int (*real_usleep)(useconds_t) = NULL;
+static int (*real_nanosleep)(const struct timespec *, struct timespec *) = NULL;
+static int (*real_clock_nanosleep)(clockid_t, int, const struct timespec *,
+                                   struct timespec *) = NULL;
+static int (*real_pthread_cond_timedwait)(pthread_cond_t *, pthread_mutex_t *,
+                                          const struct timespec *) = NULL;
+static int (*real_sem_timedwait)(sem_t *, const struct timespec *) = NULL;
+static int (*real_clock_gettime)(clockid_t, struct timespec *) = NULL;
+static int (*real_gettimeofday)(struct timeval *, void *) = NULL;
+
+static void *realFunction(const char *name) {
+  void *func = dlsym(RTLD_NEXT, name);
+  if (func == NULL) {
+    fprintf(stderr, "ERROR: Unable to find %s for the virtual clock\n", name);
+    abort();
+  }
+  return func;
+}
+
+void enableVirtualTime() {
+  virtual_time_enabled = 1;
+}
+
+static void advanceVirtualTime(long long ns) {
+  __sync_fetch_and_add(&virtual_offset_ns, ns);
+}
+
+static int isWallClock(clockid_t clk) {
+  return clk == CLOCK_REALTIME || clk == CLOCK_MONOTONIC ||
+#ifdef CLOCK_MONOTONIC_RAW
+         clk == CLOCK_MONOTONIC_RAW ||
+#endif
+#ifdef CLOCK_REALTIME_COARSE
+         clk == CLOCK_REALTIME_COARSE || clk == CLOCK_MONOTONIC_COARSE ||
+#endif
+#ifdef CLOCK_BOOTTIME
+         clk == CLOCK_BOOTTIME ||
+#endif
+         0;
+}
+
+static int isValidTime(const struct timespec *ts) {
+  return ts != NULL && ts->tv_sec >= 0 && ts->tv_nsec >= 0 &&
+         ts->tv_nsec < NSEC_PER_SEC;
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+  if (!virtual_time_enabled) {
+    if (real_nanosleep == NULL)
+      real_nanosleep = realFunction("nanosleep");
+    return real_nanosleep(req, rem);
+  }
+  if (!isValidTime(req)) {
+    errno = EINVAL;
+    return -1;
+  }
+  advanceVirtualTime(req->tv_sec * NSEC_PER_SEC + req->tv_nsec);
+  if (rem != NULL) {
+    rem->tv_sec = 0;
+    rem->tv_nsec = 0;
+  }
+  return 0;
+}
+
+unsigned int sleep(unsigned int seconds) {
+  if (!virtual_time_enabled) {
+    if (real_sleep == NULL)
+      real_sleep = realFunction("sleep");
+    return real_sleep(seconds);
+  }
+  // never interrupted, nothing of it remains
+  advanceVirtualTime(seconds * NSEC_PER_SEC);
+  return 0;
+}
+
+int usleep(useconds_t usec) {
+  if (!virtual_time_enabled) {
+    if (real_usleep == NULL)
+      real_usleep = realFunction("usleep");
+    return real_usleep(usec);
+  }
+  advanceVirtualTime(usec * 1000LL);
+  return 0;
+}
+
+int clock_nanosleep(clockid_t clk, int flags, const struct timespec *req,
+                    struct timespec *rem) {
+  if (!virtual_time_enabled || !isWallClock(clk)) {
+    if (real_clock_nanosleep == NULL)
+      real_clock_nanosleep = realFunction("clock_nanosleep");
+    return real_clock_nanosleep(clk, flags, req, rem);
+  }
+  // errors are returned, not set in errno
+  if (!isValidTime(req))
+    return EINVAL;
+  long long ns = req->tv_sec * NSEC_PER_SEC + req->tv_nsec;
+  if (flags & TIMER_ABSTIME) {
+    struct timespec now;
+    clock_gettime(clk, &now);
+    ns -= now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+  }
+  if (ns > 0)
+    advanceVirtualTime(ns);
+  if (rem != NULL && !(flags & TIMER_ABSTIME)) {
+    rem->tv_sec = 0;
+    rem->tv_nsec = 0;
+  }
+  return 0;
+}
+
+// an absolute deadline on a virtual wall clock, on the real one
+static const struct timespec *realDeadline(const struct timespec *abstime,
+                                           struct timespec *real) {
+  if (!virtual_time_enabled || !isValidTime(abstime) ||
+      abstime->tv_sec >= LLONG_MAX / NSEC_PER_SEC - 1)
+    return abstime;
+  long long ns = abstime->tv_sec * NSEC_PER_SEC + abstime->tv_nsec -
+                 virtual_offset_ns;
+  if (ns < 0)
+    ns = 0;
+  real->tv_sec = ns / NSEC_PER_SEC;
+  real->tv_nsec = ns % NSEC_PER_SEC;
+  return real;
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           const struct timespec *abstime) {
+  if (real_pthread_cond_timedwait == NULL)
+    real_pthread_cond_timedwait = realFunction("pthread_cond_timedwait");
+  struct timespec real;
+  return real_pthread_cond_timedwait(cond, mutex,
+                                     realDeadline(abstime, &real));
+}
+
+int sem_timedwait(sem_t *sem, const struct timespec *abstime) {
+  if (real_sem_timedwait == NULL)
+    real_sem_timedwait = realFunction("sem_timedwait");
+  struct timespec real;
+  return real_sem_timedwait(sem, realDeadline(abstime, &real));
+}
+
+int clock_gettime(clockid_t clk, struct timespec *tp) {
+  if (real_clock_gettime == NULL)
+    real_clock_gettime = realFunction("clock_gettime");
+  int ret = real_clock_gettime(clk, tp);
+  if (ret != 0 || !virtual_time_enabled || !isWallClock(clk))
+    return ret;
+  long long ns = tp->tv_nsec + virtual_offset_ns;
+  tp->tv_sec += ns / NSEC_PER_SEC;
+  tp->tv_nsec = ns % NSEC_PER_SEC;
+  return 0;
+}
+
+int gettimeofday(struct timeval *tv, void *tz) {
+  if (real_gettimeofday == NULL)
+    real_gettimeofday = realFunction("gettimeofday");
+  int ret = real_gettimeofday(tv, tz);
+  if (ret != 0 || !virtual_time_enabled)
+    return ret;
+  long long us = tv->tv_usec + virtual_offset_ns / 1000;
+  tv->tv_sec += us / 1000000;
+  tv->tv_usec = us % 1000000;
+  return 0;
+}
+
+time_t time(time_t *tloc) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  if (tloc != NULL)
+    *tloc = ts.tv_sec;
+  return ts.tv_sec;
+}
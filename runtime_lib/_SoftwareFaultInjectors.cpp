@@ -8,8 +8,10 @@
 #include <pthread.h>
 #include <unistd.h>
 
-//2^20 == 32MB
-#define MEM_EXHAUSTION_UNIT 33554432
+#include "Utils.h"
+
+//the smallest chunk a program still gets under LowMemory(Res), 2^13 == 8KB
+#define LOW_MEMORY_LEFT 8192
 
 class BitCorruptionInjector: public SoftwareFaultInjector {
 	public:
@@ -59,7 +61,7 @@ static RegisterFaultInjector BA("MemoryLeak(Res)", new MemoryLeakInjector());
 class HangInjector: public SoftwareFaultInjector {
 	public:
 	virtual void injectFault(long llfi_index, unsigned size, unsigned fi_bit,char *buf){
-		while(1);
+		injectHang();
 		return;
 	}
 };
@@ -146,21 +148,15 @@ static RegisterFaultInjector GA("StalePointer(Res)", new StalePointerInjector())
 class MemoryExhaustionInjector: public SoftwareFaultInjector {
 	public:
 	virtual void injectFault(long llfi_index, unsigned size, unsigned fi_bit,char *buf){
-		void* p = NULL;
-		void* left_space = NULL;
-		do{
-			p = malloc(MEM_EXHAUSTION_UNIT);
-			if(p == NULL)	p = malloc(MEM_EXHAUSTION_UNIT>>4);
-			if(p == NULL)	p = malloc(MEM_EXHAUSTION_UNIT>>8);
-			if(p == NULL)	p = malloc(MEM_EXHAUSTION_UNIT>>12);
-			if(p != NULL)	left_space = p;
-		}while(p != NULL);
+		//exhaust the simulated memory budget of MemoryBudget.c instead of the
+		//host's, the allocation under injection gets the last chunk left or none
+		void** newbuf = (void**) buf;
 		if(non_left_space){
-			void** newbuf = (void**) buf;
-			*newbuf = p;
+			setMemoryBudget(0);
+			*newbuf = NULL;
 		}else{
-			void** newbuf = (void**) buf;
-			*newbuf = left_space;
+			setMemoryBudget(LOW_MEMORY_LEFT);
+			*newbuf = malloc(LOW_MEMORY_LEFT);
 		}
 		return;
 	}
@@ -215,7 +211,7 @@ class PthreadThreadKillerInjector: public SoftwareFaultInjector {
 	public:
 	virtual void injectFault(long llfi_index, unsigned size, unsigned fi_bit,char *buf){
 		pthread_t t = pthread_t(*buf);
-		sleep(0.02);
+		usleep(20000);
 		pthread_cancel(t);
 		return;
 	}
@@ -14,7 +14,7 @@ List of options:
 --all_software_faults: Test all the test cases of SoftwareFaults.
 --all_hardware_faults: Test all the test cases of HardwareFaults.
 --all_batchmode: Test all the test cases of BatchMode fault injections.
---all_trace_tools_tests: Test all the tests for trace analysis tools.
+--all_trace_tools_tests: Test all the tests for trace analysis tools, including the Daikon invariant tools.
 --all_makefile_generation: Test all the tests for makefile generation script.
 --test_cases [test case names]: Test only specified test case.
 --clean_after_test: Clean all the generate files after testing.
@@ -208,6 +208,10 @@ def startTestRoutine():
 			pass
 		verbosePrint('Calling: test_trace_tools.test_trace_tools(' + ' '.join(prog_list) + ')')
 		test_trace_tools_returncode, trace_result_list = test_trace_tools.test_trace_tools(*prog_list)
+		import test_invariant_tools
+		verbosePrint('Calling: test_invariant_tools.test_invariant_tools(' + ' '.join(prog_list) + ')')
+		test_invariant_tools_returncode, invariant_result_list = test_invariant_tools.test_invariant_tools(*prog_list)
+		trace_result_list.extend(invariant_result_list)
 
 	## run MakefileGeneration tests
 	if options['all_makefile_generation'] or options['all'] or options['test_cases'] != []:
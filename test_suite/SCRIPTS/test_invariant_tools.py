@@ -0,0 +1,277 @@
+#! /usr/bin/env python3
+
+import os
+import sys
+import shutil
+import yaml
+import subprocess
+
+validateinvariants_script = ""
+invariantvalidator_exe = ""
+dtracesplit_exe = ""
+dtraceconvert_exe = ""
+
+def readViolations(csv_file):
+	with open(csv_file) as f:
+		lines = f.read().splitlines()
+	## the validators go through the dtraces in different orders
+	return lines[0], sorted(lines[1:])
+
+def callInvariantValidators(work_dir, resources):
+	global validateinvariants_script
+	global invariantvalidator_exe
+
+	invariant_file = os.path.join(work_dir, resources['invariants'])
+	if os.path.isfile(invariant_file) == False:
+		return ("FAIL: invariant_file not found:", resources['invariants'])
+	dtrace_dir = os.path.join(work_dir, resources['dtrace_dir'], '')
+	if os.path.isdir(dtrace_dir) == False:
+		return ("FAIL: dtrace_dir not found:", resources['dtrace_dir'])
+
+	## validate every dtrace of the directory with both validators
+	results = []
+	for validator, csv_name in ((validateinvariants_script, 'llfi.invariants.py.csv'),
+		(invariantvalidator_exe, 'llfi.invariants.native.csv')):
+		csv_file = os.path.join(work_dir, csv_name)
+		if os.path.isfile(csv_file):
+			os.remove(csv_file)
+		commands = [validator, '-o', csv_file, '--invariantFile', invariant_file, '--dtracedir', dtrace_dir]
+		p = subprocess.Popen(' '.join(commands), shell=True)
+		p.wait()
+		if p.returncode != 0:
+			return ("FAIL: \'" + os.path.basename(validator) + "\' quits unnormally!")
+		if os.path.isfile(csv_file) == False:
+			return ("FAIL: violations not generated by \'" + os.path.basename(validator) + "\':", csv_name)
+		results.append(readViolations(csv_file))
+
+	if results[0][0] != results[1][0]:
+		return ("FAIL: \'invariantvalidator\' writes another header than \'ValidateInvariants\':", results[1][0])
+	if len(results[0][1]) == 0:
+		return ("FAIL: no violations found by \'ValidateInvariants\' in:", resources['dtrace_dir'])
+	if results[0][1] != results[1][1]:
+		missing = [v for v in results[0][1] if v not in results[1][1]]
+		extra = [v for v in results[1][1] if v not in results[0][1]]
+		return ("FAIL: \'invariantvalidator\' and \'ValidateInvariants\' disagree, missing:", missing, "extra:", extra)
+
+	return "PASS"
+
+## the records of a dtrace with their nonces left out, dtraceconvert pads
+## the brackets of arrays
+def readConvertedRecords(dtrace_file):
+	records = []
+	for record in readRecords(dtrace_file):
+		lines = record.split('\n')
+		lines = lines[0:2] + lines[3:]
+		records.append('\n'.join(lines).replace('[ ', '[').replace(' ]', ']'))
+	return records
+
+def callDtraceConvert(work_dir, resources):
+	global validateinvariants_script
+	global invariantvalidator_exe
+	global dtraceconvert_exe
+
+	bdtrace = os.path.join(work_dir, resources['bdtrace'])
+	if os.path.isfile(bdtrace) == False:
+		return ("FAIL: binary dtrace not found:", resources['bdtrace'])
+	text_dtrace = os.path.join(work_dir, resources['bdtrace_text'])
+	if os.path.isfile(text_dtrace) == False:
+		return ("FAIL: text dtrace not found:", resources['bdtrace_text'])
+	invariant_file = os.path.join(work_dir, resources['invariants'])
+
+	converted = os.path.join(work_dir, 'llfi.converted.dtrace')
+	if os.path.isfile(converted):
+		os.remove(converted)
+	commands = [dtraceconvert_exe, '-o', converted, bdtrace]
+	p = subprocess.Popen(' '.join(commands), shell=True)
+	p.wait()
+	if p.returncode != 0:
+		return ("FAIL: \'dtraceconvert\' quits unnormally!")
+	if os.path.isfile(converted) == False:
+		return ("FAIL: dtrace not converted by \'dtraceconvert\':", resources['bdtrace'])
+	if readConvertedRecords(converted) != readConvertedRecords(text_dtrace):
+		return ("FAIL: \'dtraceconvert\' does not reproduce", resources['bdtrace_text'])
+
+	## both validators report the violations of the text dtrace for the binary
+	## one, at the same line numbers of its text form
+	results = []
+	for validator, dtrace_file, csv_name in ((validateinvariants_script, text_dtrace, 'llfi.invariants.text.csv'),
+		(validateinvariants_script, bdtrace, 'llfi.invariants.binary.py.csv'),
+		(invariantvalidator_exe, bdtrace, 'llfi.invariants.binary.native.csv')):
+		csv_file = os.path.join(work_dir, csv_name)
+		if os.path.isfile(csv_file):
+			os.remove(csv_file)
+		commands = [validator, '-o', csv_file, '--invariantFile', invariant_file, '--dtraceFile', dtrace_file]
+		p = subprocess.Popen(' '.join(commands), shell=True)
+		p.wait()
+		if p.returncode != 0:
+			return ("FAIL: \'" + os.path.basename(validator) + "\' quits unnormally on", os.path.basename(dtrace_file))
+		if os.path.isfile(csv_file) == False:
+			return ("FAIL: violations not generated by \'" + os.path.basename(validator) + "\':", csv_name)
+		results.append(readViolations(csv_file)[1])
+
+	if len(results[0]) == 0:
+		return ("FAIL: no violations found by \'ValidateInvariants\' in:", resources['bdtrace_text'])
+	if results[1] != results[2]:
+		return ("FAIL: \'invariantvalidator\' and \'ValidateInvariants\' disagree on", resources['bdtrace'])
+	if sorted(v.split(',', 1)[1] for v in results[0]) != sorted(v.split(',', 1)[1] for v in results[1]):
+		return ("FAIL: violations of", resources['bdtrace'], "differ from those of", resources['bdtrace_text'])
+
+	return "PASS"
+
+def getFunctionName(ppt_name):
+	return ppt_name.split(':::')[0]
+
+def isEnter(ppt_name):
+	return ppt_name.endswith(':::ENTER')
+
+def readRecords(dtrace_file):
+	with open(dtrace_file) as f:
+		blocks = f.read().split('\n\n')
+	blocks = [b.strip('\n') for b in blocks]
+	return [b for b in blocks if b.startswith('..')]
+
+def getPptName(record):
+	return record.split('\n')[0].lstrip('.')
+
+## sections of the invariants printed by Daikon, in the order of the file
+def readInvariantSections(invariant_file):
+	sections = []
+	begin_file = False
+	with open(invariant_file) as f:
+		for line in f.read().splitlines():
+			if line.startswith('=='):
+				begin_file = True
+			elif line.startswith('Exiting'):
+				break
+			elif begin_file and line.startswith('..'):
+				sections.append((line, []))
+			elif begin_file and line and len(sections) > 0:
+				sections[-1][1].append(line)
+	return sections
+
+def writeInvariantSections(invariant_file, sections):
+	with open(invariant_file, 'w') as f:
+		for ppt_name, invariants in sections:
+			f.write('=' * 75 + '\n')
+			f.write(ppt_name + '\n')
+			for invariant in invariants:
+				f.write(invariant + '\n')
+		f.write('Exiting Daikon.\n')
+
+def callDtraceSplit(work_dir, resources):
+	global dtracesplit_exe
+
+	golden_dtrace = os.path.join(work_dir, resources['dtrace_golden'])
+	if os.path.isfile(golden_dtrace) == False:
+		return ("FAIL: golden dtrace not found:", resources['dtrace_golden'])
+	invariant_file = os.path.join(work_dir, resources['invariants'])
+	invariant_sections = readInvariantSections(invariant_file)
+	records = readRecords(golden_dtrace)
+
+	for split_args, shard_name in (([], 'llfi.dtrace_shards'), (['--ppt'], 'llfi.dtrace_shards.ppt')):
+		shard_dir = os.path.join(work_dir, shard_name)
+		if os.path.isdir(shard_dir):
+			shutil.rmtree(shard_dir)
+		commands = [dtracesplit_exe] + split_args + ['-d', shard_dir, golden_dtrace]
+		p = subprocess.Popen(' '.join(commands), shell=True)
+		p.wait()
+		if p.returncode != 0:
+			return ("FAIL: \'dtracesplit\' quits unnormally!")
+		manifest_file = os.path.join(shard_dir, 'shards.txt')
+		if os.path.isfile(manifest_file) == False:
+			return ("FAIL: shards.txt not generated by \'dtracesplit\':", shard_name)
+
+		## every shard holds the records of its function or program point, and
+		## the shards of other program points also those of the ENTER of their
+		## function, in the order of the dtrace
+		split_records = set()
+		merge_inputs = []
+		with open(manifest_file) as f:
+			shard_list = [line.split(' ', 2) for line in f.read().splitlines()]
+		for shard_file, shard_records, shard_key in shard_list:
+			if split_args == []:
+				expected = [rec for rec in records if getFunctionName(getPptName(rec)) == shard_key]
+			else:
+				expected = [rec for rec in records if getPptName(rec) == shard_key or \
+					(not isEnter(shard_key) and isEnter(getPptName(rec)) and \
+					getFunctionName(getPptName(rec)) == getFunctionName(shard_key))]
+			if os.path.isfile(shard_file) == False:
+				return ("FAIL: shard not generated by \'dtracesplit\':", shard_file)
+			if readRecords(shard_file) != expected or int(shard_records) != len(expected):
+				return ("FAIL: records of shard", shard_key, "not split by \'dtracesplit\':", shard_file)
+			split_records.update(expected)
+
+			## the invariants Daikon finds for the shard, ENTER program points
+			## of shards of the EXIT program points are found twice
+			merge_input = shard_file[:-len('.dtrace')] + '.txt'
+			writeInvariantSections(merge_input, [s for s in invariant_sections \
+				if getFunctionName(s[0].lstrip('.')) == getFunctionName(shard_key) and \
+				(split_args == [] or isEnter(s[0]) or not isEnter(shard_key))])
+			merge_inputs.append(merge_input)
+		if len(split_records) != len(set(records)):
+			return ("FAIL: records lost by \'dtracesplit\':", shard_name)
+
+		merged_file = os.path.join(shard_dir, 'invariants.txt')
+		commands = [dtracesplit_exe, '--merge', '-o', merged_file] + merge_inputs
+		p = subprocess.Popen(' '.join(commands), shell=True)
+		p.wait()
+		if p.returncode != 0:
+			return ("FAIL: \'dtracesplit --merge\' quits unnormally!")
+		if os.path.isfile(merged_file) == False:
+			return ("FAIL: invariants not merged by \'dtracesplit --merge\':", shard_name)
+		if sorted(readInvariantSections(merged_file)) != sorted(invariant_sections):
+			return ("FAIL: invariants merged by \'dtracesplit --merge\' differ from", resources['invariants'])
+
+	return "PASS"
+
+def test_invariant_tools(*test_list):
+	global validateinvariants_script
+	global invariantvalidator_exe
+	global dtracesplit_exe
+	global dtraceconvert_exe
+
+	r = 0
+	suite = {}
+	script_dir = os.path.dirname(os.path.realpath(__file__))
+	llfi_tools_dir = os.path.join(script_dir, '../../tools')
+	validateinvariants_script = os.path.join(llfi_tools_dir, "ValidateInvariants")
+	invariantvalidator_exe = os.path.join(llfi_tools_dir, "invariantvalidator")
+	dtracesplit_exe = os.path.join(llfi_tools_dir, "dtracesplit")
+	dtraceconvert_exe = os.path.join(llfi_tools_dir, "dtraceconvert")
+
+	testsuite_dir = os.path.join(script_dir, os.pardir)
+	with open(os.path.join(testsuite_dir, "test_suite.yaml")) as f:
+		try:
+			suite = yaml.load(f)
+		except:
+			print("ERROR: Unable to load yaml file: test_suite.yaml", file=sys.stderr)
+			return -1
+
+	work_dict = {}
+	for test in suite["Invariants"]:
+		if len(test_list) == 0 or test in test_list or "all" in test_list:
+			work_dict["./Invariants/"+test] = suite["Invariants"][test]
+
+	result_list = []
+	for test_path in work_dict:
+		print ("MSG: Testing on invariants and dtrace files of:", test_path)
+		work_dir = os.path.abspath(os.path.join(testsuite_dir, test_path))
+		result = callInvariantValidators(work_dir, work_dict[test_path])
+		if result == 'PASS':
+			result = callDtraceSplit(work_dir, work_dict[test_path])
+		if result == 'PASS':
+			result = callDtraceConvert(work_dir, work_dict[test_path])
+		if result != 'PASS':
+			r += 1
+		record = {"name": test_path, "result": result}
+		result_list.append(record)
+
+	return r, result_list
+
+if __name__ == "__main__":
+	r, result_list = test_invariant_tools(*sys.argv[1:])
+	print ("=============== Result ===============")
+	for record in result_list:
+		print(record["name"], "\t\t", record["result"])
+
+	sys.exit(r)
@@ -10,8 +10,10 @@ tracediff_script = ""
 traceunion_script = ""
 traceontograph_script = ""
 tracetodot_script = ""
+traceaggregate_script = ""
 
 def callTraceTools(work_dir, resources):
+	global traceaggregate_script
 	global tracediff_script
 	global traceunion_script
 	global traceontograph_script
@@ -57,6 +59,18 @@ def callTraceTools(work_dir, resources):
 	if os.path.getsize(report_file) == 0:
 		return ("FAIL: united report_file generated by \'traceunion\' is empty:", united_report_name)
 
+	## call traceaggregate to merge all reports into a propagation summary
+	summary_name = 'llfi.stat.trace.summary.bin'
+	summary_file = os.path.join(work_dir, summary_name)
+	commands = [traceaggregate_script, '-o', summary_file]
+	commands.extend(reports_list)
+	p = subprocess.Popen(' '.join(commands), shell=True)
+	p.wait()
+	if p.returncode != 0:
+		return ("FAIL: \'traceaggregate\' quits unnormally!")
+	if os.path.isfile(summary_file) == False:
+		return ("FAIL: summary file not generated by \'traceaggregate\':", summary_name)
+
 	## call traceontograph to generate the dot file
 	cdfg_prof_file = os.path.join(work_dir, resources['cdfg_prof'])
 	if os.path.isfile(cdfg_prof_file) == False:
@@ -79,7 +93,7 @@ def callTraceTools(work_dir, resources):
 	llfi_stat_dir = os.path.join(work_dir, 'llfi', 'llfi_stat_output')
 	os.chdir(llfi_stat_dir)
 	#print (os.getcwd())
-	p = subprocess.Popen(tracetodot_script, shell=True)
+	p = subprocess.Popen(tracetodot_script + ' --aggregate', shell=True)
 	p.wait()
 	os.chdir(current_dir)
 	if p.returncode != 0:
@@ -97,6 +111,7 @@ def callTraceTools(work_dir, resources):
 
 
 def test_trace_tools(*test_list):
+	global traceaggregate_script
 	global tracediff_script
 	global traceunion_script
 	global traceontograph_script
@@ -110,6 +125,7 @@ def test_trace_tools(*test_list):
 	traceunion_script = os.path.join(llfi_tools_dir, "traceunion")
 	traceontograph_script = os.path.join(llfi_tools_dir, "traceontograph")
 	tracetodot_script = os.path.join(llfi_tools_dir, "tracetodot")
+	traceaggregate_script = os.path.join(llfi_tools_dir, "traceaggregate")
 	
 	testsuite_dir = os.path.join(script_dir, os.pardir)
 	with open(os.path.join(testsuite_dir, "test_suite.yaml")) as f:
@@ -0,0 +1,147 @@
+/************
+/DtraceConvert.cpp
+/  This tool is part of the LLFI Daikon tracing system
+/  It converts a binary dtrace (program.bdtrace, written with
+/  dtrace_format=binary) into Daikon's text dtrace format, one record at a
+/  time. The text is the same as DaikonTraceLib writes with dtrace_format=text.
+/
+/  Exec: dtraceconvert [-o|-a <text dtrace>] <binary dtrace>
+/  Output: <binary dtrace> with the .bdtrace extension replaced by .dtrace by
+/          default, "-" writes to stdout
+*************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "DtraceReader.h"
+
+using namespace std;
+
+static const char *usageMsg =
+  "dtraceconvert converts a binary LLFI dtrace into Daikon's text format\n\n"
+  "Usage: dtraceconvert [-o|-a <text dtrace>] <binary dtrace>\n\n"
+  "  -o <text dtrace>   Text dtrace to write (default: the input with .dtrace\n"
+  "                     instead of .bdtrace, - for stdout)\n"
+  "  -a <text dtrace>   Append to the text dtrace, e.g. after the declarations\n"
+  "                     written by the DaikonTrace pass\n";
+
+static void writeValue(FILE *out, uint8_t type, const DtraceValue &val) {
+  switch (type) {
+  case DAIKON_TYPE_INT:
+  case DAIKON_TYPE_CHAR:
+    fprintf(out, "\n%lld\n1\n", (long long)val.intValue);
+    break;
+  case DAIKON_TYPE_DOUBLE:
+    fprintf(out, "\n%f\n1\n", val.doubleValue);
+    break;
+  case DAIKON_TYPE_INT_ARRAY:
+  case DAIKON_TYPE_INT64_ARRAY:
+  case DAIKON_TYPE_DOUBLE_ARRAY:
+    if (val.isNull) {
+      fputs("\nnull\n1\n", out);
+      break;
+    }
+    fputs("\n[", out);
+    if (type == DAIKON_TYPE_DOUBLE_ARRAY) {
+      for (size_t i = 0; i < val.doubles.size(); ++i) {
+        if (val.doubles[i] != val.doubles[i])
+          fputs(" NaN", out);
+        else
+          fprintf(out, " %f", val.doubles[i]);
+      }
+    } else {
+      for (size_t i = 0; i < val.ints.size(); ++i)
+        fprintf(out, " %lld", (long long)val.ints[i]);
+    }
+    fputs(" ]\n1\n", out);
+    break;
+  case DAIKON_TYPE_STRING:
+    fputs("\n", out);
+    fputs(val.isNull ? "(null)" : val.str.c_str(), out);
+    fputs("\n1\n", out);
+    break;
+  default:
+    fputs("\nnonsensical\n2\n", out);
+    break;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *input = NULL;
+  string output;
+  const char *mode = "w";
+
+  for (int i = 1; i < argc; ++i) {
+    string arg(argv[i]);
+    if (arg == "-h" || arg == "--help") {
+      fputs(usageMsg, stderr);
+      return 0;
+    } else if ((arg == "-o" || arg == "-a") && i + 1 < argc) {
+      output = argv[++i];
+      mode = arg == "-a" ? "a" : "w";
+    } else if (arg[0] == '-' || input != NULL) {
+      fprintf(stderr, "ERROR: Invalid argument: %s\n\n%s", argv[i], usageMsg);
+      return 1;
+    } else {
+      input = argv[i];
+    }
+  }
+  if (input == NULL) {
+    fprintf(stderr, "ERROR: No binary dtrace specified\n\n%s", usageMsg);
+    return 1;
+  }
+  if (output.empty()) {
+    output = input;
+    size_t ext = output.rfind(".bdtrace");
+    if (ext != string::npos && ext + 8 == output.size())
+      output.erase(ext);
+    output += ".dtrace";
+  }
+
+  DtraceReader reader;
+  if (!reader.open(input)) {
+    fprintf(stderr, "ERROR: %s\n", reader.error().c_str());
+    return 1;
+  }
+  FILE *out = output == "-" ? stdout : fopen(output.c_str(), mode);
+  if (out == NULL) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", output.c_str());
+    return 1;
+  }
+  static char outBuffer[1 << 20];
+  setvbuf(out, outBuffer, _IOFBF, sizeof(outBuffer));
+
+  DtraceRecord rec;
+  unsigned long long records = 0;
+  while (reader.next(rec)) {
+    if (rec.tag == DTRACE_RECORD_STREAM) {
+      fputs("input-language C/C++\ndecl-version 2.0\nvar-comparability implicit\n\n\n", out);
+      continue;
+    }
+    if (rec.tag == DTRACE_RECORD_FAULT) {
+      fputs("FaultInjection\n", out);
+      continue;
+    }
+    fputs(rec.ppt->name.c_str(), out);
+    fprintf(out, "\nthis_invocation_nonce\n%lld\n", (long long)rec.nonce);
+    for (size_t i = 0; i < rec.values.size(); ++i) {
+      fputs(rec.ppt->varNames[i].c_str(), out);
+      writeValue(out, rec.ppt->varTypes[i], rec.values[i]);
+    }
+    fputs("\n", out);
+    ++records;
+  }
+  if (out != stdout)
+    fclose(out);
+  else
+    fflush(out);
+
+  if (!reader.error().empty()) {
+    fprintf(stderr, "ERROR: %s: %s\n", input, reader.error().c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,267 @@
+/************
+/DtraceReader.h
+/  Streaming reader of the binary dtrace written by DaikonTraceLib with
+/  dtrace_format=binary (format described in runtime_lib/DaikonTrace.h).
+/  The file is memory-mapped and decoded one record at a time, program point
+/  declarations are consumed by the reader.
+*************/
+
+#ifndef LLFI_DTRACE_READER_H
+#define LLFI_DTRACE_READER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "DaikonTrace.h"
+
+// returned by DtraceReader::next() at the start of every stream of the file
+#define DTRACE_RECORD_STREAM 'S'
+
+struct DtracePpt {
+  uint32_t id;
+  std::string name;
+  std::vector<std::string> varNames;
+  std::vector<uint8_t> varTypes;
+};
+
+struct DtraceValue {
+  bool isNull;
+  int64_t intValue;                // INT, CHAR
+  double doubleValue;              // DOUBLE
+  std::vector<int64_t> ints;       // INT_ARRAY, INT64_ARRAY
+  std::vector<double> doubles;     // DOUBLE_ARRAY
+  std::string str;                 // STRING
+};
+
+struct DtraceRecord {
+  char tag;                        // DTRACE_RECORD_ENTER/EXIT/FAULT or DTRACE_RECORD_STREAM
+  const DtracePpt *ppt;
+  uint32_t thread;
+  int64_t nonce;
+  std::vector<DtraceValue> values; // in the order of ppt->varNames
+};
+
+class DtraceReader {
+public:
+  DtraceReader() : data(NULL), cur(NULL), end(NULL), size(0) {}
+  ~DtraceReader() { close(); }
+
+  bool open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      err = std::string("unable to open ") + path;
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      ::close(fd);
+      err = std::string("unable to stat ") + path;
+      return false;
+    }
+    size = st.st_size;
+    if (size > 0) {
+      void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED) {
+        ::close(fd);
+        err = std::string("unable to map ") + path;
+        return false;
+      }
+      madvise(map, size, MADV_SEQUENTIAL);
+      data = (const unsigned char *)map;
+    }
+    ::close(fd);
+    cur = data;
+    end = data + size;
+    return true;
+  }
+
+  void close() {
+    if (data != NULL)
+      munmap((void *)data, size);
+    data = cur = end = NULL;
+    size = 0;
+    ppts.clear();
+  }
+
+  // false at the end of the file or on a malformed record (see error())
+  bool next(DtraceRecord &rec) {
+    while (cur < end) {
+      char tag = (char)*cur;
+      if (tag == DTRACE_BINARY_MAGIC[0])
+        return readStreamHeader(rec);
+      ++cur;
+      if (tag == DTRACE_RECORD_PPT) {
+        if (!readPpt())
+          return false;
+      } else if (tag == DTRACE_RECORD_ENTER || tag == DTRACE_RECORD_EXIT) {
+        rec.tag = tag;
+        return readInvocation(rec);
+      } else if (tag == DTRACE_RECORD_FAULT) {
+        rec.tag = tag;
+        rec.ppt = NULL;
+        return true;
+      } else {
+        return fail("unknown record");
+      }
+    }
+    return false;
+  }
+
+  bool atEnd() const { return cur >= end; }
+  const std::string &error() const { return err; }
+  size_t offset() const { return cur - data; }
+
+private:
+  const unsigned char *data;
+  const unsigned char *cur;
+  const unsigned char *end;
+  size_t size;
+  std::map<uint32_t, DtracePpt> ppts;
+  std::string err;
+
+  bool fail(const char *msg) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), " at offset %lu", (unsigned long)(cur - data));
+    err = std::string(msg) + buf;
+    cur = end;
+    return false;
+  }
+
+  template <typename T> bool read(T &value) {
+    if ((size_t)(end - cur) < sizeof(T))
+      return fail("truncated record");
+    memcpy(&value, cur, sizeof(T));
+    cur += sizeof(T);
+    return true;
+  }
+
+  bool readString(std::string &str, bool *isNull = NULL) {
+    uint32_t len;
+    if (!read(len))
+      return false;
+    if (isNull != NULL)
+      *isNull = len == DTRACE_BINARY_NULL;
+    if (len == DTRACE_BINARY_NULL) {
+      str.clear();
+      return true;
+    }
+    if ((size_t)(end - cur) < len)
+      return fail("truncated string");
+    str.assign((const char *)cur, len);
+    cur += len;
+    return true;
+  }
+
+  bool readStreamHeader(DtraceRecord &rec) {
+    uint32_t version;
+    if ((size_t)(end - cur) < 8 || memcmp(cur, DTRACE_BINARY_MAGIC, 8) != 0)
+      return fail("bad stream header");
+    cur += 8;
+    if (!read(version))
+      return false;
+    if (version != DTRACE_BINARY_VERSION)
+      return fail("unsupported binary dtrace version");
+    ppts.clear();
+    rec.tag = DTRACE_RECORD_STREAM;
+    rec.ppt = NULL;
+    return true;
+  }
+
+  bool readPpt() {
+    uint32_t id, varCount;
+    if (!read(id))
+      return false;
+    DtracePpt &ppt = ppts[id];
+    ppt.id = id;
+    if (!readString(ppt.name) || !read(varCount))
+      return false;
+    ppt.varNames.resize(varCount);
+    ppt.varTypes.resize(varCount);
+    for (uint32_t i = 0; i < varCount; ++i) {
+      if (!read(ppt.varTypes[i]) || !readString(ppt.varNames[i]))
+        return false;
+    }
+    return true;
+  }
+
+  template <typename E, typename T>
+  bool readElements(uint32_t count, std::vector<T> &out) {
+    if ((size_t)(end - cur) / sizeof(E) < count)
+      return fail("truncated array");
+    out.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+      E element;
+      memcpy(&element, cur, sizeof(E));
+      cur += sizeof(E);
+      out[i] = (T)element;
+    }
+    return true;
+  }
+
+  bool readInvocation(DtraceRecord &rec) {
+    uint32_t id;
+    if (!read(id) || !read(rec.thread) || !read(rec.nonce))
+      return false;
+    std::map<uint32_t, DtracePpt>::const_iterator it = ppts.find(id);
+    if (it == ppts.end())
+      return fail("undeclared program point");
+    rec.ppt = &it->second;
+    rec.values.resize(rec.ppt->varTypes.size());
+    for (size_t i = 0; i < rec.ppt->varTypes.size(); ++i) {
+      DtraceValue &val = rec.values[i];
+      val.isNull = false;
+      switch (rec.ppt->varTypes[i]) {
+      case DAIKON_TYPE_INT:
+      case DAIKON_TYPE_CHAR:
+        if (!read(val.intValue))
+          return false;
+        break;
+      case DAIKON_TYPE_DOUBLE:
+        if (!read(val.doubleValue))
+          return false;
+        break;
+      case DAIKON_TYPE_INT_ARRAY:
+      case DAIKON_TYPE_INT64_ARRAY:
+      case DAIKON_TYPE_DOUBLE_ARRAY: {
+        uint32_t count;
+        if (!read(count))
+          return false;
+        val.isNull = count == DTRACE_BINARY_NULL;
+        if (val.isNull)
+          count = 0;
+        bool ok;
+        if (rec.ppt->varTypes[i] == DAIKON_TYPE_INT_ARRAY)
+          ok = readElements<int32_t>(count, val.ints);
+        else if (rec.ppt->varTypes[i] == DAIKON_TYPE_INT64_ARRAY)
+          ok = readElements<int64_t>(count, val.ints);
+        else
+          ok = readElements<double>(count, val.doubles);
+        if (!ok)
+          return false;
+        break;
+      }
+      case DAIKON_TYPE_STRING:
+        if (!readString(val.str, &val.isNull))
+          return false;
+        break;
+      default:
+        // unknown types carry no value
+        val.isNull = true;
+        break;
+      }
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,431 @@
+/************
+/DtraceSplit.cpp
+/  This tool is part of the LLFI Daikon tracing system
+/  Daikon infers the invariants of one dtrace on a single core. dtracesplit
+/  splits a text dtrace (declarations of the DaikonTrace pass followed by the
+/  records) into shards of one function, or of one program point, each with
+/  its own header and declarations, so Daikon can run on every shard at once:
+/
+/    dtracesplit -p ProgramPoints.ppts -d shards program.dtrace
+/    ls shards/shard-*.dtrace | xargs -P $(nproc) -n 1 java daikon.Daikon ...
+/    dtracesplit --merge -o invariants.txt shards/shard-*.txt
+/
+/  The shards of EXIT program points also get the ENTER records of their
+/  function, which Daikon needs for orig(). Merging keeps the first section
+/  of every program point, so the ENTER invariants found twice are written
+/  once, in the format ValidateInvariants reads.
+/
+/  Exec: dtracesplit [-p <ProgramPoints.ppts>] [--ppt] [-d <shard dir>] <dtrace>
+/        dtracesplit --merge [-o <invariants>] <invariants> ...
+/  Output: <shard dir>/shard-<N>.dtrace and <shard dir>/shards.txt, the
+/          function or program point of every shard
+*************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const char *usageMsg =
+  "dtracesplit splits a Daikon dtrace into shards for parallel inference and\n"
+  "merges the invariants found for the shards\n\n"
+  "Usage: dtracesplit [-p <ProgramPoints.ppts>] [--ppt] [-d <shard dir>] <dtrace>\n"
+  "       dtracesplit --merge [-o <invariants>] <invariants> ...\n\n"
+  "  -p <ppts file>     Functions to keep, in the order of the shards (the\n"
+  "                     ProgramPoints.ppts of the DaikonTrace pass)\n"
+  "  --ppt              One shard per program point instead of per function\n"
+  "  -d <shard dir>     Directory of the shards (default: dtrace_shards)\n"
+  "  --merge            Merge the invariants printed by Daikon for the shards\n"
+  "  -o <invariants>    Merged invariants to write (default: stdout)\n";
+
+static const char *defaultHeader =
+  "input-language C/C++\ndecl-version 2.0\nvar-comparability implicit\n\n";
+
+// Shards are buffered and appended to their file, which is open only while
+// it is appended to. A shard is flushed once its buffer reaches
+// shardFlushSize, and the largest buffers once all of them together reach
+// bufferLimit, down to half of it
+static const size_t shardFlushSize = 1 << 20;
+static const size_t bufferLimit = 64 << 20;
+static size_t bufferedBytes = 0;
+
+struct Shard {
+  string key;
+  string path;
+  string buffer;
+  bool created;
+  unsigned long long records;
+};
+
+static vector<Shard> shards;
+static string shardDir = "dtrace_shards";
+static string header;
+
+static string getFunctionName(const string &pptName) {
+  return pptName.substr(0, pptName.find(":::"));
+}
+
+static bool isEnter(const string &pptName) {
+  size_t separator = pptName.rfind(":::");
+  return separator != string::npos && pptName.compare(separator + 3, string::npos, "ENTER") == 0;
+}
+
+static bool flushShard(Shard &shard) {
+  if (shard.buffer.empty())
+    return true;
+  FILE *out = fopen(shard.path.c_str(), shard.created ? "a" : "w");
+  if (out == NULL) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", shard.path.c_str());
+    return false;
+  }
+  bool ok = fwrite(shard.buffer.data(), 1, shard.buffer.size(), out) == shard.buffer.size();
+  ok = fclose(out) == 0 && ok;
+  shard.created = true;
+  bufferedBytes -= shard.buffer.size();
+  string().swap(shard.buffer);
+  return ok;
+}
+
+static bool flushLargestShards() {
+  while (bufferedBytes > bufferLimit / 2) {
+    size_t largest = 0;
+    for (size_t i = 1; i < shards.size(); ++i) {
+      if (shards[i].buffer.size() > shards[largest].buffer.size())
+        largest = i;
+    }
+    if (!flushShard(shards[largest]))
+      return false;
+  }
+  return true;
+}
+
+static size_t addShard(const string &key) {
+  char name[32];
+  snprintf(name, sizeof(name), "/shard-%lu.dtrace", (unsigned long)shards.size());
+  Shard shard;
+  shard.key = key;
+  shard.path = shardDir + name;
+  shard.created = false;
+  shard.records = 0;
+  shards.push_back(shard);
+  return shards.size() - 1;
+}
+
+static bool readProgramPoints(const char *fileName, vector<string> &functions) {
+  ifstream pptFile(fileName);
+  if (!pptFile.is_open())
+    return false;
+  string line;
+  while (getline(pptFile, line)) {
+    size_t begin = line.find_first_not_of(" \t"), end = line.find_last_not_of(" \t\r");
+    if (begin == string::npos || line.compare(begin, 11, "Module_Name") == 0)
+      continue;
+    functions.push_back(line.substr(begin, end - begin + 1));
+  }
+  return true;
+}
+
+/**
+ * Program points of the declarations, which precede the records
+ */
+static void scanDeclarations(const char *cur, const char *end, vector<string> &pptNames) {
+  set<string> seen;
+  while (cur < end) {
+    const char *eol = (const char *)memchr(cur, '\n', end - cur);
+    if (eol == NULL)
+      eol = end;
+    if (eol - cur >= 2 && cur[0] == '.' && cur[1] == '.')
+      break;
+    if (eol - cur > 4 && memcmp(cur, "ppt ", 4) == 0) {
+      const char *name = cur + 4;
+      while (name < eol && *name == '.')
+        ++name;
+      string pptName(name, eol - name);
+      if (seen.insert(pptName).second)
+        pptNames.push_back(pptName);
+    }
+    cur = eol + 1;
+  }
+}
+
+/**
+ * Shards of every program point: its function, or itself and for ENTER
+ * program points also the other program points of the function
+ */
+static void createShards(const vector<string> &pptNames, const vector<string> &functions,
+                         bool perPpt, map<string, vector<size_t> > &routes) {
+  map<string, vector<string> > functionPpts;
+  vector<string> order;
+  for (size_t i = 0; i < pptNames.size(); ++i) {
+    string functionName = getFunctionName(pptNames[i]);
+    if (functionPpts.find(functionName) == functionPpts.end())
+      order.push_back(functionName);
+    functionPpts[functionName].push_back(pptNames[i]);
+  }
+  if (!functions.empty()) {
+    order = functions;
+    for (size_t i = 0; i < order.size(); ++i) {
+      if (functionPpts.find(order[i]) == functionPpts.end())
+        fprintf(stderr, "WARNING: No declaration of %s\n", order[i].c_str());
+    }
+  }
+
+  for (size_t i = 0; i < order.size(); ++i) {
+    map<string, vector<string> >::iterator ppts = functionPpts.find(order[i]);
+    if (ppts == functionPpts.end())
+      continue;
+    if (!perPpt) {
+      size_t shard = addShard(order[i]);
+      for (size_t p = 0; p < ppts->second.size(); ++p)
+        routes[ppts->second[p]].push_back(shard);
+      continue;
+    }
+    vector<size_t> functionShards;
+    for (size_t p = 0; p < ppts->second.size(); ++p) {
+      size_t shard = addShard(ppts->second[p]);
+      routes[ppts->second[p]].push_back(shard);
+      functionShards.push_back(shard);
+    }
+    for (size_t p = 0; p < ppts->second.size(); ++p) {
+      if (!isEnter(ppts->second[p]))
+        continue;
+      for (size_t s = 0; s < functionShards.size(); ++s) {
+        if (shards[functionShards[s]].key != ppts->second[p])
+          routes[ppts->second[p]].push_back(functionShards[s]);
+      }
+    }
+  }
+}
+
+static bool writeBlock(const vector<size_t> &targets, const char *block, size_t length,
+                       bool isRecord) {
+  for (size_t i = 0; i < targets.size(); ++i) {
+    Shard &shard = shards[targets[i]];
+    size_t size = shard.buffer.size();
+    if (!shard.created && shard.buffer.empty())
+      shard.buffer = header.empty() ? defaultHeader : header;
+    shard.buffer.append(block, length);
+    shard.buffer += "\n\n";
+    bufferedBytes += shard.buffer.size() - size;
+    if (isRecord)
+      ++shard.records;
+    if (shard.buffer.size() >= shardFlushSize && !flushShard(shard))
+      return false;
+  }
+  return bufferedBytes < bufferLimit || flushLargestShards();
+}
+
+static int splitDtrace(const char *input, const char *pptFileName, bool perPpt) {
+  vector<string> functions;
+  if (pptFileName != NULL && !readProgramPoints(pptFileName, functions)) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", pptFileName);
+    return 1;
+  }
+
+  int fd = open(input, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", input);
+    return 1;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    fprintf(stderr, "ERROR: %s is empty\n", input);
+    return 1;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "ERROR: Unable to map %s\n", input);
+    return 1;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  const char *data = (const char *)map, *end = data + st.st_size;
+
+  if (mkdir(shardDir.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "ERROR: Unable to create %s\n", shardDir.c_str());
+    munmap(map, st.st_size);
+    return 1;
+  }
+
+  vector<string> pptNames;
+  scanDeclarations(data, end, pptNames);
+  std::map<string, vector<size_t> > routes;
+  createShards(pptNames, functions, perPpt, routes);
+
+  //Blocks are separated by blank lines, lines outside of them (the fault
+  //injection markers) are dropped
+  unsigned long long skipped = 0;
+  bool ok = true;
+  const char *cur = data;
+  while (cur < end && ok) {
+    const char *eol = (const char *)memchr(cur, '\n', end - cur);
+    if (eol == NULL)
+      eol = end;
+    const char *line = cur;
+    size_t length = eol - line;
+    cur = eol + 1;
+
+    bool isDecl = length > 4 && memcmp(line, "ppt ", 4) == 0;
+    bool isRecord = length >= 2 && line[0] == '.' && line[1] == '.';
+    if (!isDecl && !isRecord) {
+      if (header.empty() && length >= 14 && memcmp(line, "input-language", 14) == 0) {
+        //the header block, up to the first blank line
+        while (cur < end && *cur != '\n') {
+          const char *next = (const char *)memchr(cur, '\n', end - cur);
+          cur = next == NULL ? end : next + 1;
+        }
+        header.assign(line, cur - line);
+        header += "\n";
+      }
+      continue;
+    }
+
+    //the block ends at the next blank line
+    const char *blockEnd = eol;
+    while (cur < end && *cur != '\n') {
+      const char *next = (const char *)memchr(cur, '\n', end - cur);
+      blockEnd = next == NULL ? end : next;
+      cur = blockEnd + 1;
+    }
+    const char *name = line + (isDecl ? 4 : 0);
+    while (name < eol && *name == '.')
+      ++name;
+    std::map<string, vector<size_t> >::const_iterator route = routes.find(string(name, eol - name));
+    if (route == routes.end()) {
+      if (isRecord)
+        ++skipped;
+      continue;
+    }
+    ok = writeBlock(route->second, line, blockEnd - line, isRecord);
+  }
+  munmap(map, st.st_size);
+
+  string manifestName = shardDir + "/shards.txt";
+  FILE *manifest = fopen(manifestName.c_str(), "w");
+  if (manifest == NULL) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", manifestName.c_str());
+    return 1;
+  }
+  for (size_t i = 0; i < shards.size(); ++i) {
+    ok = flushShard(shards[i]) && ok;
+    fprintf(manifest, "%s %llu %s\n", shards[i].path.c_str(), shards[i].records,
+            shards[i].key.c_str());
+  }
+  fclose(manifest);
+  if (skipped > 0)
+    fprintf(stderr, "WARNING: %llu records of undeclared or unselected program points skipped\n",
+            skipped);
+  return ok ? 0 : 1;
+}
+
+/**
+ * Invariants of every program point of the Daikon outputs, the first section
+ * of a program point wins
+ */
+static int mergeInvariants(const vector<const char *> &inputs, const char *output) {
+  vector<string> pptOrder;
+  map<string, vector<string> > sections;
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    ifstream invariants(inputs[i]);
+    if (!invariants.is_open()) {
+      fprintf(stderr, "ERROR: Unable to open %s\n", inputs[i]);
+      return 1;
+    }
+    bool beginFile = false;
+    vector<string> *section = NULL;
+    set<string> fileSections;
+    string line;
+    while (getline(invariants, line)) {
+      if (line.compare(0, 2, "==") == 0) {
+        beginFile = true;
+        section = NULL;
+      } else if (line.compare(0, 7, "Exiting") == 0) {
+        break;
+      } else if (beginFile && line.compare(0, 2, "..") == 0) {
+        section = NULL;
+        if (sections.find(line) == sections.end()) {
+          pptOrder.push_back(line);
+          fileSections.insert(line);
+        }
+        if (fileSections.count(line) > 0)
+          section = &sections[line];
+      } else if (section != NULL && !line.empty()) {
+        section->push_back(line);
+      }
+    }
+  }
+
+  FILE *out = output == NULL ? stdout : fopen(output, "w");
+  if (out == NULL) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", output);
+    return 1;
+  }
+  for (size_t i = 0; i < pptOrder.size(); ++i) {
+    fputs("===========================================================================\n", out);
+    fprintf(out, "%s\n", pptOrder[i].c_str());
+    const vector<string> &section = sections[pptOrder[i]];
+    for (size_t j = 0; j < section.size(); ++j)
+      fprintf(out, "%s\n", section[j].c_str());
+  }
+  fputs("Exiting Daikon.\n", out);
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *pptFileName = NULL;
+  const char *output = NULL;
+  bool perPpt = false, merge = false;
+  vector<const char *> inputs;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg(argv[i]);
+    if (arg == "-h" || arg == "--help") {
+      fputs(usageMsg, stderr);
+      return 0;
+    } else if (arg == "-p" && i + 1 < argc) {
+      pptFileName = argv[++i];
+    } else if (arg == "-d" && i + 1 < argc) {
+      shardDir = argv[++i];
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg == "--ppt") {
+      perPpt = true;
+    } else if (arg == "--merge") {
+      merge = true;
+    } else if (arg[0] == '-') {
+      fprintf(stderr, "ERROR: Invalid argument: %s\n\n%s", argv[i], usageMsg);
+      return 1;
+    } else {
+      inputs.push_back(argv[i]);
+    }
+  }
+
+  if (merge) {
+    if (inputs.empty()) {
+      fprintf(stderr, "ERROR: No invariants to merge\n\n%s", usageMsg);
+      return 1;
+    }
+    return mergeInvariants(inputs, output);
+  }
+  if (inputs.size() != 1) {
+    fprintf(stderr, "ERROR: Exactly one dtrace to split is required\n\n%s", usageMsg);
+    return 1;
+  }
+  return splitDtrace(inputs[0], pptFileName, perPpt);
+}
@@ -0,0 +1,898 @@
+/************
+/InvariantValidator.cpp
+/  This tool is part of the LLFI Daikon tracing system
+/  It validates the Daikon invariants of the golden run against the dtraces of
+/  fault injection runs, like ValidateInvariants.py and with the same options
+/  and output, but natively: the invariants are parsed once into a table of
+/  compiled predicates, dtraces are memory-mapped and validated in parallel,
+/  one file per worker thread.
+/
+/  Text dtraces are read as they are, binary dtraces (.bdtrace) are decoded
+/  with DtraceReader.h and their line numbers are those of the text that
+/  dtraceconvert writes for them. Supported invariants are
+/    not-null            v != null
+/    order               v sorted by <, <=, > or >=
+/    multi-value         v one of { 1, 2 }, v one of { [1, 2], [3] }
+/    array-equality      v == [1, 2, 3]
+/    elementwise         v elements OP x, v OP w (elementwise)
+/    bounds, equality    v OP c, v OP w, v OP orig(w)
+/  with OP one of >=, >, <=, <, ==, !=. Other invariants always hold.
+/
+/  Exec: invariantvalidator [-j <threads>] [-o <output file>]
+/          --invariantFile <invariants> (--dtraceFile <dtrace> |
+/          --dtracedir <dir> [--outputdir <dir>])
+/  Output: CSV of the violated invariants, see usageMsg
+*************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "DtraceReader.h"
+
+using namespace std;
+
+static const char *usageMsg =
+  "invariantvalidator validates Daikon invariants against LLFI dtrace files\n\n"
+  "Usage: invariantvalidator [OPTIONS]\n\n"
+  "  -o <output file>          CSV of the violated invariants (default:\n"
+  "                            DaikonTraceOutput.txt)\n"
+  "  --invariantFile <file>    Daikon invariants of the golden run\n"
+  "  --dtraceFile <file>       Single dtrace (.dtrace or .bdtrace) file\n"
+  "  --dtracedir <dir>         Every *.dtrace and *.bdtrace file in the\n"
+  "                            directory (a prefix of the file names)\n"
+  "  --outputdir <dir>         Directory of the std_outputfile-run-<id> files,\n"
+  "                            adds the failure mode of each run\n"
+  "  -j <threads>              Number of worker threads (default: number of\n"
+  "                            cores)\n";
+
+//Classes of ValidateInvariants.py, the first match wins
+static const char *invariantStrings[][2] = {
+  { "has only one value", "uniqueness" },
+  { "!= null", "not-null" },
+  { "sorted by", "order" },
+  { "one of", "multi-value" },
+  { "== orig", "initialization" },
+  { "== [", "array-equality" },
+  { "elements ==", "element-initialization" },
+  { "elementwise", "elementwise" },
+  { "elements", "elementwise" },
+  { "orig", "initialization" },
+  { "return", "return-value" },
+  { ">", "minimum-condition" },
+  { "<", "maximum-condition" },
+  { "==", "equality-condition" },
+  { "!=", "inequality-condition" },
+};
+
+// A value of the trace, ints are kept exact
+struct Number {
+  bool isInt;
+  long long intValue;
+  double doubleValue;
+};
+
+enum CheckKind {
+  CHECK_NONE,
+  CHECK_NOT_NULL,
+  CHECK_ORDER,
+  CHECK_ONE_OF,
+  CHECK_ONE_OF_ARRAY,
+  CHECK_ARRAY_EQUALS,
+  CHECK_ELEMENTS,
+  CHECK_ELEMENTWISE,
+  CHECK_COMPARE
+};
+
+enum CompareOp { OP_GE, OP_GT, OP_LE, OP_LT, OP_EQ, OP_NE, OP_INVALID };
+
+enum OperandKind { OPERAND_CONSTANT, OPERAND_VARIABLE, OPERAND_ORIG };
+
+struct Operand {
+  OperandKind kind;
+  Number constant;
+  string variable;
+};
+
+struct CompiledInvariant {
+  string predicate;
+  string invariantClass;
+  string variable;
+  CheckKind check;
+  CompareOp op;
+  Operand rhs;
+  vector<Number> constants;
+  vector<vector<Number> > arrays;
+};
+
+typedef map<string, vector<CompiledInvariant> > InvariantTable;
+
+// A variable of the record being read, the value as it appears in the text
+struct TraceVariable {
+  const char *name;
+  size_t nameLength;
+  const char *value;
+  size_t valueLength;
+  unsigned long long lineNumber;
+};
+
+// Values of the ENTER record of every invocation, for orig()
+typedef map<string, string> OrigValues;
+
+struct FileState {
+  string traceID;
+  string errorMode;
+  map<string, OrigValues> origValues;
+  string output;
+};
+
+static string outputFileName = "DaikonTraceOutput.txt";
+static string outputDir;
+static InvariantTable functionInvariants;
+
+static vector<string> dtraceFiles;
+static vector<string> results;
+static vector<bool> finished;
+static bool readFailed = false;
+static size_t nextDtraceFile = 0;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resultReady = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Like Python's int() and float() of ValidateInvariants.py
+ */
+static bool parseNumber(const char *text, size_t length, Number &number) {
+  char buf[64];
+  while (length > 0 && (*text == ' ' || *text == '\t')) {
+    ++text;
+    --length;
+  }
+  while (length > 0 && (text[length - 1] == ' ' || text[length - 1] == '\t'))
+    --length;
+  if (length == 0 || length >= sizeof(buf))
+    return false;
+  memcpy(buf, text, length);
+  buf[length] = '\0';
+
+  char *end;
+  errno = 0;
+  number.intValue = strtoll(buf, &end, 10);
+  if (*end == '\0' && errno == 0) {
+    number.isInt = true;
+    number.doubleValue = (double)number.intValue;
+    return true;
+  }
+  number.doubleValue = strtod(buf, &end);
+  if (*end != '\0')
+    return false;
+  number.isInt = false;
+  return true;
+}
+
+static bool parseNumber(const string &text, Number &number) {
+  return parseNumber(text.data(), text.size(), number);
+}
+
+/**
+ * Elements of a list, separated by blanks in the trace ("[ 1 2 3 ]") and by
+ * commas in the invariants ("[1, 2, 3]")
+ */
+static bool parseList(const char *text, size_t length, vector<Number> &list) {
+  list.clear();
+  const char *end = text + length;
+  while (text < end && *text == ' ')
+    ++text;
+  while (end > text && end[-1] == ' ')
+    --end;
+  if (text == end || *text != '[' || end[-1] != ']')
+    return false;
+  ++text;
+  --end;
+  while (text < end) {
+    while (text < end && (*text == ' ' || *text == ','))
+      ++text;
+    const char *element = text;
+    while (text < end && *text != ' ' && *text != ',')
+      ++text;
+    if (text == element)
+      break;
+    Number number;
+    if (!parseNumber(element, text - element, number))
+      return false;
+    list.push_back(number);
+  }
+  return true;
+}
+
+static bool parseList(const string &text, vector<Number> &list) {
+  return parseList(text.data(), text.size(), list);
+}
+
+static bool evaluateCompareOp(CompareOp op, const Number &lhs, const Number &rhs) {
+  if (lhs.isInt && rhs.isInt) {
+    long long a = lhs.intValue, b = rhs.intValue;
+    switch (op) {
+    case OP_GE: return a >= b;
+    case OP_GT: return a > b;
+    case OP_LE: return a <= b;
+    case OP_LT: return a < b;
+    case OP_EQ: return a == b;
+    case OP_NE: return a != b;
+    default: return true;
+    }
+  }
+  double a = lhs.doubleValue, b = rhs.doubleValue;
+  switch (op) {
+  case OP_GE: return a >= b;
+  case OP_GT: return a > b;
+  case OP_LE: return a <= b;
+  case OP_LT: return a < b;
+  case OP_EQ: return a == b;
+  case OP_NE: return a != b;
+  default: return true;
+  }
+}
+
+static bool equalLists(const vector<Number> &a, const vector<Number> &b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (!evaluateCompareOp(OP_EQ, a[i], b[i]))
+      return false;
+  }
+  return true;
+}
+
+static CompareOp parseCompareOp(const string &op) {
+  if (op == ">=")
+    return OP_GE;
+  if (op == ">")
+    return OP_GT;
+  if (op == "<=")
+    return OP_LE;
+  if (op == "<")
+    return OP_LT;
+  if (op == "==")
+    return OP_EQ;
+  if (op == "!=")
+    return OP_NE;
+  return OP_INVALID;
+}
+
+//"a[]" and "a[..]" stand for the array variable a
+static string getVariableName(string token) {
+  size_t bracket = token.find('[');
+  if (bracket != string::npos && bracket > 0)
+    token = token.substr(0, bracket);
+  return token;
+}
+
+static void parseOperand(const string &token, Operand &operand) {
+  if (parseNumber(token, operand.constant)) {
+    operand.kind = OPERAND_CONSTANT;
+  } else if (token.compare(0, 5, "orig(") == 0 && token[token.size() - 1] == ')') {
+    operand.kind = OPERAND_ORIG;
+    operand.variable = getVariableName(token.substr(5, token.size() - 6));
+  } else {
+    operand.kind = OPERAND_VARIABLE;
+    operand.variable = getVariableName(token);
+  }
+}
+
+static string classifyInvariant(const string &predicate) {
+  for (size_t i = 0; i < sizeof(invariantStrings) / sizeof(invariantStrings[0]); ++i) {
+    if (predicate.find(invariantStrings[i][0]) != string::npos)
+      return invariantStrings[i][1];
+  }
+  return "other";
+}
+
+/**
+ * Compile the predicate, invariants that cannot be checked get CHECK_NONE
+ */
+static void compileInvariant(CompiledInvariant &inv) {
+  vector<string> tokens;
+  istringstream words(inv.predicate);
+  string word;
+  while (words >> word)
+    tokens.push_back(word);
+
+  inv.check = CHECK_NONE;
+  inv.op = OP_INVALID;
+  if (tokens.size() < 3 || inv.invariantClass == "uniqueness")
+    return;
+  inv.variable = getVariableName(tokens[0]);
+
+  if (tokens.size() == 3 && tokens[1] == "!=" && tokens[2] == "null") {
+    inv.check = CHECK_NOT_NULL;
+  } else if (tokens.size() == 4 && tokens[1] == "sorted" && tokens[2] == "by") {
+    inv.op = parseCompareOp(tokens[3]);
+    if (inv.op != OP_INVALID && inv.op != OP_EQ && inv.op != OP_NE)
+      inv.check = CHECK_ORDER;
+  } else if (tokens[1] == "one" && tokens[2] == "of") {
+    size_t open = inv.predicate.find('{'), close = inv.predicate.rfind('}');
+    if (open == string::npos || close == string::npos || close < open)
+      return;
+    string values = inv.predicate.substr(open + 1, close - open - 1);
+    if (values.find('[') == string::npos) {
+      istringstream elements(values);
+      string element;
+      while (getline(elements, element, ',')) {
+        Number number;
+        if (!parseNumber(element, number))
+          return;
+        inv.constants.push_back(number);
+      }
+      inv.check = CHECK_ONE_OF;
+    } else {
+      size_t begin = values.find('[');
+      while (begin != string::npos) {
+        size_t end = values.find(']', begin);
+        if (end == string::npos)
+          return;
+        inv.arrays.push_back(vector<Number>());
+        if (!parseList(values.substr(begin, end - begin + 1), inv.arrays.back()))
+          return;
+        begin = values.find('[', end);
+      }
+      inv.check = CHECK_ONE_OF_ARRAY;
+    }
+  } else if (tokens[1] == "==" && tokens[2][0] == '[') {
+    size_t open = inv.predicate.find("== [");
+    if (parseList(inv.predicate.substr(open + 3), inv.constants))
+      inv.check = CHECK_ARRAY_EQUALS;
+  } else if (tokens.size() == 4 && tokens[1] == "elements") {
+    inv.op = parseCompareOp(tokens[2]);
+    parseOperand(tokens[3], inv.rhs);
+    if (inv.op != OP_INVALID)
+      inv.check = CHECK_ELEMENTS;
+  } else if (tokens.size() == 4 && tokens[3] == "(elementwise)") {
+    inv.op = parseCompareOp(tokens[1]);
+    inv.rhs.kind = OPERAND_VARIABLE;
+    inv.rhs.variable = getVariableName(tokens[2]);
+    if (inv.op != OP_INVALID)
+      inv.check = CHECK_ELEMENTWISE;
+  } else if (tokens.size() == 3) {
+    inv.op = parseCompareOp(tokens[1]);
+    parseOperand(tokens[2], inv.rhs);
+    if (inv.op != OP_INVALID)
+      inv.check = CHECK_COMPARE;
+  }
+}
+
+/**
+ * Invariants per function key ("func.ENTER" / "func.EXIT0"), read like
+ * readDaikonInvariantFile() of ValidateInvariants.py
+ */
+static bool readInvariantFile(const string &fileName) {
+  ifstream invariants(fileName.c_str());
+  if (!invariants.is_open())
+    return false;
+
+  bool beginFile = false;
+  string functionKey;
+  string line;
+  while (getline(invariants, line)) {
+    if (line.compare(0, 2, "==") == 0) {
+      beginFile = true;
+    } else if (line.compare(0, 7, "Exiting") == 0) {
+      break;
+    } else if (beginFile && line.compare(0, 2, "..") == 0) {
+      string pptName = line.substr(line.find_first_not_of('.'));
+      string functionName = pptName.substr(0, pptName.find('('));
+      functionName = functionName.substr(0, functionName.find(":::"));
+      functionKey = functionName + "." + pptName.substr(pptName.rfind(":::") + 3);
+    } else if (beginFile && !functionKey.empty()) {
+      size_t begin = line.find_first_not_of(':');
+      if (begin == string::npos)
+        continue;
+      CompiledInvariant inv;
+      inv.predicate = line.substr(begin);
+      inv.invariantClass = classifyInvariant(inv.predicate);
+      compileInvariant(inv);
+      functionInvariants[functionKey].push_back(inv);
+    }
+  }
+  return true;
+}
+
+static const TraceVariable *findVariable(const vector<TraceVariable> &variables,
+                                         const string &name) {
+  for (size_t i = 0; i < variables.size(); ++i) {
+    if (variables[i].nameLength == name.size() &&
+        memcmp(variables[i].name, name.data(), name.size()) == 0)
+      return &variables[i];
+  }
+  return NULL;
+}
+
+/**
+ * The right hand side of a comparison, false when it is not known
+ */
+static bool getOperand(const Operand &operand, const vector<TraceVariable> &variables,
+                       const OrigValues *orig, Number &number) {
+  if (operand.kind == OPERAND_CONSTANT) {
+    number = operand.constant;
+    return true;
+  }
+  if (operand.kind == OPERAND_ORIG) {
+    if (orig == NULL)
+      return false;
+    OrigValues::const_iterator value = orig->find(operand.variable);
+    return value != orig->end() && parseNumber(value->second, number);
+  }
+  const TraceVariable *variable = findVariable(variables, operand.variable);
+  return variable != NULL &&
+         parseNumber(variable->value, variable->valueLength, number);
+}
+
+/**
+ * False when the record violates the invariant, invariants over values that
+ * are not in the record hold
+ */
+static bool invariantHolds(const CompiledInvariant &inv, const TraceVariable &variable,
+                           const vector<TraceVariable> &variables,
+                           const OrigValues *orig) {
+  Number value, rhs;
+  vector<Number> list;
+  switch (inv.check) {
+  case CHECK_NOT_NULL:
+    return !(variable.valueLength == 4 && memcmp(variable.value, "null", 4) == 0);
+
+  case CHECK_ORDER:
+    if (!parseList(variable.value, variable.valueLength, list))
+      return true;
+    for (size_t i = 1; i < list.size(); ++i) {
+      if (!evaluateCompareOp(inv.op, list[i - 1], list[i]))
+        return false;
+    }
+    return true;
+
+  case CHECK_ONE_OF:
+    if (!parseNumber(variable.value, variable.valueLength, value))
+      return true;
+    for (size_t i = 0; i < inv.constants.size(); ++i) {
+      if (evaluateCompareOp(OP_EQ, value, inv.constants[i]))
+        return true;
+    }
+    return false;
+
+  case CHECK_ONE_OF_ARRAY:
+    if (!parseList(variable.value, variable.valueLength, list))
+      return true;
+    for (size_t i = 0; i < inv.arrays.size(); ++i) {
+      if (equalLists(list, inv.arrays[i]))
+        return true;
+    }
+    return false;
+
+  case CHECK_ARRAY_EQUALS:
+    if (!parseList(variable.value, variable.valueLength, list))
+      return true;
+    return equalLists(list, inv.constants);
+
+  case CHECK_ELEMENTS:
+    if (!parseList(variable.value, variable.valueLength, list) ||
+        !getOperand(inv.rhs, variables, orig, rhs))
+      return true;
+    for (size_t i = 0; i < list.size(); ++i) {
+      if (!evaluateCompareOp(inv.op, list[i], rhs))
+        return false;
+    }
+    return true;
+
+  case CHECK_ELEMENTWISE: {
+    const TraceVariable *other = findVariable(variables, inv.rhs.variable);
+    vector<Number> otherList;
+    if (other == NULL || !parseList(variable.value, variable.valueLength, list) ||
+        !parseList(other->value, other->valueLength, otherList))
+      return true;
+    for (size_t i = 0; i < list.size() && i < otherList.size(); ++i) {
+      if (!evaluateCompareOp(inv.op, list[i], otherList[i]))
+        return false;
+    }
+    return true;
+  }
+
+  case CHECK_COMPARE:
+    if (!parseNumber(variable.value, variable.valueLength, value) ||
+        !getOperand(inv.rhs, variables, orig, rhs))
+      return true;
+    return evaluateCompareOp(inv.op, value, rhs);
+
+  default:
+    return true;
+  }
+}
+
+/**
+ * Check a complete record and save the values of ENTER records for orig()
+ */
+static void evaluateRecord(const string &pptName, const string &nonce,
+                           const vector<TraceVariable> &variables, FileState &state) {
+  size_t separator = pptName.rfind(":::");
+  if (separator == string::npos)
+    return;
+  string functionName = pptName.substr(0, pptName.find('('));
+  functionName = functionName.substr(0, functionName.find(":::"));
+  string point = pptName.substr(separator + 3);
+  string functionKey = functionName + "." + (point == "EXIT0" ? "EXIT" : point);
+  string origKey = nonce + '\0' + functionName;
+
+  if (point == "ENTER") {
+    OrigValues &orig = state.origValues[origKey];
+    orig.clear();
+    for (size_t i = 0; i < variables.size(); ++i) {
+      orig[string(variables[i].name, variables[i].nameLength)] =
+          string(variables[i].value, variables[i].valueLength);
+    }
+  }
+
+  InvariantTable::const_iterator invariants = functionInvariants.find(functionKey);
+  if (invariants == functionInvariants.end())
+    return;
+  map<string, OrigValues>::const_iterator origItr = state.origValues.find(origKey);
+  const OrigValues *orig = origItr == state.origValues.end() ? NULL : &origItr->second;
+
+  char lineNumber[32];
+  for (size_t i = 0; i < invariants->second.size(); ++i) {
+    const CompiledInvariant &inv = invariants->second[i];
+    if (inv.check == CHECK_NONE)
+      continue;
+    const TraceVariable *variable = findVariable(variables, inv.variable);
+    if (variable == NULL || invariantHolds(inv, *variable, variables, orig))
+      continue;
+    snprintf(lineNumber, sizeof(lineNumber), "%llu", variable->lineNumber);
+    state.output += "\"";
+    state.output += lineNumber;
+    state.output += "\",\"" + functionKey + "\",\"" + inv.predicate + "\",\"" +
+                    inv.invariantClass + "\",\"" + state.traceID + "\"";
+    if (!state.errorMode.empty())
+      state.output += ",\"" + state.errorMode + "\"";
+    state.output += "\n";
+  }
+}
+
+static bool validateTextDtrace(const string &fileName, FileState &state) {
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return true;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  const char *cur = (const char *)map, *end = cur + st.st_size;
+  unsigned long long lineNumber = 0;
+  enum { OUTSIDE, NONCE_LINE, NAME_LINE, VALUE_LINE, MODIFIED_LINE } expect = OUTSIDE;
+  bool inRecord = false;
+  string pptName, nonce;
+  vector<TraceVariable> variables;
+
+  while (cur < end) {
+    const char *line = cur;
+    const char *eol = (const char *)memchr(cur, '\n', end - cur);
+    if (eol == NULL)
+      eol = end;
+    cur = eol + 1;
+    size_t length = eol - line;
+    ++lineNumber;
+
+    if (length == 0) {
+      //a blank line ends the record
+      if (inRecord)
+        evaluateRecord(pptName, nonce, variables, state);
+      inRecord = false;
+      expect = OUTSIDE;
+    } else if (length >= 2 && line[0] == '.' && line[1] == '.') {
+      size_t dots = 0;
+      while (dots < length && line[dots] == '.')
+        ++dots;
+      pptName.assign(line + dots, length - dots);
+      nonce.clear();
+      variables.clear();
+      inRecord = true;
+      expect = NAME_LINE;
+    } else if (!inRecord) {
+      continue;
+    } else if (expect == NONCE_LINE) {
+      nonce.assign(line, length);
+      expect = NAME_LINE;
+    } else if (expect == VALUE_LINE) {
+      variables.back().value = line;
+      variables.back().valueLength = length;
+      variables.back().lineNumber = lineNumber;
+      expect = MODIFIED_LINE;
+    } else if (expect == MODIFIED_LINE) {
+      expect = NAME_LINE;
+    } else if (length == 21 && memcmp(line, "this_invocation_nonce", 21) == 0) {
+      expect = NONCE_LINE;
+    } else {
+      TraceVariable variable;
+      variable.name = line;
+      variable.nameLength = length;
+      variable.value = NULL;
+      variable.valueLength = 0;
+      variable.lineNumber = lineNumber;
+      variables.push_back(variable);
+      expect = VALUE_LINE;
+    }
+  }
+  if (inRecord)
+    evaluateRecord(pptName, nonce, variables, state);
+  munmap(map, st.st_size);
+  return true;
+}
+
+/**
+ * A value as dtraceconvert writes it to the text dtrace
+ */
+static void formatValue(uint8_t type, const DtraceValue &val, string &text) {
+  char buf[64];
+  text.clear();
+  switch (type) {
+  case DAIKON_TYPE_INT:
+  case DAIKON_TYPE_CHAR:
+    snprintf(buf, sizeof(buf), "%lld", (long long)val.intValue);
+    text = buf;
+    break;
+  case DAIKON_TYPE_DOUBLE:
+    snprintf(buf, sizeof(buf), "%f", val.doubleValue);
+    text = buf;
+    break;
+  case DAIKON_TYPE_INT_ARRAY:
+  case DAIKON_TYPE_INT64_ARRAY:
+  case DAIKON_TYPE_DOUBLE_ARRAY:
+    if (val.isNull) {
+      text = "null";
+      break;
+    }
+    text = "[";
+    if (type == DAIKON_TYPE_DOUBLE_ARRAY) {
+      for (size_t i = 0; i < val.doubles.size(); ++i) {
+        if (val.doubles[i] != val.doubles[i])
+          text += " NaN";
+        else {
+          snprintf(buf, sizeof(buf), " %f", val.doubles[i]);
+          text += buf;
+        }
+      }
+    } else {
+      for (size_t i = 0; i < val.ints.size(); ++i) {
+        snprintf(buf, sizeof(buf), " %lld", (long long)val.ints[i]);
+        text += buf;
+      }
+    }
+    text += " ]";
+    break;
+  case DAIKON_TYPE_STRING:
+    text = val.isNull ? "(null)" : val.str;
+    break;
+  default:
+    text = "nonsensical";
+    break;
+  }
+}
+
+static bool validateBinaryDtrace(const string &fileName, FileState &state) {
+  DtraceReader reader;
+  if (!reader.open(fileName.c_str()))
+    return false;
+
+  DtraceRecord rec;
+  char nonce[32];
+  vector<string> values;
+  vector<TraceVariable> variables;
+  unsigned long long lineNumber = 1;
+  while (reader.next(rec)) {
+    if (rec.tag == DTRACE_RECORD_STREAM) {
+      lineNumber += 5;
+      continue;
+    }
+    if (rec.tag == DTRACE_RECORD_FAULT) {
+      lineNumber += 1;
+      continue;
+    }
+    size_t varCount = rec.values.size();
+    values.resize(varCount);
+    variables.resize(varCount);
+    for (size_t i = 0; i < varCount; ++i) {
+      formatValue(rec.ppt->varTypes[i], rec.values[i], values[i]);
+      variables[i].name = rec.ppt->varNames[i].data();
+      variables[i].nameLength = rec.ppt->varNames[i].size();
+      variables[i].value = values[i].data();
+      variables[i].valueLength = values[i].size();
+      variables[i].lineNumber = lineNumber + 4 + 3 * i;
+    }
+    snprintf(nonce, sizeof(nonce), "%lld", (long long)rec.nonce);
+    size_t dots = rec.ppt->name.find_first_not_of('.');
+    evaluateRecord(rec.ppt->name.substr(dots == string::npos ? 0 : dots), nonce,
+                   variables, state);
+    lineNumber += 4 + 3 * varCount;
+  }
+  if (!reader.error().empty()) {
+    fprintf(stderr, "ERROR: %s: %s\n", fileName.c_str(), reader.error().c_str());
+    return false;
+  }
+  return true;
+}
+
+static string getTraceID(const string &fileName) {
+  size_t last = fileName.rfind('.');
+  if (last == string::npos)
+    return fileName;
+  size_t previous = last == 0 ? string::npos : fileName.rfind('.', last - 1);
+  return previous == string::npos ? fileName.substr(0, last)
+                                  : fileName.substr(previous + 1, last - previous - 1);
+}
+
+/**
+ * checkFailureMode() of ValidateInvariants.py
+ */
+static string checkFailureMode(const string &traceID) {
+  string stdOutputFileName = outputDir + "std_outputfile-run-" + traceID;
+  ifstream output(stdOutputFileName.c_str());
+  if (!output.is_open())
+    return "ErrorMode.Crash";
+  stringstream content;
+  content << output.rdbuf();
+  string text = content.str();
+  if (text.empty() || text == "PARSEC Benchmark Suite\n")
+    return "ErrorMode.Crash";
+
+  istringstream lines(text);
+  string line;
+  while (getline(lines, line)) {
+    if (line.find("not") != string::npos)
+      return "ErrorMode.SDC";
+  }
+  return "ErrorMode.Benign";
+}
+
+static void *validateWorker(void *) {
+  while (true) {
+    pthread_mutex_lock(&queueLock);
+    size_t idx = nextDtraceFile++;
+    pthread_mutex_unlock(&queueLock);
+    if (idx >= dtraceFiles.size())
+      break;
+
+    const string &fileName = dtraceFiles[idx];
+    FileState state;
+    state.traceID = getTraceID(fileName);
+    if (!outputDir.empty())
+      state.errorMode = checkFailureMode(state.traceID);
+    size_t ext = fileName.rfind(".bdtrace");
+    bool ok = ext != string::npos && ext + 8 == fileName.size()
+                  ? validateBinaryDtrace(fileName, state)
+                  : validateTextDtrace(fileName, state);
+    if (!ok)
+      fprintf(stderr, "ERROR: Unable to read %s\n", fileName.c_str());
+
+    pthread_mutex_lock(&queueLock);
+    if (!ok)
+      readFailed = true;
+    results[idx].swap(state.output);
+    finished[idx] = true;
+    pthread_cond_signal(&resultReady);
+    pthread_mutex_unlock(&queueLock);
+  }
+  return NULL;
+}
+
+static void addDtraceFiles(const string &pattern) {
+  glob_t matches;
+  if (glob(pattern.c_str(), 0, NULL, &matches) == 0) {
+    for (size_t i = 0; i < matches.gl_pathc; ++i)
+      dtraceFiles.push_back(matches.gl_pathv[i]);
+  }
+  globfree(&matches);
+}
+
+int main(int argc, char *argv[]) {
+  string invariantFile, dtraceFile, dtraceDir;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (int i = 1; i < argc; ++i) {
+    string arg(argv[i]);
+    if (arg == "-h" || arg == "--help") {
+      fputs(usageMsg, stderr);
+      return 0;
+    } else if (arg == "-o" && i + 1 < argc) {
+      outputFileName = argv[++i];
+    } else if (arg == "--invariantFile" && i + 1 < argc) {
+      invariantFile = argv[++i];
+    } else if (arg == "--dtraceFile" && i + 1 < argc) {
+      dtraceFile = argv[++i];
+    } else if (arg == "--dtracedir" && i + 1 < argc) {
+      dtraceDir = argv[++i];
+    } else if (arg == "--outputdir" && i + 1 < argc) {
+      outputDir = argv[++i];
+    } else if (arg == "--goldenFile" && i + 1 < argc) {
+      //accepted for ValidateInvariants.py compatibility, unused there too
+      ++i;
+    } else if (arg == "-j" && i + 1 < argc) {
+      threads = atol(argv[++i]);
+    } else {
+      fprintf(stderr, "ERROR: Invalid argument: %s\n\n%s", argv[i], usageMsg);
+      return 1;
+    }
+  }
+
+  if (invariantFile.empty() || (dtraceFile.empty() && dtraceDir.empty())) {
+    fprintf(stderr, "ERROR: An invariant file and dtrace files are required\n\n%s",
+            usageMsg);
+    return 1;
+  }
+  if (!readInvariantFile(invariantFile)) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", invariantFile.c_str());
+    return 1;
+  }
+
+  if (!dtraceDir.empty()) {
+    addDtraceFiles(dtraceDir + "*.dtrace");
+    addDtraceFiles(dtraceDir + "*.bdtrace");
+  } else {
+    dtraceFiles.push_back(dtraceFile);
+  }
+
+  FILE *out = fopen(outputFileName.c_str(), "w");
+  if (out == NULL) {
+    fprintf(stderr, "ERROR: Unable to open %s\n", outputFileName.c_str());
+    return 1;
+  }
+  static char outBuffer[1 << 20];
+  setvbuf(out, outBuffer, _IOFBF, sizeof(outBuffer));
+  fputs("\"LineNumber\",\"FunctionKey\",\"Invariant\",\"Class\",\"TraceID\"", out);
+  fputs(outputDir.empty() ? "\n" : ",\"FailureMode\"\n", out);
+
+  if (threads < 1)
+    threads = 1;
+  if ((size_t)threads > dtraceFiles.size())
+    threads = dtraceFiles.size();
+  results.resize(dtraceFiles.size());
+  finished.resize(dtraceFiles.size(), false);
+
+  vector<pthread_t> workers(threads);
+  for (long t = 0; t < threads; ++t)
+    pthread_create(&workers[t], NULL, validateWorker, NULL);
+
+  //violations are written in the order of the files, as soon as they are known
+  for (size_t idx = 0; idx < dtraceFiles.size(); ++idx) {
+    string output;
+    pthread_mutex_lock(&queueLock);
+    while (!finished[idx])
+      pthread_cond_wait(&resultReady, &queueLock);
+    output.swap(results[idx]);
+    pthread_mutex_unlock(&queueLock);
+    fwrite(output.data(), 1, output.size(), out);
+  }
+
+  for (long t = 0; t < threads; ++t)
+    pthread_join(workers[t], NULL);
+  fclose(out);
+  return readFailed ? 1 : 0;
+}
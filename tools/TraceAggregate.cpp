@@ -0,0 +1,349 @@
+/************
+/TraceAggregate.cpp
+/  This tool is part of the LLFI tracing system
+/  It merges any number of trace difference reports (the output of tracediff)
+/  into per llfi_index propagation statistics. Reports are parsed in parallel,
+/  one file per worker thread. A union of reports from traceunion no longer
+/  tells which diffs came from which fault, so such reports are skipped: pass
+/  the reports of tracediff themselves.
+/
+/  Exec: traceaggregate [-j <threads>] -o <summary file> <report|dir> ...
+/  Output: a compact binary summary (see TraceAggregate.h) that traceontograph
+/          can overlay on the program CDFG as a propagation heatmap
+*************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "TraceAggregate.h"
+
+using namespace std;
+
+struct SiteStats {
+  unsigned long long injected;
+  unsigned long long corrupted;
+  unsigned long long ctrl_diverged;
+  double distance_sum;
+
+  SiteStats() : injected(0), corrupted(0), ctrl_diverged(0), distance_sum(0) {}
+};
+
+typedef map<long long, SiteStats> SiteMap;
+
+struct WorkerState {
+  SiteMap sites;
+  unsigned long long reports;
+  unsigned long long ctrl_reports;
+};
+
+static vector<string> reportFiles;
+static size_t nextReportFile = 0;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *usageMsg =
+  "traceaggregate merges trace difference reports into per llfi_index "
+  "propagation statistics\n\n"
+  "Usage: traceaggregate [-j <threads>] -o <summary file> <report|dir> ...\n\n"
+  "  -o <summary file>   Binary summary to write (default: "
+  "llfi.stat.trace.summary.bin)\n"
+  "  -j <threads>        Number of worker threads (default: number of cores)\n"
+  "  <dir>               Every TraceDiffReportFile* in the directory is merged\n\n"
+  "Reports are the output of tracediff, unions from traceunion are skipped\n";
+
+static bool readWholeFile(const string &path, string &content) {
+  FILE *f = fopen(path.c_str(), "r");
+  if (f == NULL)
+    return false;
+  char buf[1 << 16];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    content.append(buf, n);
+  fclose(f);
+  return true;
+}
+
+// "Diff@ inst # 130\130 -> inst # 131\131": return the golden start (130)
+static long long parseDiffStart(const char *line) {
+  const char *p = strstr(line, "inst #");
+  if (p == NULL)
+    return -1;
+  return atoll(p + 6);
+}
+
+// "Data Diff: ID: 20 OPCode: add Value: ..." / "Ctrl Diff: ID: 22 \ 25"
+static void parseIDs(const char *line, long long *first, long long *second) {
+  *first = -1;
+  *second = -1;
+  const char *p = strstr(line, "ID:");
+  if (p == NULL)
+    return;
+  p += 3;
+  while (*p == ' ')
+    ++p;
+  if (strncmp(p, "None", 4) != 0)
+    *first = atoll(p);
+  const char *q = strchr(p, '\\');
+  if (q == NULL)
+    return;
+  ++q;
+  while (*q == ' ')
+    ++q;
+  if (strncmp(q, "None", 4) != 0)
+    *second = atoll(q);
+}
+
+struct ReportState {
+  bool open;
+  long long start;
+  long long fault_id;
+  bool has_ctrl;
+  long long block_start;
+  long long block_offset;
+  map<long long, long long> first_corruption;
+  set<long long> ctrl_sites;
+};
+
+static void closeReport(ReportState &rep, WorkerState &ws) {
+  if (!rep.open)
+    return;
+  ws.reports++;
+  if (rep.has_ctrl)
+    ws.ctrl_reports++;
+  if (rep.fault_id >= 0)
+    ws.sites[rep.fault_id].injected++;
+  for (map<long long, long long>::iterator it = rep.first_corruption.begin();
+       it != rep.first_corruption.end(); ++it) {
+    if (it->first == rep.fault_id)
+      continue;
+    SiteStats &s = ws.sites[it->first];
+    s.corrupted++;
+    s.distance_sum += (double)(it->second - rep.start);
+  }
+  for (set<long long>::iterator it = rep.ctrl_sites.begin();
+       it != rep.ctrl_sites.end(); ++it)
+    ws.sites[*it].ctrl_diverged++;
+  rep.open = false;
+}
+
+static void aggregateReportFile(const string &path, WorkerState &ws) {
+  string content;
+  if (!readWholeFile(path, content)) {
+    fprintf(stderr, "WARNING: Unable to open trace report %s\n", path.c_str());
+    return;
+  }
+
+  ReportState rep;
+  rep.open = false;
+  int header_line = 0;
+  size_t pos = 0;
+  while (pos < content.size()) {
+    size_t end = content.find('\n', pos);
+    if (end == string::npos)
+      end = content.size();
+    string line = content.substr(pos, end - pos);
+    pos = end + 1;
+    const char *l = line.c_str();
+    while (*l == ' ' || *l == '\t')
+      ++l;
+    if (*l == '\0')
+      continue;
+
+    if (strncmp(l, "#FaultReport", 12) == 0) {
+      closeReport(rep, ws);
+      rep.open = true;
+      rep.start = 0;
+      rep.fault_id = -1;
+      rep.has_ctrl = false;
+      rep.block_start = -1;
+      rep.block_offset = 0;
+      rep.first_corruption.clear();
+      rep.ctrl_sites.clear();
+      header_line = 1;
+      continue;
+    }
+    if (!rep.open)
+      continue;
+
+    if (header_line == 1) {
+      // "<fault count> @ <trace start inst number>"
+      if (strtoull(l, NULL, 10) > 1) {
+        fprintf(stderr, "WARNING: %s holds a union of trace reports, which "
+                "cannot be aggregated, skipped\n", path.c_str());
+        rep.open = false;
+        continue;
+      }
+      const char *at = strchr(l, '@');
+      if (at != NULL)
+        rep.start = atoll(at + 1);
+      header_line = 2;
+    } else if (header_line == 2) {
+      // "ID: 14 OPCode: sub Value: 1336d337 / ..."
+      long long unused;
+      parseIDs(l, &rep.fault_id, &unused);
+      header_line = 0;
+    } else if (strncmp(l, "Diff@", 5) == 0) {
+      rep.block_start = parseDiffStart(l);
+      rep.block_offset = 0;
+    } else if (strncmp(l, "Data Diff", 9) == 0) {
+      long long id, unused;
+      parseIDs(l, &id, &unused);
+      if (id >= 0) {
+        // blocks are not sorted by position, keep the earliest corruption
+        long long at = rep.block_start + rep.block_offset;
+        map<long long, long long>::iterator it = rep.first_corruption.find(id);
+        if (it == rep.first_corruption.end() || at < it->second)
+          rep.first_corruption[id] = at;
+      }
+      ++rep.block_offset;
+    } else if (strncmp(l, "Ctrl Diff", 9) == 0) {
+      long long golden_id, faulty_id;
+      parseIDs(l, &golden_id, &faulty_id);
+      if (golden_id >= 0)
+        rep.ctrl_sites.insert(golden_id);
+      if (faulty_id >= 0)
+        rep.ctrl_sites.insert(faulty_id);
+      rep.has_ctrl = true;
+      ++rep.block_offset;
+    }
+  }
+  closeReport(rep, ws);
+}
+
+static void *aggregateWorker(void *arg) {
+  WorkerState *ws = (WorkerState *)arg;
+  while (true) {
+    pthread_mutex_lock(&queueLock);
+    size_t idx = nextReportFile++;
+    pthread_mutex_unlock(&queueLock);
+    if (idx >= reportFiles.size())
+      break;
+    aggregateReportFile(reportFiles[idx], *ws);
+  }
+  return NULL;
+}
+
+static void addReportPath(const string &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    fprintf(stderr, "WARNING: %s does not exist, skipped\n", path.c_str());
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    reportFiles.push_back(path);
+    return;
+  }
+  DIR *dir = opendir(path.c_str());
+  if (dir == NULL)
+    return;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL) {
+    if (strncmp(ent->d_name, "TraceDiffReportFile", 19) == 0)
+      reportFiles.push_back(path + "/" + ent->d_name);
+  }
+  closedir(dir);
+}
+
+static bool writeSummary(const char *path, const SiteMap &sites,
+                         unsigned long long reports,
+                         unsigned long long ctrl_reports) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL)
+    return false;
+
+  TraceAggregateHeader header;
+  memcpy(header.magic, TRACE_AGGREGATE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_AGGREGATE_VERSION;
+  header.reserved = 0;
+  header.num_reports = reports;
+  header.num_ctrl_reports = ctrl_reports;
+  header.num_sites = sites.size();
+  fwrite(&header, sizeof(header), 1, f);
+
+  for (SiteMap::const_iterator it = sites.begin(); it != sites.end(); ++it) {
+    TraceAggregateSite rec;
+    rec.llfi_index = it->first;
+    rec.injected = it->second.injected;
+    rec.corrupted = it->second.corrupted;
+    rec.ctrl_diverged = it->second.ctrl_diverged;
+    rec.mean_distance = it->second.corrupted == 0 ? 0.0 :
+        it->second.distance_sum / (double)it->second.corrupted;
+    fwrite(&rec, sizeof(rec), 1, f);
+  }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  const char *output = "llfi.stat.trace.summary.bin";
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (int i = 1; i < argc; ++i) {
+    string arg(argv[i]);
+    if (arg == "-h" || arg == "--help") {
+      fputs(usageMsg, stderr);
+      return 0;
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg == "-j" && i + 1 < argc) {
+      threads = atol(argv[++i]);
+    } else if (arg[0] == '-') {
+      fprintf(stderr, "ERROR: Invalid argument: %s\n\n%s", argv[i], usageMsg);
+      return 1;
+    } else {
+      addReportPath(arg);
+    }
+  }
+
+  if (reportFiles.empty()) {
+    fprintf(stderr, "ERROR: No trace difference report to aggregate\n\n%s",
+            usageMsg);
+    return 1;
+  }
+  if (threads < 1)
+    threads = 1;
+  if ((size_t)threads > reportFiles.size())
+    threads = reportFiles.size();
+
+  vector<WorkerState> states(threads);
+  vector<pthread_t> workers(threads);
+  for (long t = 0; t < threads; ++t) {
+    states[t].reports = 0;
+    states[t].ctrl_reports = 0;
+    pthread_create(&workers[t], NULL, aggregateWorker, &states[t]);
+  }
+
+  SiteMap sites;
+  unsigned long long reports = 0, ctrl_reports = 0;
+  for (long t = 0; t < threads; ++t) {
+    pthread_join(workers[t], NULL);
+    reports += states[t].reports;
+    ctrl_reports += states[t].ctrl_reports;
+    for (SiteMap::iterator it = states[t].sites.begin();
+         it != states[t].sites.end(); ++it) {
+      SiteStats &s = sites[it->first];
+      s.injected += it->second.injected;
+      s.corrupted += it->second.corrupted;
+      s.ctrl_diverged += it->second.ctrl_diverged;
+      s.distance_sum += it->second.distance_sum;
+    }
+  }
+
+  if (!writeSummary(output, sites, reports, ctrl_reports)) {
+    fprintf(stderr, "ERROR: Unable to write summary file %s\n", output);
+    return 1;
+  }
+  printf("Aggregated %llu reports (%lu files) into %lu sites: %s\n",
+         reports, (unsigned long)reportFiles.size(),
+         (unsigned long)sites.size(), output);
+  return 0;
+}
@@ -0,0 +1,34 @@
+/************
+/TraceAggregate.h
+/  On-disk layout of the propagation summary written by traceaggregate.
+/  All fields are little-endian and naturally aligned, so the file can be
+/  read back with python struct formats '<8sIIQQQ' (header) and '<qQQQd'
+/  (one record per llfi_index, sorted by index).
+*************/
+
+#ifndef LLFI_TRACE_AGGREGATE_H
+#define LLFI_TRACE_AGGREGATE_H
+
+#include <stdint.h>
+
+#define TRACE_AGGREGATE_MAGIC "LLFIAGG\0"
+#define TRACE_AGGREGATE_VERSION 1
+
+struct TraceAggregateHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t num_reports;       // faulty runs merged
+  uint64_t num_ctrl_reports;  // faulty runs with at least one control diff
+  uint64_t num_sites;
+};
+
+struct TraceAggregateSite {
+  int64_t llfi_index;
+  uint64_t injected;       // runs whose fault was injected at this site
+  uint64_t corrupted;      // runs in which this site produced a data diff
+  uint64_t ctrl_diverged;  // runs in which this site took part in a ctrl diff
+  double mean_distance;    // mean dynamic distance from injection to corruption
+};
+
+#endif
@@ -15,14 +15,20 @@ List of options:
 --dtracedir:		File directory containing DTrace files
 --outputdir:		File directory containing Output files
 --help(-h):             Show help information
+
+invariantvalidator (tools/InvariantValidator.cpp) takes the same options and validates
+the dtrace files of a campaign in parallel
 """
 
 import sys, os
 import glob
+import subprocess
+import tempfile
 from collections import OrderedDict, defaultdict
 from enum import Enum
 
 prog = os.path.basename(sys.argv[0])
+dtraceconvert = os.path.join(os.path.dirname(os.path.realpath(__file__)), "dtraceconvert")
 
 
 #Global variables
@@ -393,8 +399,29 @@ def readDaikonInvariantFile():
 	FunctionInvariants = {funcKey:invariantList for funcKey, invariantList in funcInvariantsList.items() if invariantList}
 
 
+#Binary dtrace files (dtraceFormat: binary) are converted to the text format first
+def convertBinaryDTraceFile(dtraceFileName):
+	textFile = tempfile.NamedTemporaryFile(suffix=".dtrace", delete=False)
+	textFile.close()
+	if subprocess.call([dtraceconvert, "-o", textFile.name, dtraceFileName]) != 0:
+		os.remove(textFile.name)
+		print("Unable to convert ", dtraceFileName)
+		sys.exit(1)
+	return textFile.name
+
 def readDTraceFile(dtraceFileName, errorMode=ErrorMode.Undefined):
 
+	if dtraceFileName.endswith(".bdtrace"):
+		textFileName = convertBinaryDTraceFile(dtraceFileName)
+		try:
+			readTextDTraceFile(textFileName, getTraceID(dtraceFileName), errorMode)
+		finally:
+			os.remove(textFileName)
+	else:
+		readTextDTraceFile(dtraceFileName, getTraceID(dtraceFileName), errorMode)
+
+def readTextDTraceFile(dtraceFileName, traceID, errorMode):
+
 	try:
 		lineCount = getLineCount(dtraceFileName)
 		dtraceFile = open(dtraceFileName, 'r')
@@ -406,7 +433,6 @@ def readDTraceFile(dtraceFileName, errorMode=ErrorMode.Undefined):
 	nextLineisVal = False
 	variableDict = {}
 	lineNumber = 1
-	traceID = getTraceID(dtraceFileName)
 
 	beginReading = 0;
 
@@ -477,6 +503,7 @@ def main(args):
 
 	if options["dtracedir"]:
 		DaikonTraceFiles.extend(glob.glob(options["dtracedir"] + "*.dtrace"))
+		DaikonTraceFiles.extend(glob.glob(options["dtracedir"] + "*.bdtrace"))
 		
 		for dtraceFile in DaikonTraceFiles:
 			if options["outputdir"]:
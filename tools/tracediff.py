@@ -39,6 +39,27 @@ def traceDiff(argv, output = 0):
   goldTraceLines = goldTrace.split("\n")
   faultyTraceLines =  faultyTrace.split("\n")
 
+  #A golden window replayed for rolling hash traces starts at its own header
+  goldTraceStartPoint = 1
+  if goldTraceLines[0].startswith("#TraceStartInstNumber:"):
+    goldTraceStartPoint = int(goldTraceLines[0].split(' ')[1])
+
+  #A fault injected before the rolling hash window the faulty trace starts at,
+  #or skipped by sampled tracing, is named by a "#FaultRecord: <inst number>
+  #<record>" header instead of being the first record
+  faultRecord = None
+  for line in faultyTraceLines[1:]:
+    if line.startswith("#FaultRecord:"):
+      flds = line.split(' ', 2)
+      faultRecord = (int(flds[1]), flds[2])
+      break
+
+  #Drop annotations such as the "#Sync: <clock>" lines of multithreaded traces,
+  #keeping the faulty trace header
+  goldTraceLines = [line for line in goldTraceLines if not line.startswith("#")]
+  faultyTraceLines = faultyTraceLines[:1] + \
+    [line for line in faultyTraceLines[1:] if not line.startswith("#")]
+
   #Examine Header of Trace File
   header = faultyTraceLines[0].split(' ')
   for i in range(0, len(header) - 1):
@@ -47,20 +68,31 @@ def traceDiff(argv, output = 0):
     #Remove traces from golden trace that happened before fault injection point
       faultyTraceStartPoint = int(header[i+1])
       faultyTraceLines.pop(0)
-      for i in range (0,faultyTraceStartPoint-1):
+      for i in range (0,faultyTraceStartPoint-goldTraceStartPoint):
         goldTraceLines.pop(0)
 
-  #record and report the fault injected line
-  goldInjectedLine = diffLine(goldTraceLines[0])
-  faultInjectedLine = diffLine(faultyTraceLines[0])
-  diffID = goldInjectedLine.ID
-  print("#FaultReport")
-  print("1 @", faultyTraceStartPoint)
-  print(goldInjectedLine.raw, "/", faultInjectedLine.Value)
-
-  #remove the fault injected lines
-  goldTraceLines.pop(0)
-  faultyTraceLines.pop(0)
+  #diff positions count from the record after the first one of the traces
+  diffStartPoint = faultyTraceStartPoint
+  if faultRecord is None:
+    #record and report the fault injected line
+    goldInjectedLine = diffLine(goldTraceLines[0])
+    faultInjectedLine = diffLine(faultyTraceLines[0])
+    diffID = goldInjectedLine.ID
+    print("#FaultReport")
+    print("1 @", faultyTraceStartPoint)
+    print(goldInjectedLine.raw, "/", faultInjectedLine.Value)
+
+    #remove the fault injected lines
+    goldTraceLines.pop(0)
+    faultyTraceLines.pop(0)
+  else:
+    #the golden value of the injected instance is not in the golden window
+    faultInjectedLine = diffLine(faultRecord[1])
+    diffID = faultInjectedLine.ID
+    print("#FaultReport")
+    print("1 @", faultRecord[0])
+    print("ID:", diffID, "OPCode:", faultInjectedLine.OPCode, "Value: ? /", faultInjectedLine.Value)
+    diffStartPoint = faultyTraceStartPoint - 1
 
   for line in goldTraceLines:
     if line == "":
@@ -88,7 +120,7 @@ def traceDiff(argv, output = 0):
       break
   '''
 
-  report = diffReport(goldTraceLines, faultyTraceLines, faultyTraceStartPoint, diffID)
+  report = diffReport(goldTraceLines, faultyTraceLines, diffStartPoint, diffID)
   report.printSummary()
 
   #restore stdout
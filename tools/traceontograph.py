@@ -5,8 +5,11 @@
 #This script will take 1 trace Union file as input, and 1 llfi program dot graph
 #it will apply the tracing information to the graph so that fault injected instructions
 #are bordered in red, and fault affected instructions have a yellow fill
+#If the input is a propagation summary written by traceaggregate, instructions
+#are instead filled on a heatmap scaled by how often they were corrupted
 #Usage:
 #     ./traceOntoGraph.py myTraceReportFile myProgramGraph.dot > myNewGraph.dot
+#     ./traceOntoGraph.py llfi.stat.trace.summary.bin myProgramGraph.dot > myHeatmap.dot
 
 import sys
 import os
@@ -18,6 +21,43 @@ FAULT_INJECTED_BORDER_COLOR = "red"
 
 prog = os.path.basename(sys.argv[0])
 
+def heatmapColor(rate):
+  #white (never corrupted) to red (corrupted in every run), in dot HSV notation
+  return "0.000 %.3f 1.000" % min(1.0, max(0.0, rate))
+
+def summaryOntoGraph(summaryFile, graphFile, output=0):
+  oldSTDOut = sys.stdout
+  if output != 0:
+    sys.stdout = open(output, "w")
+
+  numReports, sites = parseAggregateSummary(summaryFile)
+
+  graphF = open(graphFile, 'r')
+  graphLines = graphF.readlines()
+  graphF.close()
+
+  for i in range(len(graphLines)):
+    line = graphLines[i]
+    if not line.lstrip().startswith("llfiID_") or " [shape" not in line:
+      continue
+    try:
+      ID = int(line.split("llfiID_")[1].split(" ")[0])
+    except ValueError:
+      continue
+    if ID not in sites:
+      continue
+    site = sites[ID]
+    attrs = ", style=\"filled\", fillcolor=\"" + heatmapColor(site.corruptionRate) + "\""
+    if site.injected > 0:
+      attrs += ", color=\"" + FAULT_INJECTED_BORDER_COLOR + "\", penwidth=2"
+    attrs += ", tooltip=\"corrupted %d/%d runs, mean distance %.1f\"" % \
+      (site.corrupted, numReports, site.meanDistance)
+    graphLines[i] = line.rstrip()[:-2] + attrs + "];\n"
+
+  print(''.join(graphLines))
+
+  sys.stdout = oldSTDOut
+
 def traceOntoGraph(traceFile, graphFile, output=0):
   #save stdout so we can redirect it without mangling other python scripts
   oldSTDOut = sys.stdout
@@ -59,9 +99,13 @@ def traceOntoGraph(traceFile, graphFile, output=0):
 if __name__ == "__main__":
   if len(sys.argv) >= 2 and (sys.argv[1] == '-h' or sys.argv[1] == '--help'):
     print(("%(prog)s applies the program trace difference summary to program static control-data-flow graph to visualize it\n\n"
-    "running option: %(prog)s <trace difference report> <program dot-formatted CDFG>" %{"prog": prog}), file=sys.stderr)
+    "running option: %(prog)s <trace difference report> <program dot-formatted CDFG>\n"
+    "                %(prog)s <traceaggregate summary> <program dot-formatted CDFG>" %{"prog": prog}), file=sys.stderr)
   elif len(sys.argv) >= 3:
-    traceOntoGraph(sys.argv[1], sys.argv[2])
+    if isAggregateSummary(sys.argv[1]):
+      summaryOntoGraph(sys.argv[1], sys.argv[2])
+    else:
+      traceOntoGraph(sys.argv[1], sys.argv[2])
   else:
     print("Error: running option: %(prog)s <trace difference report> <program dot-formatted CDFG>" %{"prog": prog}, file=sys.stderr)
     exit(1)
\ No newline at end of file
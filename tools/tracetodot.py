@@ -20,6 +20,8 @@ Usage: %(prog)s [OPTIONS]
 List of options:
 
 --help(-h):             Show help information
+--aggregate:            Also merge all trace difference reports with traceaggregate
+                        and write a propagation heatmap TraceGraphAggregate.dot
 
 """
 
@@ -29,16 +31,20 @@ import subprocess
 import shlex
 
 prog = os.path.basename(sys.argv[0])
+aggregate = False
 
 
 
 def parseArgs(args):
+  global aggregate
   argid = 0
   while argid < len(args):
     arg = args[argid]
     if arg.startswith("-"):
       if arg == "--help" or arg == "-h":
         usage()
+      elif arg == "--aggregate":
+        aggregate = True
       else:
         usage("Invalid argument: " + arg)
     argid += 1
@@ -82,6 +88,14 @@ def makeTraceOutputFolder():
 
 
 
+def escapeParens(path):
+	while "(" in path and not "\(" in path:
+		path = path[:path.find("(")]+'\('+ path[path.find("(")+1:]
+	while ")" in path and not "\)" in path:
+		path = path[:path.find(")")]+'\)'+ path[path.find(")")+1:]
+	return path
+
+
 def executeTraceDiff():
 	traceFileCount = 0
 	log_path =os.path.abspath(os.path.join(traceOutputFolder, "stderr_log.txt"))
@@ -106,7 +120,17 @@ def executeTraceDiff():
 		temptraceOutputFolder = temptraceOutputFolder[:temptraceOutputFolder.find(")")]+'\)'+ temptraceOutputFolder[temptraceOutputFolder.find(")")+1:]
 	for file in os.listdir(currentpath):
 		if file.endswith(".txt") and file.startswith("llfi.stat.trace."):
-			cmd = tempScriptdir+"/tracediff "+tempgoldenTraceFilePath+" "+file+" > "+temptraceOutputFolder+"/TraceDiffReportFile"+file[file.find("llfi.stat.trace")+len("llfi.stat.trace"):]
+			# Traces of thread k of multithreaded programs are compared with the golden trace of the same thread
+			threadGoldenTraceFilePath = tempgoldenTraceFilePath
+			flds = file.split(".")
+			if len(flds) > 4 and flds[3].startswith("t") and flds[3][1:].isdigit():
+				threadGoldenTraceFilePath = escapeParens(os.path.abspath(os.path.join(currentpath,
+					"../baseline/llfi.stat.trace."+flds[3]+".prof.txt")))
+			# With rolling hash tracing the golden records of the diverged window are replayed per run
+			goldenWindowFile = "llfi.stat.goldtrace" + file[len("llfi.stat.trace"):]
+			if os.path.isfile(os.path.join(currentpath, goldenWindowFile)):
+				threadGoldenTraceFilePath = escapeParens(os.path.abspath(os.path.join(currentpath, goldenWindowFile)))
+			cmd = tempScriptdir+"/tracediff "+threadGoldenTraceFilePath+" "+file+" > "+temptraceOutputFolder+"/TraceDiffReportFile"+file[file.find("llfi.stat.trace")+len("llfi.stat.trace"):]
 			p =subprocess.call(cmd,shell=True,stderr=log_file)
 			traceFileCount += 1
 	#Check if trace files present, if not show error messages
@@ -158,6 +182,24 @@ def generateDotFile():
 			p =subprocess.call(cmd,shell=True,stderr=log_file)
 
 
+def generateAggregateDotFile():
+	log_path =os.path.abspath(os.path.join(traceOutputFolder, "stderr_log.txt"))
+	log_file =open(log_path ,'a')
+	goldenTraceDotFile = os.path.abspath(os.path.join(currentpath, "../../../llfi.stat.graph.dot"))
+	if not os.path.isfile(goldenTraceDotFile):
+		goldenTraceDotFile = os.path.abspath(os.path.join(currentpath, "../../llfi.stat.graph.dot"))
+	summaryFile = os.path.join(traceOutputFolder, "llfi.stat.trace.summary.bin")
+	# Argument lists avoid the shell, so no escaping of the paths is needed here
+	p = subprocess.call([os.path.join(scriptdir, "traceaggregate"), "-o", summaryFile, traceOutputFolder],
+		stdout=log_file, stderr=log_file)
+	if p != 0 or not os.path.isfile(summaryFile):
+		print ("traceaggregate failed, see stderr_log.txt in trace_report_output")
+		return
+	with open(os.path.join(traceOutputFolder, "TraceGraphAggregate.dot"), 'w') as dotFile:
+		subprocess.call([os.path.join(scriptdir, "traceontograph"), summaryFile, goldenTraceDotFile],
+			stdout=dotFile, stderr=log_file)
+
+
 def main(args):
 	global currentpath, scriptdir, traceOutputFolder, goldenTraceFilePath
 	parseArgs(args)
@@ -165,6 +207,8 @@ def main(args):
 	makeTraceOutputFolder()
 	executeTraceDiff()
 	generateDotFile()
+	if aggregate:
+		generateAggregateDotFile()
 
 if __name__=="__main__":
   main(sys.argv[1:])
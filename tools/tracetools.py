@@ -500,3 +500,38 @@ def parseFaultReportsfromFile(target):
 
   return reports
 
+
+#Propagation summaries written by traceaggregate (layout in TraceAggregate.h)
+AGGREGATE_MAGIC = b"LLFIAGG\0"
+AGGREGATE_HEADER = "<8sIIQQQ"
+AGGREGATE_SITE = "<qQQQd"
+
+class aggregateSite:
+  def __init__(self, record, numReports):
+    self.ID, self.injected, self.corrupted, self.ctrlDiverged, \
+      self.meanDistance = record
+    self.corruptionRate = 0.0
+    self.ctrlDivergenceRate = 0.0
+    if numReports > 0:
+      self.corruptionRate = float(self.corrupted) / numReports
+      self.ctrlDivergenceRate = float(self.ctrlDiverged) / numReports
+
+def isAggregateSummary(target):
+  with open(target, 'rb') as f:
+    return f.read(len(AGGREGATE_MAGIC)) == AGGREGATE_MAGIC
+
+def parseAggregateSummary(target):
+  import struct
+  with open(target, 'rb') as f:
+    data = f.read()
+  headerSize = struct.calcsize(AGGREGATE_HEADER)
+  magic, version, reserved, numReports, numCtrlReports, numSites = \
+    struct.unpack_from(AGGREGATE_HEADER, data, 0)
+  assert magic == AGGREGATE_MAGIC, "Not a traceaggregate summary file"
+  siteSize = struct.calcsize(AGGREGATE_SITE)
+  sites = {}
+  for i in range(numSites):
+    record = struct.unpack_from(AGGREGATE_SITE, data, headerSize + i * siteSize)
+    site = aggregateSite(record, numReports)
+    sites[site.ID] = site
+  return numReports, sites